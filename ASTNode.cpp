@@ -1,17 +1,86 @@
 #include "ASTNode.h"
 #include "bytecode.h"
+#include <algorithm>
+#include <cassert>
+
+/* ASTNode */
+ASTNode::ASTNode(int type)
+    : m_refs(), m_type(type), m_processed(), m_offset(-1)
+{
+    // Only a node new'd straight into the arena belongs to it, not one
+    // on the stack or inside something else
+    ASTArena* arena = ASTArena::s_active;
+    if (arena && !arena->m_pending.empty() && arena->m_pending.back() == this) {
+        arena->m_pending.pop_back();
+        arena->m_nodes.push_back(this);
+        m_refs.setImmortal();
+    }
+}
+
+void* ASTNode::operator new(size_t size)
+{
+    ASTArena* arena = ASTArena::s_active;
+    if (!arena)
+        return ::operator new(size);
+    void* mem = arena->m_arena.allocate(size);
+    arena->m_pending.push_back(mem);
+    return mem;
+}
+
+void ASTNode::operator delete(void* ptr)
+{
+    // Arena nodes are never deleted one by one, so this only sees arena
+    // memory when a constructor, or something evaluated for one, throws,
+    // which is still inside the scope that allocated it
+    ASTArena* arena = ASTArena::s_active;
+    if (arena && arena->m_arena.owns(ptr)) {
+        auto node = std::find(arena->m_nodes.rbegin(), arena->m_nodes.rend(), ptr);
+        if (node != arena->m_nodes.rend())
+            arena->m_nodes.erase(std::next(node).base());
+        auto pending = std::find(arena->m_pending.rbegin(), arena->m_pending.rend(), ptr);
+        if (pending != arena->m_pending.rend())
+            arena->m_pending.erase(std::next(pending).base());
+        return;
+    }
+    ::operator delete(ptr);
+}
+
+
+/* ASTArena */
+thread_local ASTArena* ASTArena::s_active = nullptr;
+
+ASTArena::~ASTArena()
+{
+    assert(s_active != this);
+
+    // The nodes still point at each other, but every one is immortal, so
+    // the references they drop don't touch the others' counts
+    for (ASTNode* node : m_nodes)
+        node->~ASTNode();
+    m_arena.release();
+}
+
+ASTArena::Scope::Scope(ASTArena& arena)
+    : m_arena(&arena), m_outer(s_active)
+{
+    s_active = m_arena;
+}
+
+ASTArena::Scope::~Scope()
+{
+    assert(s_active == m_arena);
+    s_active = m_outer;
+}
 
 /* ASTNodeList */
 void ASTNodeList::removeLast()
 {
-    list_t::iterator it = m_nodes.end();
-    --it;
-    m_nodes.erase(it);
+    m_nodes.pop_back();
 }
 
 void ASTNodeList::removeFirst()
 {
-    m_nodes.erase(m_nodes.begin());
+    m_nodes.pop_front();
 }
 
 
@@ -187,14 +256,12 @@ const char* ASTKeyword::word_str() const
 /* ASTBlock */
 void ASTBlock::removeLast()
 {
-    list_t::iterator it = m_nodes.end();
-    --it;
-    m_nodes.erase(it);
+    m_nodes.pop_back();
 }
 
 void ASTBlock::removeFirst()
 {
-    m_nodes.erase(m_nodes.begin());
+    m_nodes.pop_front();
 }
 
 const char* ASTBlock::type_str() const
@@ -2,9 +2,13 @@
 #define _PYC_ASTNODE_H
 
 #include "pyc_module.h"
+#include "pyc_arena.h"
+#include "pyc_small_vector.h"
 #include <list>
 #include <deque>
 
+class ASTArena;
+
 /* Similar interface to PycObject, so PycRef can work on it... *
  * However, this does *NOT* mean the two are interchangeable!  */
 class ASTNode {
@@ -24,18 +28,28 @@ public:
         NODE_LOCALS,
     };
 
-    ASTNode(int type = NODE_INVALID) : m_refs(), m_type(type), m_processed() { }
+    ASTNode(int type = NODE_INVALID);
     virtual ~ASTNode() { }
 
+    /* Nodes made while an ASTArena is active live in it */
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
+
     int type() const { return internalGetType(this); }
 
     bool processed() const { return m_processed; }
     void setProcessed() { m_processed = true; }
 
+    /* The bytecode offset a statement or block was built at, or -1 */
+    int offset() const { return m_offset; }
+    void setOffset(int offset) { m_offset = offset; }
+
 private:
-    int m_refs;
+    // Arena nodes are immortal; the arena frees them all at once
+    PycRefCount m_refs;
     int m_type;
     bool m_processed;
+    int m_offset;
 
     // Hack to make clang happy :(
     static int internalGetType(const ASTNode *node)
@@ -46,12 +60,12 @@ private:
     static void internalAddRef(ASTNode *node)
     {
         if (node)
-            ++node->m_refs;
+            node->m_refs.retain();
     }
 
     static void internalDelRef(ASTNode *node)
     {
-        if (node && --node->m_refs == 0)
+        if (node && node->m_refs.release())
             delete node;
     }
 
@@ -61,9 +75,55 @@ public:
 };
 
 
+/* Owns every node made while it is active, which is one decompilation:
+ * references between them skip counting, and they are all destroyed
+ * together when the arena goes.  It is only active inside a Scope, and
+ * scopes nest per thread; a node goes to the innermost one's arena, or
+ * the heap outside of any. */
+class ASTArena {
+public:
+    ASTArena() { }
+    ~ASTArena();
+
+    ASTArena(const ASTArena&) = delete;
+    ASTArena& operator=(const ASTArena&) = delete;
+
+    class Scope {
+    public:
+        explicit Scope(ASTArena& arena);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        ASTArena* m_arena;
+        ASTArena* m_outer;
+    };
+
+    static ASTArena* active() { return s_active; }
+
+    size_t nodeCount() const { return m_nodes.size(); }
+    size_t bytesUsed() const { return m_arena.bytesUsed(); }
+
+private:
+    friend class ASTNode;
+
+    static thread_local ASTArena* s_active;
+
+    PycArena m_arena;
+    std::vector<ASTNode*> m_nodes;
+
+    // Memory handed out for nodes not yet constructed.  Arguments to a
+    // node's constructor can make nodes of their own after its memory is
+    // allocated, but those are finished first, so it works as a stack.
+    std::vector<void*> m_pending;
+};
+
+
 class ASTNodeList : public ASTNode {
 public:
-    typedef std::list<PycRef<ASTNode>> list_t;
+    typedef PycSmallVector<PycRef<ASTNode>, 4> list_t;
 
     ASTNodeList(list_t nodes)
         : ASTNode(NODE_NODELIST), m_nodes(std::move(nodes)) { }
@@ -85,7 +145,7 @@ private:
 class ASTChainStore : public ASTNodeList {
 public:
     ASTChainStore(list_t nodes, PycRef<ASTNode> src)
-        : ASTNodeList(nodes, NODE_CHAINSTORE), m_src(std::move(src)) { }
+        : ASTNodeList(std::move(nodes), NODE_CHAINSTORE), m_src(std::move(src)) { }
     
     PycRef<ASTNode> src() const { return m_src; }
 
@@ -529,7 +589,7 @@ private:
 
 class ASTBlock : public ASTNode {
 public:
-    typedef std::list<PycRef<ASTNode>> list_t;
+    typedef PycSmallVector<PycRef<ASTNode>, 4> list_t;
 
     enum BlkType {
         BLK_MAIN, BLK_IF, BLK_ELSE, BLK_ELIF, BLK_TRY,
@@ -642,16 +702,16 @@ private:
 
 class ASTComprehension : public ASTNode {
 public:
-    typedef std::list<PycRef<ASTIterBlock>> generator_t;
+    typedef PycSmallVector<PycRef<ASTIterBlock>, 2> generator_t;
 
     ASTComprehension(PycRef<ASTNode> result)
         : ASTNode(NODE_COMPREHENSION), m_result(std::move(result)) { }
 
     PycRef<ASTNode> result() const { return m_result; }
-    generator_t generators() const { return m_generators; }
+    const generator_t& generators() const { return m_generators; }
 
     void addGenerator(PycRef<ASTIterBlock> gen) {
-        m_generators.emplace_front(std::move(gen));
+        m_generators.push_front(std::move(gen));
     }
 
 private:
@@ -17,19 +17,6 @@
 static void append_to_chain_store(const PycRef<ASTNode>& chainStore,
         PycRef<ASTNode> item, FastStack& stack, const PycRef<ASTBlock>& curblock);
 
-/* Use this to determine if an error occurred (and therefore, if we should
- * avoid cleaning the output tree) */
-static bool cleanBuild;
-
-/* Use this to prevent printing return keywords and newlines in lambdas. */
-static bool inLambda = false;
-
-/* Use this to keep track of whether we need to print out any docstring and
- * the list of global variables that we are using (such as inside a function). */
-static bool printDocstringAndGlobals = false;
-
-/* Use this to keep track of whether we need to print a class or module docstring */
-static bool printClassDocstring = true;
 
 // shortcut for all top/pop calls
 static PycRef<ASTNode> StackPopTop(FastStack& stack)
@@ -72,11 +59,57 @@ static void CheckIfExpr(FastStack& stack, PycRef<ASTBlock> curblock)
     stack.push(new ASTTernary(std::move(if_block), std::move(if_expr), std::move(else_expr)));
 }
 
-PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
+/* Notes where the blocks and statements built by an instruction came from,
+ * for source maps.  They are the unmarked ones at the end of the current
+ * block, or at the end of an unmarked block it just closed. */
+static void mark_offsets(const PycRef<ASTBlock>& curblock, int offset)
 {
-    PycBuffer source(code->code()->value(), code->code()->length());
+    std::vector<ASTBlock*> pending { curblock };
+    while (!pending.empty()) {
+        ASTBlock* blk = pending.back();
+        pending.pop_back();
+        if (blk->offset() < 0)
+            blk->setOffset(offset);
+        for (auto it = blk->nodes().rbegin(); it != blk->nodes().rend() && *it != NULL; ++it) {
+            if ((*it)->offset() >= 0)
+                break;
+            (*it)->setOffset(offset);
+            if ((*it).type() == ASTNode::NODE_BLOCK)
+                pending.push_back((*it).cast<ASTBlock>());
+        }
+    }
+}
 
-    FastStack stack((mod->majorVer() == 1) ? 20 : code->stackSize());
+PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod,
+                              DecompileContext& ctx)
+{
+    ASTArena::Scope arenaScope(ctx.arena);
+
+    const PycInstructions& insns = code->lowered(mod);
+    const PycExceptionTable& exceptions = code->exceptionIndex();
+
+    /* Code whose stack can't be followed statically won't build sensibly
+     * either, so from 3.9 on give up on it before starting.  Older code is
+     * only warned about, as the analysis is advisory there. */
+    const PycStackDepth& depths = code->stackDepth(mod);
+    switch (depths.status()) {
+    case PycStackDepth::STACK_UNDERFLOW:
+    case PycStackDepth::STACK_INCONSISTENT:
+    case PycStackDepth::STACK_UNBOUNDED:
+        if (mod->verCompare(3, 9) < 0) {
+            fprintf(stderr, "Warning: unexpected stack layout at %d: %s\n",
+                    depths.errorOffset(), depths.statusText());
+            break;
+        }
+        fprintf(stderr, "Unsupported stack layout at %d: %s\n", depths.errorOffset(),
+                depths.statusText());
+        ctx.cleanBuild = false;
+        return new ASTNodeList(ASTNodeList::list_t());
+    default:
+        // Unknown opcodes are reported by the builder when it reaches them
+        break;
+    }
+    FastStack stack;
     stackhist_t stack_hist;
 
     std::stack<PycRef<ASTBlock> > blocks;
@@ -85,15 +118,17 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
     PycRef<ASTBlock> curblock = defblock;
     blocks.push(defblock);
 
-    int opcode, operand;
+    int opcode, operand, target;
+    unsigned flags;
     int curpos = 0;
     int pos = 0;
+    size_t insn = 0;
     int unpack = 0;
     bool else_pop = false;
     bool need_try = false;
     bool variable_annotations = false;
 
-    while (!source.atEof()) {
+    while (insn < insns.size()) {
 #if defined(BLOCK_DEBUG) || defined(STACK_DEBUG)
         fprintf(stderr, "%-7d", pos);
     #ifdef STACK_DEBUG
@@ -107,8 +142,12 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
         fprintf(stderr, "\n");
 #endif
 
-        curpos = pos;
-        bc_next(source, mod, opcode, operand, pos);
+        curpos = insns.offset(insn);
+        opcode = insns.opcode(insn);
+        operand = insns.operand(insn);
+        target = insns.target(insn);
+        flags = insns.flags(insn);
+        pos = insns.next(insn++);
 
         if (need_try && opcode != Pyc::SETUP_EXCEPT_A) {
             need_try = false;
@@ -123,11 +162,9 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                 && opcode != Pyc::JUMP_IF_FALSE_A
                 && opcode != Pyc::JUMP_IF_FALSE_OR_POP_A
                 && opcode != Pyc::POP_JUMP_IF_FALSE_A
-                && opcode != Pyc::POP_JUMP_FORWARD_IF_FALSE_A
                 && opcode != Pyc::JUMP_IF_TRUE_A
                 && opcode != Pyc::JUMP_IF_TRUE_OR_POP_A
                 && opcode != Pyc::POP_JUMP_IF_TRUE_A
-                && opcode != Pyc::POP_JUMP_FORWARD_IF_TRUE_A
                 && opcode != Pyc::POP_BLOCK) {
             else_pop = false;
 
@@ -151,7 +188,18 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                     break;
 
                 curblock = blocks.top();
-                curblock->append(prev.cast<ASTNode>());
+                if (prev->blktype() == ASTBlock::BLK_IF && prev->size() == 0
+                        && prev->inited() == ASTCondBlock::POPPED && !stack.empty()) {
+                    /* A JUMP_IF_*_OR_POP with nothing but a value after it:
+                     * that's "a or b" / "a and b", not an if statement */
+                    PycRef<ASTCondBlock> cond = prev.cast<ASTCondBlock>();
+                    PycRef<ASTNode> value = stack.top();
+                    stack.pop();
+                    stack.push(new ASTBinary(cond->cond(), value, cond->negative()
+                            ? ASTBinary::BIN_LOG_OR : ASTBinary::BIN_LOG_AND));
+                } else {
+                    curblock->append(prev.cast<ASTNode>());
+                }
 
                 prev = curblock;
 
@@ -423,8 +471,6 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
             }
             break;
         case Pyc::CALL_A:
-        case Pyc::CALL_FUNCTION_A:
-        case Pyc::INSTRUMENTED_CALL_A:
             {
                 int kwparams = (operand & 0xFF00) >> 8;
                 int pparams = (operand & 0xFF);
@@ -473,7 +519,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                     co_consts[consti] must be a tuple of strings.
                     New in version 3.11.
                 */
-                if (mod->verCompare(3, 11) >= 0) {
+                if (flags & PycInstructions::FLAG_KW_NAMES) {
                     PycRef<ASTNode> object_or_map = stack.top();
                     if (object_or_map.type() == ASTNode::NODE_KW_NAMES_MAP) {
                         stack.pop();
@@ -515,8 +561,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                 }
                 PycRef<ASTNode> func = stack.top();
                 stack.pop();
-                if ((opcode == Pyc::CALL_A || opcode == Pyc::INSTRUMENTED_CALL_A) &&
-                        stack.top() == nullptr) {
+                if ((flags & PycInstructions::FLAG_POP_NULL) && stack.top() == nullptr) {
                     stack.pop();
                 }
 
@@ -644,12 +689,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                 stack.pop();
                 PycRef<ASTNode> left = stack.top();
                 stack.pop();
-                auto arg = operand;
-                if (mod->verCompare(3, 12) == 0)
-                    arg >>= 4; // changed under GH-100923
-                else if (mod->verCompare(3, 13) >= 0)
-                    arg >>= 5;
-                stack.push(new ASTCompare(left, right, arg));
+                stack.push(new ASTCompare(left, right, operand));
             }
             break;
         case Pyc::CONTAINS_OP_A:
@@ -676,8 +716,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
             {
                 PycRef<PycString> varname = code->getName(operand);
 
-                if (varname->length() >= 2 && varname->value()[0] == '_'
-                        && varname->value()[1] == '[') {
+                if (varname->startsWith("_[")) {
                     /* Don't show deletes that are a result of list comps. */
                     break;
                 }
@@ -690,13 +729,12 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
             {
                 PycRef<ASTNode> name;
 
-                if (mod->verCompare(1, 3) < 0)
+                if (!mod->has(PycModule::FEAT_LOCAL_NAMES))
                     name = new ASTName(code->getName(operand));
                 else
                     name = new ASTName(code->getLocal(operand));
 
-                if (name.cast<ASTName>()->name()->value()[0] == '_'
-                        && name.cast<ASTName>()->name()->value()[1] == '[') {
+                if (name.cast<ASTName>()->name()->startsWith("_[")) {
                     /* Don't show deletes that are a result of list comps. */
                     break;
                 }
@@ -894,7 +932,6 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
             }
             break;
         case Pyc::FOR_ITER_A:
-        case Pyc::INSTRUMENTED_FOR_ITER_A:
             {
                 PycRef<ASTNode> iter = stack.top(); // Iterable
                 stack.pop();
@@ -906,12 +943,9 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                 // before 3.8, there is a SETUP_LOOP instruction with block start and end position,
                 //    the operand is usually a jump to a POP_BLOCK instruction
                 // after 3.8, block extent has to be inferred implicitly; the operand is a jump to a position after the for block
-                if (mod->majorVer() == 3 && mod->minorVer() >= 8) {
-                    end = operand;
-                    if (mod->verCompare(3, 10) >= 0)
-                        end *= sizeof(uint16_t); // // BPO-27129
-                    end += pos;
-                    comprehension = strcmp(code->name()->value(), "<listcomp>") == 0;
+                if (mod->has(PycModule::FEAT_NO_SETUP_LOOP)) {
+                    end = target;
+                    comprehension = code->name()->isEqual("<listcomp>");
                 } else {
                     PycRef<ASTBlock> top = blocks.top();
                     end = top->end(); // block end position from SETUP_LOOP
@@ -1038,21 +1072,13 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
         case Pyc::JUMP_IF_TRUE_OR_POP_A:
         case Pyc::POP_JUMP_IF_FALSE_A:
         case Pyc::POP_JUMP_IF_TRUE_A:
-        case Pyc::POP_JUMP_FORWARD_IF_FALSE_A:
-        case Pyc::POP_JUMP_FORWARD_IF_TRUE_A:
-        case Pyc::INSTRUMENTED_POP_JUMP_IF_FALSE_A:
-        case Pyc::INSTRUMENTED_POP_JUMP_IF_TRUE_A:
             {
                 PycRef<ASTNode> cond = stack.top();
                 PycRef<ASTCondBlock> ifblk;
                 int popped = ASTCondBlock::UNINITED;
 
                 if (opcode == Pyc::POP_JUMP_IF_FALSE_A
-                        || opcode == Pyc::POP_JUMP_IF_TRUE_A
-                        || opcode == Pyc::POP_JUMP_FORWARD_IF_FALSE_A
-                        || opcode == Pyc::POP_JUMP_FORWARD_IF_TRUE_A
-                        || opcode == Pyc::INSTRUMENTED_POP_JUMP_IF_FALSE_A
-                        || opcode == Pyc::INSTRUMENTED_POP_JUMP_IF_TRUE_A) {
+                        || opcode == Pyc::POP_JUMP_IF_TRUE_A) {
                     /* Pop condition before the jump */
                     stack.pop();
                     popped = ASTCondBlock::PRE_POPPED;
@@ -1071,21 +1097,9 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                 /* "Jump if true" means "Jump if not false" */
                 bool neg = opcode == Pyc::JUMP_IF_TRUE_A
                         || opcode == Pyc::JUMP_IF_TRUE_OR_POP_A
-                        || opcode == Pyc::POP_JUMP_IF_TRUE_A
-                        || opcode == Pyc::POP_JUMP_FORWARD_IF_TRUE_A
-                        || opcode == Pyc::INSTRUMENTED_POP_JUMP_IF_TRUE_A;
-
-                int offs = operand;
-                if (mod->verCompare(3, 10) >= 0)
-                    offs *= sizeof(uint16_t); // // BPO-27129
-                if (mod->verCompare(3, 12) >= 0
-                        || opcode == Pyc::JUMP_IF_FALSE_A
-                        || opcode == Pyc::JUMP_IF_TRUE_A
-                        || opcode == Pyc::POP_JUMP_FORWARD_IF_TRUE_A
-                        || opcode == Pyc::POP_JUMP_FORWARD_IF_FALSE_A) {
-                    /* Offset is relative in these cases */
-                    offs += pos;
-                }
+                        || opcode == Pyc::POP_JUMP_IF_TRUE_A;
+
+                int offs = target;
 
                 if (cond.type() == ASTNode::NODE_COMPARE
                         && cond.cast<ASTCompare>()->op() == ASTCompare::CMP_EXCEPTION) {
@@ -1115,6 +1129,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                     /* We don't store the stack for loops! Pop it! */
                     stack_hist.pop();
                 } else if (curblock->size() == 0 && curblock->end() <= offs
+                           && curblock->inited() != ASTCondBlock::POPPED
                            && (curblock->blktype() == ASTBlock::BLK_IF
                            || curblock->blktype() == ASTBlock::BLK_ELIF
                            || curblock->blktype() == ASTBlock::BLK_WHILE)) {
@@ -1164,16 +1179,14 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
             break;
         case Pyc::JUMP_ABSOLUTE_A:
             {
-                int offs = operand;
-                if (mod->verCompare(3, 10) >= 0)
-                    offs *= sizeof(uint16_t); // // BPO-27129
+                int offs = target;
 
                 if (offs < pos) {
                     if (curblock->blktype() == ASTBlock::BLK_FOR) {
                         bool is_jump_to_start = offs == curblock.cast<ASTIterBlock>()->start();
                         bool should_pop_for_block = curblock.cast<ASTIterBlock>()->isComprehension();
                         // in v3.8, SETUP_LOOP is deprecated and for blocks aren't terminated by POP_BLOCK, so we add them here
-                        bool should_add_for_block = mod->majorVer() == 3 && mod->minorVer() >= 8 && is_jump_to_start && !curblock.cast<ASTIterBlock>()->isComprehension();
+                        bool should_add_for_block = mod->has(PycModule::FEAT_NO_SETUP_LOOP) && is_jump_to_start && !curblock.cast<ASTIterBlock>()->isComprehension();
 
                         if (should_pop_for_block || should_add_for_block) {
                             PycRef<ASTNode> top = stack.top();
@@ -1276,19 +1289,29 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
             }
             break;
         case Pyc::JUMP_FORWARD_A:
-        case Pyc::INSTRUMENTED_JUMP_FORWARD_A:
             {
-                int offs = operand;
-                if (mod->verCompare(3, 10) >= 0)
-                    offs *= sizeof(uint16_t); // // BPO-27129
+                /* With only the function's own block open, there is nothing
+                 * for this jump to close.  A 3.11+ try body at that level
+                 * ends this way, jumping over handlers we can't rebuild yet.
+                 * Stop here rather than unwind the block stack past its
+                 * bottom; every statement so far is already in defblock. */
+                if (blocks.size() == 1) {
+                    int handler = exceptions.nextHandler(pos);
+                    if (handler >= 0 && handler < target)
+                        fprintf(stderr, "Unsupported exception handler at %d\n", handler);
+                    else
+                        fprintf(stderr, "Unsupported jump from %d to %d\n", pos, target);
+                    ctx.cleanBuild = false;
+                    return new ASTNodeList(defblock->nodes());
+                }
 
                 if (curblock->blktype() == ASTBlock::BLK_CONTAINER) {
                     PycRef<ASTContainerBlock> cont = curblock.cast<ASTContainerBlock>();
                     if (cont->hasExcept()) {
                         stack_hist.push(stack);
 
-                        curblock->setEnd(pos+offs);
-                        PycRef<ASTBlock> except = new ASTCondBlock(ASTBlock::BLK_EXCEPT, pos+offs, NULL, false);
+                        curblock->setEnd(target);
+                        PycRef<ASTBlock> except = new ASTCondBlock(ASTBlock::BLK_EXCEPT, target, NULL, false);
                         except->init();
                         blocks.push(except);
                         curblock = blocks.top();
@@ -1314,7 +1337,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
 
                     if (prev->blktype() == ASTBlock::BLK_IF
                             || prev->blktype() == ASTBlock::BLK_ELIF) {
-                        if (offs == 0) {
+                        if (target == pos) {
                             prev = nil;
                             continue;
                         }
@@ -1322,7 +1345,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                         if (push) {
                             stack_hist.push(stack);
                         }
-                        PycRef<ASTBlock> next = new ASTBlock(ASTBlock::BLK_ELSE, pos+offs);
+                        PycRef<ASTBlock> next = new ASTBlock(ASTBlock::BLK_ELSE, target);
                         if (prev->inited() == ASTCondBlock::PRE_POPPED) {
                             next->init(ASTCondBlock::PRE_POPPED);
                         }
@@ -1330,7 +1353,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                         blocks.push(next.cast<ASTBlock>());
                         prev = nil;
                     } else if (prev->blktype() == ASTBlock::BLK_EXCEPT) {
-                        if (offs == 0) {
+                        if (target == pos) {
                             prev = nil;
                             continue;
                         }
@@ -1338,7 +1361,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                         if (push) {
                             stack_hist.push(stack);
                         }
-                        PycRef<ASTBlock> next = new ASTCondBlock(ASTBlock::BLK_EXCEPT, pos+offs, NULL, false);
+                        PycRef<ASTBlock> next = new ASTCondBlock(ASTBlock::BLK_EXCEPT, target, NULL, false);
                         next->init();
 
                         blocks.push(next.cast<ASTBlock>());
@@ -1357,7 +1380,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                             prev = nil;
                         }
                     } else if (prev->blktype() == ASTBlock::BLK_TRY
-                            && prev->end() < pos+offs) {
+                            && prev->end() < target) {
                         /* Need to add an except/finally block */
                         stack = stack_hist.top();
                         stack.pop();
@@ -1369,7 +1392,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                                     stack_hist.push(stack);
                                 }
 
-                                PycRef<ASTBlock> except = new ASTCondBlock(ASTBlock::BLK_EXCEPT, pos+offs, NULL, false);
+                                PycRef<ASTBlock> except = new ASTCondBlock(ASTBlock::BLK_EXCEPT, target, NULL, false);
                                 except->init();
                                 blocks.push(except);
                             }
@@ -1386,7 +1409,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                 curblock = blocks.top();
 
                 if (curblock->blktype() == ASTBlock::BLK_EXCEPT) {
-                    curblock->setEnd(pos+offs);
+                    curblock->setEnd(target);
                 }
             }
             break;
@@ -1468,15 +1491,9 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                 if (name.type() != ASTNode::NODE_IMPORT) {
                     stack.pop();
 
-                    if (mod->verCompare(3, 12) >= 0) {
-                        if (operand & 1) {
-                            /* Changed in version 3.12:
-                            If the low bit of name is set, then a NULL or self is pushed to the stack
-                            before the attribute or unbound method respectively. */
-                            stack.push(nullptr);
-                        }
-                        operand >>= 1;
-                    }
+                    /* A NULL or self goes before the attribute or unbound method (3.12+) */
+                    if (flags & PycInstructions::FLAG_PUSH_NULL)
+                        stack.push(nullptr);
 
                     stack.push(new ASTBinary(name, new ASTName(code->getName(operand)), ASTBinary::BIN_ATTR));
                 }
@@ -1509,26 +1526,16 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
             stack.push(new ASTName(code->getCellVar(mod, operand)));
             break;
         case Pyc::LOAD_FAST_A:
-            if (mod->verCompare(1, 3) < 0)
-                stack.push(new ASTName(code->getName(operand)));
-            else
-                stack.push(new ASTName(code->getLocal(operand)));
+            stack.push(new ASTName(code->getLocal(operand)));
             break;
         case Pyc::LOAD_FAST_LOAD_FAST_A:
             stack.push(new ASTName(code->getLocal(operand >> 4)));
             stack.push(new ASTName(code->getLocal(operand & 0xF)));
             break;
         case Pyc::LOAD_GLOBAL_A:
-            if (mod->verCompare(3, 11) >= 0) {
-                // Loads the global named co_names[namei>>1] onto the stack.
-                if (operand & 1) {
-                    /* Changed in version 3.11: 
-                    If the low bit of "NAMEI" (operand) is set, 
-                    then a NULL is pushed to the stack before the global variable. */
-                    stack.push(nullptr);
-                }
-                operand >>= 1;
-            }
+            /* A NULL goes before the global variable (3.11+) */
+            if (flags & PycInstructions::FLAG_PUSH_NULL)
+                stack.push(nullptr);
             stack.push(new ASTName(code->getName(operand)));
             break;
         case Pyc::LOAD_LOCALS:
@@ -1577,6 +1584,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
             }
             break;
         case Pyc::NOP:
+        case Pyc::EXTENDED_ARG_A:   // Left over from a very long prefix run
             break;
         case Pyc::POP_BLOCK:
             {
@@ -1788,12 +1796,15 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                     curblock = blocks.top();
                     curblock->append(prev.cast<ASTNode>());
 
-                    bc_next(source, mod, opcode, operand, pos);
+                    // Skip the jump over the else, if there is one
+                    if (insn < insns.size()
+                            && (insns.opcode(insn) == Pyc::JUMP_FORWARD_A
+                                || insns.opcode(insn) == Pyc::JUMP_ABSOLUTE_A))
+                        pos = insns.next(insn++);
                 }
             }
             break;
         case Pyc::RETURN_VALUE:
-        case Pyc::INSTRUMENTED_RETURN_VALUE_A:
             {
                 PycRef<ASTNode> value = stack.top();
                 stack.pop();
@@ -1811,12 +1822,15 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                     curblock = blocks.top();
                     curblock->append(prev.cast<ASTNode>());
 
-                    bc_next(source, mod, opcode, operand, pos);
+                    // Skip the jump over the else, if there is one
+                    if (insn < insns.size()
+                            && (insns.opcode(insn) == Pyc::JUMP_FORWARD_A
+                                || insns.opcode(insn) == Pyc::JUMP_ABSOLUTE_A))
+                        pos = insns.next(insn++);
                 }
             }
             break;
         case Pyc::RETURN_CONST_A:
-        case Pyc::INSTRUMENTED_RETURN_CONST_A:
             {
                 PycRef<ASTObject> value = new ASTObject(code->getConst(operand));
                 curblock->append(new ASTReturn(value.cast<ASTNode>()));
@@ -2064,7 +2078,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                 if (unpack) {
                     PycRef<ASTNode> name;
 
-                    if (mod->verCompare(1, 3) < 0)
+                    if (!mod->has(PycModule::FEAT_LOCAL_NAMES))
                         name = new ASTName(code->getName(operand));
                     else
                         name = new ASTName(code->getLocal(operand));
@@ -2097,13 +2111,12 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                     stack.pop();
                     PycRef<ASTNode> name;
 
-                    if (mod->verCompare(1, 3) < 0)
+                    if (!mod->has(PycModule::FEAT_LOCAL_NAMES))
                         name = new ASTName(code->getName(operand));
                     else
                         name = new ASTName(code->getLocal(operand));
 
-                    if (name.cast<ASTName>()->name()->value()[0] == '_'
-                            && name.cast<ASTName>()->name()->value()[1] == '[') {
+                    if (name.cast<ASTName>()->name()->startsWith("_[")) {
                         /* Don't show stores of list comp append objects. */
                         break;
                     }
@@ -2198,8 +2211,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                     stack.pop();
 
                     PycRef<PycString> varname = code->getName(operand);
-                    if (varname->length() >= 2 && varname->value()[0] == '_'
-                            && varname->value()[1] == '[') {
+                    if (varname->startsWith("_[")) {
                         /* Don't show stores of list comp append objects. */
                         break;
                     }
@@ -2428,7 +2440,6 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
             }
             break;
         case Pyc::YIELD_VALUE:
-        case Pyc::INSTRUMENTED_YIELD_VALUE_A:
             {
                 PycRef<ASTNode> value = stack.top();
                 stack.pop();
@@ -2440,7 +2451,6 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
             break;
         case Pyc::PRECALL_A:
         case Pyc::RESUME_A:
-        case Pyc::INSTRUMENTED_RESUME_A:
             /* We just entirely ignore this / no-op */
             break;
         case Pyc::CACHE:
@@ -2475,7 +2485,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
             break;
         default:
             fprintf(stderr, "Unsupported opcode: %s (%d)\n", Pyc::OpcodeName(opcode), opcode);
-            cleanBuild = false;
+            ctx.cleanBuild = false;
             return new ASTNodeList(defblock->nodes());
         }
 
@@ -2483,6 +2493,9 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
                       || (curblock->blktype() == ASTBlock::BLK_IF)
                       || (curblock->blktype() == ASTBlock::BLK_ELIF) )
                  && (curblock->end() == pos);
+
+        if (ctx.sourceMap)
+            mark_offsets(curblock, curpos);
     }
 
     if (stack_hist.size()) {
@@ -2504,7 +2517,7 @@ PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod)
         }
     }
 
-    cleanBuild = true;
+    ctx.cleanBuild = true;
     return new ASTNodeList(defblock->nodes());
 }
 
@@ -2582,73 +2595,81 @@ static int cmp_prec(PycRef<ASTNode> parent, PycRef<ASTNode> child)
 }
 
 static void print_ordered(PycRef<ASTNode> parent, PycRef<ASTNode> child,
-                          PycModule* mod, std::ostream& pyc_output)
+                          PycModule* mod, std::ostream& pyc_output,
+                          DecompileContext& ctx)
 {
     if (child.type() == ASTNode::NODE_BINARY ||
         child.type() == ASTNode::NODE_COMPARE) {
         if (cmp_prec(parent, child) > 0) {
             pyc_output << "(";
-            print_src(child, mod, pyc_output);
+            print_src(child, mod, pyc_output, ctx);
             pyc_output << ")";
         } else {
-            print_src(child, mod, pyc_output);
+            print_src(child, mod, pyc_output, ctx);
         }
     } else if (child.type() == ASTNode::NODE_UNARY) {
         if (cmp_prec(parent, child) > 0) {
             pyc_output << "(";
-            print_src(child, mod, pyc_output);
+            print_src(child, mod, pyc_output, ctx);
             pyc_output << ")";
         } else {
-            print_src(child, mod, pyc_output);
+            print_src(child, mod, pyc_output, ctx);
         }
     } else {
-        print_src(child, mod, pyc_output);
+        print_src(child, mod, pyc_output, ctx);
     }
 }
 
-static void start_line(int indent, std::ostream& pyc_output)
+static void start_line(int indent, std::ostream& pyc_output, DecompileContext& ctx)
 {
-    if (inLambda)
+    if (ctx.inLambda)
         return;
     for (int i=0; i<indent; i++)
         pyc_output << "    ";
 }
 
-static void end_line(std::ostream& pyc_output)
+static void end_line(std::ostream& pyc_output, DecompileContext& ctx)
 {
-    if (inLambda)
+    if (ctx.inLambda)
         return;
     pyc_output << "\n";
 }
 
-int cur_indent = -1;
+static void map_line(const PycRef<ASTNode>& node, std::ostream& pyc_output,
+                     DecompileContext& ctx)
+{
+    if (ctx.sourceMap && !ctx.inLambda && node != NULL && node->offset() >= 0)
+        ctx.sourceMap->push_back({ pyc_output.tellp(), ctx.mapCode, node->offset() });
+}
+
 static void print_block(PycRef<ASTBlock> blk, PycModule* mod,
-                        std::ostream& pyc_output)
+                        std::ostream& pyc_output, DecompileContext& ctx)
 {
-    ASTBlock::list_t lines = blk->nodes();
+    const ASTBlock::list_t& lines = blk->nodes();
 
     if (lines.size() == 0) {
         PycRef<ASTNode> pass = new ASTKeyword(ASTKeyword::KW_PASS);
-        start_line(cur_indent, pyc_output);
-        print_src(pass, mod, pyc_output);
+        start_line(ctx.indent, pyc_output, ctx);
+        print_src(pass, mod, pyc_output, ctx);
     }
 
     for (auto ln = lines.cbegin(); ln != lines.cend();) {
         if ((*ln).cast<ASTNode>().type() != ASTNode::NODE_NODELIST) {
-            start_line(cur_indent, pyc_output);
+            start_line(ctx.indent, pyc_output, ctx);
+            map_line(*ln, pyc_output, ctx);
         }
-        print_src(*ln, mod, pyc_output);
+        print_src(*ln, mod, pyc_output, ctx);
         if (++ln != lines.end()) {
-            end_line(pyc_output);
+            end_line(pyc_output, ctx);
         }
     }
 }
 
 void print_formatted_value(PycRef<ASTFormattedValue> formatted_value, PycModule* mod,
-                           std::ostream& pyc_output)
+                           std::ostream& pyc_output, DecompileContext& ctx)
 {
     pyc_output << "{";
-    print_src(formatted_value->val(), mod, pyc_output);
+    print_src(formatted_value->val(), mod, pyc_output, ctx);
 
     switch (formatted_value->conversion() & ASTFormattedValue::CONVERSION_MASK) {
     case ASTFormattedValue::NONE:
@@ -2664,16 +2685,17 @@ void print_formatted_value(PycRef<ASTFormattedValue> formatted_value, PycModule*
         break;
     }
     if (formatted_value->conversion() & ASTFormattedValue::HAVE_FMT_SPEC) {
-        pyc_output << ":" << formatted_value->format_spec().cast<ASTObject>()->object().cast<PycString>()->value();
+        pyc_output << ":" << formatted_value->format_spec().cast<ASTObject>()->object().cast<PycString>()->strValue();
     }
     pyc_output << "}";
 }
 
-void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
+void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output,
+               DecompileContext& ctx)
 {
     if (node == NULL) {
         pyc_output << "None";
-        cleanBuild = true;
+        ctx.cleanBuild = true;
         return;
     }
 
@@ -2682,54 +2704,54 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
     case ASTNode::NODE_COMPARE:
         {
             PycRef<ASTBinary> bin = node.cast<ASTBinary>();
-            print_ordered(node, bin->left(), mod, pyc_output);
+            print_ordered(node, bin->left(), mod, pyc_output, ctx);
             pyc_output << bin->op_str();
-            print_ordered(node, bin->right(), mod, pyc_output);
+            print_ordered(node, bin->right(), mod, pyc_output, ctx);
         }
         break;
     case ASTNode::NODE_UNARY:
         {
             PycRef<ASTUnary> un = node.cast<ASTUnary>();
             pyc_output << un->op_str();
-            print_ordered(node, un->operand(), mod, pyc_output);
+            print_ordered(node, un->operand(), mod, pyc_output, ctx);
         }
         break;
     case ASTNode::NODE_CALL:
         {
             PycRef<ASTCall> call = node.cast<ASTCall>();
-            print_src(call->func(), mod, pyc_output);
+            print_src(call->func(), mod, pyc_output, ctx);
             pyc_output << "(";
             bool first = true;
             for (const auto& param : call->pparams()) {
                 if (!first)
                     pyc_output << ", ";
-                print_src(param, mod, pyc_output);
+                print_src(param, mod, pyc_output, ctx);
                 first = false;
             }
             for (const auto& param : call->kwparams()) {
                 if (!first)
                     pyc_output << ", ";
                 if (param.first.type() == ASTNode::NODE_NAME) {
-                    pyc_output << param.first.cast<ASTName>()->name()->value() << " = ";
+                    pyc_output << param.first.cast<ASTName>()->name()->strValue() << " = ";
                 } else {
                     PycRef<PycString> str_name = param.first.cast<ASTObject>()->object().cast<PycString>();
-                    pyc_output << str_name->value() << " = ";
+                    pyc_output << str_name->strValue() << " = ";
                 }
-                print_src(param.second, mod, pyc_output);
+                print_src(param.second, mod, pyc_output, ctx);
                 first = false;
             }
             if (call->hasVar()) {
                 if (!first)
                     pyc_output << ", ";
                 pyc_output << "*";
-                print_src(call->var(), mod, pyc_output);
+                print_src(call->var(), mod, pyc_output, ctx);
                 first = false;
             }
             if (call->hasKW()) {
                 if (!first)
                     pyc_output << ", ";
                 pyc_output << "**";
-                print_src(call->kw(), mod, pyc_output);
+                print_src(call->kw(), mod, pyc_output, ctx);
                 first = false;
             }
             pyc_output << ")";
@@ -2738,30 +2760,30 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
     case ASTNode::NODE_DELETE:
         {
             pyc_output << "del ";
-            print_src(node.cast<ASTDelete>()->value(), mod, pyc_output);
+            print_src(node.cast<ASTDelete>()->value(), mod, pyc_output, ctx);
         }
         break;
     case ASTNode::NODE_EXEC:
         {
             PycRef<ASTExec> exec = node.cast<ASTExec>();
             pyc_output << "exec ";
-            print_src(exec->statement(), mod, pyc_output);
+            print_src(exec->statement(), mod, pyc_output, ctx);
 
             if (exec->globals() != NULL) {
                 pyc_output << " in ";
-                print_src(exec->globals(), mod, pyc_output);
+                print_src(exec->globals(), mod, pyc_output, ctx);
 
                 if (exec->locals() != NULL
                         && exec->globals() != exec->locals()) {
                     pyc_output << ", ";
-                    print_src(exec->locals(), mod, pyc_output);
+                    print_src(exec->locals(), mod, pyc_output, ctx);
                 }
             }
         }
         break;
     case ASTNode::NODE_FORMATTEDVALUE:
         pyc_output << "f" F_STRING_QUOTE;
-        print_formatted_value(node.cast<ASTFormattedValue>(), mod, pyc_output);
+        print_formatted_value(node.cast<ASTFormattedValue>(), mod, pyc_output, ctx);
         pyc_output << F_STRING_QUOTE;
         break;
     case ASTNode::NODE_JOINEDSTR:
@@ -2769,7 +2791,7 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
         for (const auto& val : node.cast<ASTJoinedStr>()->values()) {
             switch (val.type()) {
             case ASTNode::NODE_FORMATTEDVALUE:
-                print_formatted_value(val.cast<ASTFormattedValue>(), mod, pyc_output);
+                print_formatted_value(val.cast<ASTFormattedValue>(), mod, pyc_output, ctx);
                 break;
             case ASTNode::NODE_OBJECT:
                 // When printing a piece of the f-string, keep the quote style consistent.
@@ -2789,17 +2811,17 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
         {
             pyc_output << "[";
             bool first = true;
-            cur_indent++;
+            ctx.indent++;
             for (const auto& val : node.cast<ASTList>()->values()) {
                 if (first)
                     pyc_output << "\n";
                 else
                     pyc_output << ",\n";
-                start_line(cur_indent, pyc_output);
-                print_src(val, mod, pyc_output);
+                start_line(ctx.indent, pyc_output, ctx);
+                print_src(val, mod, pyc_output, ctx);
                 first = false;
             }
-            cur_indent--;
+            ctx.indent--;
             pyc_output << "]";
         }
         break;
@@ -2807,17 +2829,17 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
         {
             pyc_output << "{";
             bool first = true;
-            cur_indent++;
+            ctx.indent++;
             for (const auto& val : node.cast<ASTSet>()->values()) {
                 if (first)
                     pyc_output << "\n";
                 else
                     pyc_output << ",\n";
-                start_line(cur_indent, pyc_output);
-                print_src(val, mod, pyc_output);
+                start_line(ctx.indent, pyc_output, ctx);
+                print_src(val, mod, pyc_output, ctx);
                 first = false;
             }
-            cur_indent--;
+            ctx.indent--;
             pyc_output << "}";
         }
         break;
@@ -2826,16 +2848,16 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
             PycRef<ASTComprehension> comp = node.cast<ASTComprehension>();
 
             pyc_output << "[ ";
-            print_src(comp->result(), mod, pyc_output);
+            print_src(comp->result(), mod, pyc_output, ctx);
 
             for (const auto& gen : comp->generators()) {
                 pyc_output << " for ";
-                print_src(gen->index(), mod, pyc_output);
+                print_src(gen->index(), mod, pyc_output, ctx);
                 pyc_output << " in ";
-                print_src(gen->iter(), mod, pyc_output);
+                print_src(gen->iter(), mod, pyc_output, ctx);
                 if (gen->condition()) {
                     pyc_output << " if ";
-                    print_src(gen->condition(), mod, pyc_output);
+                    print_src(gen->condition(), mod, pyc_output, ctx);
                 }
             }
             pyc_output << " ]";
@@ -2845,19 +2867,19 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
         {
             pyc_output << "{";
             bool first = true;
-            cur_indent++;
+            ctx.indent++;
             for (const auto& val : node.cast<ASTMap>()->values()) {
                 if (first)
                     pyc_output << "\n";
                 else
                     pyc_output << ",\n";
-                start_line(cur_indent, pyc_output);
-                print_src(val.first, mod, pyc_output);
+                start_line(ctx.indent, pyc_output, ctx);
+                print_src(val.first, mod, pyc_output, ctx);
                 pyc_output << ": ";
-                print_src(val.second, mod, pyc_output);
+                print_src(val.second, mod, pyc_output, ctx);
                 first = false;
             }
-            cur_indent--;
+            ctx.indent--;
             pyc_output << " }";
         }
         break;
@@ -2876,23 +2898,24 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
                 map->add(new ASTObject(key), value);
             }
 
-            print_src(map, mod, pyc_output);
+            print_src(map, mod, pyc_output, ctx);
         }
         break;
     case ASTNode::NODE_NAME:
-        pyc_output << node.cast<ASTName>()->name()->value();
+        pyc_output << node.cast<ASTName>()->name()->strValue();
         break;
     case ASTNode::NODE_NODELIST:
         {
-            cur_indent++;
+            ctx.indent++;
             for (const auto& ln : node.cast<ASTNodeList>()->nodes()) {
                 if (ln.cast<ASTNode>().type() != ASTNode::NODE_NODELIST) {
-                    start_line(cur_indent, pyc_output);
+                    start_line(ctx.indent, pyc_output, ctx);
+                    map_line(ln, pyc_output, ctx);
                 }
-                print_src(ln, mod, pyc_output);
-                end_line(pyc_output);
+                print_src(ln, mod, pyc_output, ctx);
+                end_line(pyc_output, ctx);
             }
-            cur_indent--;
+            ctx.indent--;
         }
         break;
     case ASTNode::NODE_BLOCK:
@@ -2902,9 +2925,9 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
                 break;
 
             if (blk->blktype() == ASTBlock::BLK_CONTAINER) {
-                end_line(pyc_output);
-                print_block(blk, mod, pyc_output);
-                end_line(pyc_output);
+                end_line(pyc_output, ctx);
+                print_block(blk, mod, pyc_output, ctx);
+                end_line(pyc_output, ctx);
                 break;
             }
 
@@ -2917,30 +2940,30 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
                 else
                     pyc_output << " ";
 
-                print_src(blk.cast<ASTCondBlock>()->cond(), mod, pyc_output);
+                print_src(blk.cast<ASTCondBlock>()->cond(), mod, pyc_output, ctx);
             } else if (blk->blktype() == ASTBlock::BLK_FOR || blk->blktype() == ASTBlock::BLK_ASYNCFOR) {
                 pyc_output << " ";
-                print_src(blk.cast<ASTIterBlock>()->index(), mod, pyc_output);
+                print_src(blk.cast<ASTIterBlock>()->index(), mod, pyc_output, ctx);
                 pyc_output << " in ";
-                print_src(blk.cast<ASTIterBlock>()->iter(), mod, pyc_output);
+                print_src(blk.cast<ASTIterBlock>()->iter(), mod, pyc_output, ctx);
             } else if (blk->blktype() == ASTBlock::BLK_EXCEPT &&
                     blk.cast<ASTCondBlock>()->cond() != NULL) {
                 pyc_output << " ";
-                print_src(blk.cast<ASTCondBlock>()->cond(), mod, pyc_output);
+                print_src(blk.cast<ASTCondBlock>()->cond(), mod, pyc_output, ctx);
             } else if (blk->blktype() == ASTBlock::BLK_WITH) {
                 pyc_output << " ";
-                print_src(blk.cast<ASTWithBlock>()->expr(), mod, pyc_output);
+                print_src(blk.cast<ASTWithBlock>()->expr(), mod, pyc_output, ctx);
                 PycRef<ASTNode> var = blk.try_cast<ASTWithBlock>()->var();
                 if (var != NULL) {
                     pyc_output << " as ";
-                    print_src(var, mod, pyc_output);
+                    print_src(var, mod, pyc_output, ctx);
                 }
             }
             pyc_output << ":\n";
 
-            cur_indent++;
-            print_block(blk, mod, pyc_output);
-            cur_indent--;
+            ctx.indent++;
+            print_block(blk, mod, pyc_output, ctx);
+            ctx.indent--;
         }
         break;
     case ASTNode::NODE_OBJECT:
@@ -2948,7 +2971,7 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
             PycRef<PycObject> obj = node.cast<ASTObject>()->object();
             if (obj.type() == PycObject::TYPE_CODE) {
                 PycRef<PycCode> code = obj.cast<PycCode>();
-                decompyle(code, mod, pyc_output);
+                decompyle(code, mod, pyc_output, ctx);
             } else {
                 print_const(pyc_output, obj, mod);
             }
@@ -2960,14 +2983,14 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
             bool first = true;
             if (node.cast<ASTPrint>()->stream() != nullptr) {
                 pyc_output << ">>";
-                print_src(node.cast<ASTPrint>()->stream(), mod, pyc_output);
+                print_src(node.cast<ASTPrint>()->stream(), mod, pyc_output, ctx);
                 first = false;
             }
 
             for (const auto& val : node.cast<ASTPrint>()->values()) {
                 if (!first)
                     pyc_output << ", ";
-                print_src(val, mod, pyc_output);
+                print_src(val, mod, pyc_output, ctx);
                 first = false;
             }
             if (!node.cast<ASTPrint>()->eol())
@@ -2982,7 +3005,7 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
             for (const auto& param : raise->params()) {
                 if (!first)
                     pyc_output << ", ";
-                print_src(param, mod, pyc_output);
+                print_src(param, mod, pyc_output, ctx);
                 first = false;
             }
         }
@@ -2991,7 +3014,7 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
         {
             PycRef<ASTReturn> ret = node.cast<ASTReturn>();
             PycRef<ASTNode> value = ret->value();
-            if (!inLambda) {
+            if (!ctx.inLambda) {
                 switch (ret->rettype()) {
                 case ASTReturn::RETURN:
                     pyc_output << "return ";
@@ -3009,7 +3032,7 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
                     break;
                 }
             }
-            print_src(value, mod, pyc_output);
+            print_src(value, mod, pyc_output, ctx);
         }
         break;
     case ASTNode::NODE_SLICE:
@@ -3017,11 +3040,11 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
             PycRef<ASTSlice> slice = node.cast<ASTSlice>();
 
             if (slice->op() & ASTSlice::SLICE1) {
-                print_src(slice->left(), mod, pyc_output);
+                print_src(slice->left(), mod, pyc_output, ctx);
             }
             pyc_output << ":";
             if (slice->op() & ASTSlice::SLICE2) {
-                print_src(slice->right(), mod, pyc_output);
+                print_src(slice->right(), mod, pyc_output, ctx);
             }
         }
         break;
@@ -3033,37 +3056,37 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
 
                 pyc_output << "from ";
                 if (import->name().type() == ASTNode::NODE_IMPORT)
-                    print_src(import->name().cast<ASTImport>()->name(), mod, pyc_output);
+                    print_src(import->name().cast<ASTImport>()->name(), mod, pyc_output, ctx);
                 else
-                    print_src(import->name(), mod, pyc_output);
+                    print_src(import->name(), mod, pyc_output, ctx);
                 pyc_output << " import ";
 
                 if (stores.size() == 1) {
                     auto src = stores.front()->src();
                     auto dest = stores.front()->dest();
-                    print_src(src, mod, pyc_output);
+                    print_src(src, mod, pyc_output, ctx);
 
-                    if (src.cast<ASTName>()->name()->value() != dest.cast<ASTName>()->name()->value()) {
+                    if (!src.cast<ASTName>()->name()->isEqual(dest.cast<ASTName>()->name()->strValue())) {
                         pyc_output << " as ";
-                        print_src(dest, mod, pyc_output);
+                        print_src(dest, mod, pyc_output, ctx);
                     }
                 } else {
                     bool first = true;
                     for (const auto& st : stores) {
                         if (!first)
                             pyc_output << ", ";
-                        print_src(st->src(), mod, pyc_output);
+                        print_src(st->src(), mod, pyc_output, ctx);
                         first = false;
 
-                        if (st->src().cast<ASTName>()->name()->value() != st->dest().cast<ASTName>()->name()->value()) {
+                        if (!st->src().cast<ASTName>()->name()->isEqual(st->dest().cast<ASTName>()->name()->strValue())) {
                             pyc_output << " as ";
-                            print_src(st->dest(), mod, pyc_output);
+                            print_src(st->dest(), mod, pyc_output, ctx);
                         }
                     }
                 }
             } else {
                 pyc_output << "import ";
-                print_src(import->name(), mod, pyc_output);
+                print_src(import->name(), mod, pyc_output, ctx);
             }
         }
         break;
@@ -3080,10 +3103,10 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
             for (int i=0; i<code_src->argCount(); i++) {
                 if (narg)
                     pyc_output << ", ";
-                pyc_output << code_src->getLocal(narg++)->value();
+                pyc_output << code_src->getLocal(narg++)->strValue();
                 if ((code_src->argCount() - i) <= (int)defargs.size()) {
                     pyc_output << " = ";
-                    print_src(*da++, mod, pyc_output);
+                    print_src(*da++, mod, pyc_output, ctx);
                 }
             }
             da = kwdefargs.cbegin();
@@ -3091,18 +3114,18 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
                 pyc_output << (narg == 0 ? "*" : ", *");
                 for (int i = 0; i < code_src->argCount(); i++) {
                     pyc_output << ", ";
-                    pyc_output << code_src->getLocal(narg++)->value();
+                    pyc_output << code_src->getLocal(narg++)->strValue();
                     if ((code_src->kwOnlyArgCount() - i) <= (int)kwdefargs.size()) {
                         pyc_output << " = ";
-                        print_src(*da++, mod, pyc_output);
+                        print_src(*da++, mod, pyc_output, ctx);
                     }
                 }
             }
             pyc_output << ": ";
 
-            inLambda = true;
-            print_src(code, mod, pyc_output);
-            inLambda = false;
+            ctx.inLambda = true;
+            print_src(code, mod, pyc_output, ctx);
+            ctx.inLambda = false;
 
             pyc_output << ")";
         }
@@ -3116,19 +3139,19 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
                 PycRef<PycCode> code_src = code.cast<ASTObject>()->object().cast<PycCode>();
                 bool isLambda = false;
 
-                if (strcmp(code_src->name()->value(), "<lambda>") == 0) {
+                if (code_src->name()->isEqual("<lambda>")) {
                     pyc_output << "\n";
-                    start_line(cur_indent, pyc_output);
-                    print_src(dest, mod, pyc_output);
+                    start_line(ctx.indent, pyc_output, ctx);
+                    print_src(dest, mod, pyc_output, ctx);
                     pyc_output << " = lambda ";
                     isLambda = true;
                 } else {
                     pyc_output << "\n";
-                    start_line(cur_indent, pyc_output);
+                    start_line(ctx.indent, pyc_output, ctx);
                     if (code_src->flags() & PycCode::CO_COROUTINE)
                         pyc_output << "async ";
                     pyc_output << "def ";
-                    print_src(dest, mod, pyc_output);
+                    print_src(dest, mod, pyc_output, ctx);
                     pyc_output << "(";
                 }
 
@@ -3139,10 +3162,10 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
                 for (int i = 0; i < code_src->argCount(); ++i) {
                     if (narg)
                         pyc_output << ", ";
-                    pyc_output << code_src->getLocal(narg++)->value();
+                    pyc_output << code_src->getLocal(narg++)->strValue();
                     if ((code_src->argCount() - i) <= (int)defargs.size()) {
                         pyc_output << " = ";
-                        print_src(*da++, mod, pyc_output);
+                        print_src(*da++, mod, pyc_output, ctx);
                     }
                 }
                 da = kwdefargs.cbegin();
@@ -3150,42 +3173,42 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
                     pyc_output << (narg == 0 ? "*" : ", *");
                     for (int i = 0; i < code_src->kwOnlyArgCount(); ++i) {
                         pyc_output << ", ";
-                        pyc_output << code_src->getLocal(narg++)->value();
+                        pyc_output << code_src->getLocal(narg++)->strValue();
                         if ((code_src->kwOnlyArgCount() - i) <= (int)kwdefargs.size()) {
                             pyc_output << " = ";
-                            print_src(*da++, mod, pyc_output);
+                            print_src(*da++, mod, pyc_output, ctx);
                         }
                     }
                 }
                 if (code_src->flags() & PycCode::CO_VARARGS) {
                     if (narg)
                         pyc_output << ", ";
-                    pyc_output << "*" << code_src->getLocal(narg++)->value();
+                    pyc_output << "*" << code_src->getLocal(narg++)->strValue();
                 }
                 if (code_src->flags() & PycCode::CO_VARKEYWORDS) {
                     if (narg)
                         pyc_output << ", ";
-                    pyc_output << "**" << code_src->getLocal(narg++)->value();
+                    pyc_output << "**" << code_src->getLocal(narg++)->strValue();
                 }
 
                 if (isLambda) {
                     pyc_output << ": ";
                 } else {
                     pyc_output << "):\n";
-                    printDocstringAndGlobals = true;
+                    ctx.printDocstringAndGlobals = true;
                 }
 
-                bool preLambda = inLambda;
-                inLambda |= isLambda;
+                bool preLambda = ctx.inLambda;
+                ctx.inLambda |= isLambda;
 
-                print_src(code, mod, pyc_output);
+                print_src(code, mod, pyc_output, ctx);
 
-                inLambda = preLambda;
+                ctx.inLambda = preLambda;
             } else if (src.type() == ASTNode::NODE_CLASS) {
                 pyc_output << "\n";
-                start_line(cur_indent, pyc_output);
+                start_line(ctx.indent, pyc_output, ctx);
                 pyc_output << "class ";
-                print_src(dest, mod, pyc_output);
+                print_src(dest, mod, pyc_output, ctx);
                 PycRef<ASTTuple> bases = src.cast<ASTClass>()->bases().cast<ASTTuple>();
                 if (bases->values().size() > 0) {
                     pyc_output << "(";
@@ -3193,7 +3216,7 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
                     for (const auto& val : bases->values()) {
                         if (!first)
                             pyc_output << ", ";
-                        print_src(val, mod, pyc_output);
+                        print_src(val, mod, pyc_output, ctx);
                         first = false;
                     }
                     pyc_output << "):\n";
@@ -3201,10 +3224,10 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
                     // Don't put parens if there are no base classes
                     pyc_output << ":\n";
                 }
-                printClassDocstring = true;
+                ctx.printClassDocstring = true;
                 PycRef<ASTNode> code = src.cast<ASTClass>()->code().cast<ASTCall>()
                                        ->func().cast<ASTFunction>()->code();
-                print_src(code, mod, pyc_output);
+                print_src(code, mod, pyc_output, ctx);
             } else if (src.type() == ASTNode::NODE_IMPORT) {
                 PycRef<ASTImport> import = src.cast<ASTImport>();
                 if (import->fromlist() != NULL) {
@@ -3212,9 +3235,9 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
                     if (fromlist != Pyc_None) {
                         pyc_output << "from ";
                         if (import->name().type() == ASTNode::NODE_IMPORT)
-                            print_src(import->name().cast<ASTImport>()->name(), mod, pyc_output);
+                            print_src(import->name().cast<ASTImport>()->name(), mod, pyc_output, ctx);
                         else
-                            print_src(import->name(), mod, pyc_output);
+                            print_src(import->name(), mod, pyc_output, ctx);
                         pyc_output << " import ";
                         if (fromlist.type() == PycObject::TYPE_TUPLE ||
                                 fromlist.type() == PycObject::TYPE_SMALL_TUPLE) {
@@ -3222,56 +3245,56 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
                             for (const auto& val : fromlist.cast<PycTuple>()->values()) {
                                 if (!first)
                                     pyc_output << ", ";
-                                pyc_output << val.cast<PycString>()->value();
+                                pyc_output << val.cast<PycString>()->strValue();
                                 first = false;
                             }
                         } else {
-                            pyc_output << fromlist.cast<PycString>()->value();
+                            pyc_output << fromlist.cast<PycString>()->strValue();
                         }
                     } else {
                         pyc_output << "import ";
-                        print_src(import->name(), mod, pyc_output);
+                        print_src(import->name(), mod, pyc_output, ctx);
                     }
                 } else {
                     pyc_output << "import ";
                     PycRef<ASTNode> import_name = import->name();
-                    print_src(import_name, mod, pyc_output);
+                    print_src(import_name, mod, pyc_output, ctx);
                     if (!dest.cast<ASTName>()->name()->isEqual(import_name.cast<ASTName>()->name().cast<PycObject>())) {
                         pyc_output << " as ";
-                        print_src(dest, mod, pyc_output);
+                        print_src(dest, mod, pyc_output, ctx);
                     }
                 }
             } else if (src.type() == ASTNode::NODE_BINARY
                     && src.cast<ASTBinary>()->is_inplace()) {
-                print_src(src, mod, pyc_output);
+                print_src(src, mod, pyc_output, ctx);
             } else {
-                print_src(dest, mod, pyc_output);
+                print_src(dest, mod, pyc_output, ctx);
                 pyc_output << " = ";
-                print_src(src, mod, pyc_output);
+                print_src(src, mod, pyc_output, ctx);
             }
         }
         break;
     case ASTNode::NODE_CHAINSTORE:
         {
             for (auto& dest : node.cast<ASTChainStore>()->nodes()) {
-                print_src(dest, mod, pyc_output);
+                print_src(dest, mod, pyc_output, ctx);
                 pyc_output << " = ";
             }
-            print_src(node.cast<ASTChainStore>()->src(), mod, pyc_output);
+            print_src(node.cast<ASTChainStore>()->src(), mod, pyc_output, ctx);
         }
         break;
     case ASTNode::NODE_SUBSCR:
         {
-            print_src(node.cast<ASTSubscr>()->name(), mod, pyc_output);
+            print_src(node.cast<ASTSubscr>()->name(), mod, pyc_output, ctx);
             pyc_output << "[";
-            print_src(node.cast<ASTSubscr>()->key(), mod, pyc_output);
+            print_src(node.cast<ASTSubscr>()->key(), mod, pyc_output, ctx);
             pyc_output << "]";
         }
         break;
     case ASTNode::NODE_CONVERT:
         {
             pyc_output << "`";
-            print_src(node.cast<ASTConvert>()->name(), mod, pyc_output);
+            print_src(node.cast<ASTConvert>()->name(), mod, pyc_output, ctx);
             pyc_output << "`";
         }
         break;
@@ -3285,7 +3308,7 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
             for (const auto& val : values) {
                 if (!first)
                     pyc_output << ", ";
-                print_src(val, mod, pyc_output);
+                print_src(val, mod, pyc_output, ctx);
                 first = false;
             }
             if (values.size() == 1)
@@ -3300,9 +3323,9 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
             PycRef<ASTObject> name = annotated_var->name().cast<ASTObject>();
             PycRef<ASTNode> annotation = annotated_var->annotation();
 
-            pyc_output << name->object().cast<PycString>()->value();
+            pyc_output << name->object().cast<PycString>()->strValue();
             pyc_output << ": ";
-            print_src(annotation, mod, pyc_output);
+            print_src(annotation, mod, pyc_output, ctx);
         }
         break;
     case ASTNode::NODE_TERNARY:
@@ -3317,34 +3340,34 @@ void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output)
              */
             PycRef<ASTTernary> ternary = node.cast<ASTTernary>();
             //pyc_output << "(";
-            print_src(ternary->if_expr(), mod, pyc_output);
+            print_src(ternary->if_expr(), mod, pyc_output, ctx);
             const auto if_block = ternary->if_block().cast<ASTCondBlock>();
             pyc_output << " if ";
             if (if_block->negative())
                 pyc_output << "not ";
-            print_src(if_block->cond(), mod, pyc_output);
+            print_src(if_block->cond(), mod, pyc_output, ctx);
             pyc_output << " else ";
-            print_src(ternary->else_expr(), mod, pyc_output);
+            print_src(ternary->else_expr(), mod, pyc_output, ctx);
             //pyc_output << ")";
         }
         break;
     default:
         pyc_output << "<NODE:" << node->type() << ">";
         fprintf(stderr, "Unsupported Node type: %d\n", node->type());
-        cleanBuild = false;
+        ctx.cleanBuild = false;
         return;
     }
 
-    cleanBuild = true;
+    ctx.cleanBuild = true;
 }
 
 bool print_docstring(PycRef<PycObject> obj, int indent, PycModule* mod,
-                     std::ostream& pyc_output)
+                     std::ostream& pyc_output, DecompileContext& ctx)
 {
     // docstrings are translated from the bytecode __doc__ = 'string' to simply '''string'''
     auto doc = obj.try_cast<PycString>();
     if (doc != nullptr) {
-        start_line(indent, pyc_output);
+        start_line(indent, pyc_output, ctx);
         doc->print(pyc_output, mod, true);
         pyc_output << "\n";
         return true;
@@ -3352,12 +3375,23 @@ bool print_docstring(PycRef<PycObject> obj, int indent, PycModule* mod,
     return false;
 }
 
-void decompyle(PycRef<PycCode> code, PycModule* mod, std::ostream& pyc_output)
+void decompyle(PycRef<PycCode> code, PycModule* mod, std::ostream& pyc_output,
+               SourceMap* sourceMap)
 {
-    PycRef<ASTNode> source = BuildFromCode(code, mod);
+    DecompileContext ctx(sourceMap);
+    decompyle(code, mod, pyc_output, ctx);
+}
+
+void decompyle(PycRef<PycCode> code, PycModule* mod, std::ostream& pyc_output,
+               DecompileContext& ctx)
+{
+    // Also covers the nodes print_src makes along the way
+    ASTArena::Scope arenaScope(ctx.arena);
+
+    PycRef<ASTNode> source = BuildFromCode(code, mod, ctx);
 
     PycRef<ASTNodeList> clean = source.cast<ASTNodeList>();
-    if (cleanBuild) {
+    if (ctx.cleanBuild) {
         // The Python compiler adds some stuff that we don't really care
         // about, and would add extra code for re-compilation anyway.
         // We strip these lines out here, and then add a "pass" statement
@@ -3392,13 +3426,13 @@ void decompyle(PycRef<PycCode> code, PycModule* mod, std::ostream& pyc_output)
         }
 
         // Class and module docstrings may only appear at the beginning of their source
-        if (printClassDocstring && clean->nodes().front().type() == ASTNode::NODE_STORE) {
+        if (ctx.printClassDocstring && clean->nodes().front().type() == ASTNode::NODE_STORE) {
             PycRef<ASTStore> store = clean->nodes().front().cast<ASTStore>();
             if (store->dest().type() == ASTNode::NODE_NAME &&
                     store->dest().cast<ASTName>()->name()->isEqual("__doc__") &&
                     store->src().type() == ASTNode::NODE_OBJECT) {
                 if (print_docstring(store->src().cast<ASTObject>()->object(),
-                        cur_indent + (code->name()->isEqual("<module>") ? 0 : 1), mod, pyc_output))
+                        ctx.indent + (code->name()->isEqual("<module>") ? 0 : 1), mod, pyc_output, ctx))
                     clean->removeFirst();
             }
         }
@@ -3412,39 +3446,42 @@ void decompyle(PycRef<PycCode> code, PycModule* mod, std::ostream& pyc_output)
             }
         }
     }
-    if (printClassDocstring)
-        printClassDocstring = false;
+    if (ctx.printClassDocstring)
+        ctx.printClassDocstring = false;
     // This is outside the clean check so a source block will always
     // be compilable, even if decompylation failed.
     if (clean->nodes().size() == 0 && !code.isIdent(mod->code()))
         clean->append(new ASTKeyword(ASTKeyword::KW_PASS));
 
-    bool part1clean = cleanBuild;
+    bool part1clean = ctx.cleanBuild;
 
-    if (printDocstringAndGlobals) {
+    if (ctx.printDocstringAndGlobals) {
         if (code->consts()->size())
-            print_docstring(code->getConst(0), cur_indent + 1, mod, pyc_output);
+            print_docstring(code->getConst(0), ctx.indent + 1, mod, pyc_output, ctx);
 
         PycCode::globals_t globs = code->getGlobals();
         if (globs.size()) {
-            start_line(cur_indent + 1, pyc_output);
+            start_line(ctx.indent + 1, pyc_output, ctx);
             pyc_output << "global ";
             bool first = true;
             for (const auto& glob : globs) {
                 if (!first)
                     pyc_output << ", ";
-                pyc_output << glob->value();
+                pyc_output << glob->strValue();
                 first = false;
             }
             pyc_output << "\n";
         }
-        printDocstringAndGlobals = false;
+        ctx.printDocstringAndGlobals = false;
     }
 
-    print_src(source, mod, pyc_output);
+    PycRef<PycCode> outerCode = ctx.mapCode;
+    ctx.mapCode = code;
+    print_src(source, mod, pyc_output, ctx);
+    ctx.mapCode = outerCode;
 
-    if (!cleanBuild || !part1clean) {
-        start_line(cur_indent, pyc_output);
+    if (!ctx.cleanBuild || !part1clean) {
+        start_line(ctx.indent, pyc_output, ctx);
         pyc_output << "# WARNING: Decompyle incomplete\n";
     }
 }
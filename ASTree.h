@@ -2,10 +2,68 @@
 #define _PYC_ASTREE_H
 
 #include "ASTNode.h"
+#include <ostream>
+#include <vector>
 
-PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod);
-void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output);
+/* Where a decompiled statement starts in the output, and the code object
+ * and bytecode offset it was built from */
+struct SourceMapEntry {
+    std::streamoff outPos;
+    PycRef<PycCode> code;
+    int offset;
+};
+typedef std::vector<SourceMapEntry> SourceMap;
 
-void decompyle(PycRef<PycCode> code, PycModule* mod, std::ostream& pyc_output);
+/* Everything one decompilation keeps track of as it builds and prints the
+ * code objects of a module.  Separate contexts share nothing, so threads
+ * can each run their own at once.  The nodes built come from its arena,
+ * which is only active while decompyle() or BuildFromCode() runs with the
+ * context, and they are only good for as long as the context is. */
+struct DecompileContext {
+    explicit DecompileContext(SourceMap* sourceMap = nullptr)
+        : cleanBuild(), inLambda(), printDocstringAndGlobals(),
+          printClassDocstring(true), indent(-1), sourceMap(sourceMap) { }
+
+    DecompileContext(const DecompileContext&) = delete;
+    DecompileContext& operator=(const DecompileContext&) = delete;
+
+    // First, so it outlives every node reference below
+    ASTArena arena;
+
+    /* Use this to determine if an error occurred (and therefore, if we
+     * should avoid cleaning the output tree) */
+    bool cleanBuild;
+
+    /* Use this to prevent printing return keywords and newlines in lambdas */
+    bool inLambda;
+
+    /* Use this to keep track of whether we need to print out any docstring
+     * and the list of global variables that we are using (such as inside a
+     * function) */
+    bool printDocstringAndGlobals;
+
+    /* Use this to keep track of whether we need to print a class or module
+     * docstring */
+    bool printClassDocstring;
+
+    int indent;
+
+    /* The source map being filled in, if any, and the code object whose
+     * statements are being printed */
+    SourceMap* sourceMap;
+    PycRef<PycCode> mapCode;
+};
+
+PycRef<ASTNode> BuildFromCode(PycRef<PycCode> code, PycModule* mod,
+                              DecompileContext& ctx);
+void print_src(PycRef<ASTNode> node, PycModule* mod, std::ostream& pyc_output,
+               DecompileContext& ctx);
+
+/* Given a source map, every statement printed for the module is added to
+ * it.  outPos comes from tellp(), so the stream must support it. */
+void decompyle(PycRef<PycCode> code, PycModule* mod, std::ostream& pyc_output,
+               SourceMap* sourceMap = nullptr);
+void decompyle(PycRef<PycCode> code, PycModule* mod, std::ostream& pyc_output,
+               DecompileContext& ctx);
 
 #endif
@@ -4,50 +4,100 @@
 #include "ASTNode.h"
 #include <stack>
 
+/* The decompiler's value stack, kept as a persistent linked list: push and
+ * pop never change a cell once it is made, so copies share everything below
+ * their tops.  Saving one in a stackhist_t costs O(1), and restoring it is a
+ * pointer swap. */
 class FastStack {
 public:
-    FastStack(int size) : m_ptr(-1) { m_stack.resize(size); }
+    FastStack() : m_top(nullptr) { }
 
-    FastStack(const FastStack& copy)
-        : m_stack(copy.m_stack), m_ptr(copy.m_ptr) { }
+    FastStack(const FastStack& copy) : m_top(copy.m_top) { retain(m_top); }
+
+    FastStack(FastStack&& move) noexcept : m_top(move.m_top) { move.m_top = nullptr; }
+
+    ~FastStack() { release(m_top); }
 
     FastStack& operator=(const FastStack& copy)
     {
-        m_stack = copy.m_stack;
-        m_ptr = copy.m_ptr;
+        retain(copy.m_top);
+        release(m_top);
+        m_top = copy.m_top;
         return *this;
     }
 
-    void push(PycRef<ASTNode> node)
+    FastStack& operator=(FastStack&& move) noexcept
     {
-        if (static_cast<int>(m_stack.size()) == m_ptr + 1)
-            m_stack.emplace_back(nullptr);
+        if (this != &move) {
+            release(m_top);
+            m_top = move.m_top;
+            move.m_top = nullptr;
+        }
+        return *this;
+    }
 
-        m_stack[++m_ptr] = std::move(node);
+    void push(PycRef<ASTNode> node)
+    {
+        // The new cell takes over our reference to the old top
+        m_top = new Cell(std::move(node), m_top);
     }
 
     void pop()
     {
-        if (m_ptr > -1)
-            m_stack[m_ptr--] = nullptr;
+        Cell* cell = m_top;
+        if (!cell)
+            return;
+        m_top = cell->next;
+        if (cell->refs == 1) {
+            // Nothing else shares it, so its reference to the next is ours
+            cell->next = nullptr;
+            delete cell;
+        } else {
+            --cell->refs;
+            retain(m_top);
+        }
     }
 
     PycRef<ASTNode> top() const
     {
-        if (m_ptr > -1)
-            return m_stack[m_ptr];
+        if (m_top)
+            return m_top->value;
         else
             return nullptr;
     }
 
     bool empty() const
     {
-        return m_ptr == -1;
+        return m_top == nullptr;
     }
 
 private:
-    std::vector<PycRef<ASTNode>> m_stack;
-    int m_ptr;
+    struct Cell {
+        Cell(PycRef<ASTNode> value, Cell* next)
+            : value(std::move(value)), next(next), refs(1) { }
+
+        PycRef<ASTNode> value;
+        Cell* next;
+        int refs;
+    };
+
+    static void retain(Cell* cell)
+    {
+        if (cell)
+            ++cell->refs;
+    }
+
+    // Iterative, so dropping a deep stack doesn't recurse once per cell
+    static void release(Cell* cell)
+    {
+        while (cell && --cell->refs == 0) {
+            Cell* next = cell->next;
+            delete cell;
+            cell = next;
+        }
+    }
+
+    Cell* m_top;
 };
 
 typedef std::stack<FastStack> stackhist_t;
@@ -0,0 +1,50 @@
+#ifndef _PYC_BENCH_H
+#define _PYC_BENCH_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifndef WIN32
+#include <sys/resource.h>
+#endif
+
+/* Shared helpers for the benchmark programs in this directory */
+
+static inline double bench_now()
+{
+    using namespace std::chrono;
+    return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+}
+
+/* Parses an optional leading "-n <iterations>" and returns the index of the
+ * first remaining argument. */
+static inline int bench_parse_iterations(int argc, char* argv[], int& iterations)
+{
+    int arg = 1;
+    if (arg + 1 < argc && strcmp(argv[arg], "-n") == 0) {
+        iterations = atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if (iterations < 1)
+        iterations = 1;
+    return arg;
+}
+
+static inline void bench_report(const char* label, double seconds, long items)
+{
+    printf("%-28s %10.3f ms  %12.1f ns/item\n", label, seconds * 1000.0,
+           items ? (seconds * 1e9) / (double)items : 0.0);
+}
+
+static inline void bench_report_rss()
+{
+#ifndef WIN32
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        printf("%-28s %10ld KiB\n", "peak RSS", (long)usage.ru_maxrss);
+#endif
+}
+
+#endif
@@ -0,0 +1,69 @@
+#include "bench.h"
+#include "bytecode.h"
+#include <exception>
+#include <vector>
+
+static void collect_code(PycRef<PycCode> code, std::vector<PycRef<PycCode>>& out)
+{
+    out.push_back(code);
+    PycRef<PycSequence> consts = code->consts();
+    for (size_t i = 0; i < consts->size(); ++i) {
+        PycRef<PycObject> obj = consts->get(i);
+        if (obj.type() == PycObject::TYPE_CODE || obj.type() == PycObject::TYPE_CODE2)
+            collect_code(obj.cast<PycCode>(), out);
+    }
+}
+
+/* Measures instruction decoding (bc_next) over every code object in the
+ * .pyc files named on the command line.  The modules are loaded once,
+ * outside the timed loop. */
+int main(int argc, char* argv[])
+{
+    int iterations = 200;
+    int first = bench_parse_iterations(argc, argv, iterations);
+    if (first >= argc) {
+        fprintf(stderr, "Usage:  %s [-n iterations] input.pyc [...]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<PycModule> modules(argc - first);
+    std::vector<std::pair<PycModule*, PycRef<PycCode>>> codes;
+    for (int arg = first; arg < argc; ++arg) {
+        PycModule& mod = modules[arg - first];
+        try {
+            mod.loadFromFile(argv[arg]);
+        } catch (std::exception& ex) {
+            fprintf(stderr, "Error loading %s: %s\n", argv[arg], ex.what());
+            continue;
+        }
+        if (!mod.isValid() || mod.code() == NULL)
+            continue;
+
+        std::vector<PycRef<PycCode>> found;
+        collect_code(mod.code(), found);
+        for (auto& code : found)
+            codes.emplace_back(&mod, code);
+    }
+
+    long instructions = 0;
+    int checksum = 0;
+    double start = bench_now();
+    for (int i = 0; i < iterations; ++i) {
+        for (const auto& entry : codes) {
+            PycRef<PycString> bytes = entry.second->code();
+            PycBuffer source(bytes->data(), bytes->length());
+            int opcode, operand, pos = 0;
+            while (!source.atEof()) {
+                bc_next(source, entry.first, opcode, operand, pos);
+                checksum += opcode ^ operand;
+                ++instructions;
+            }
+        }
+    }
+    double elapsed = bench_now() - start;
+
+    printf("%ld instructions in %zu code objects (checksum %d)\n", instructions,
+           codes.size(), checksum);
+    bench_report("bc_next", elapsed, instructions);
+    return 0;
+}
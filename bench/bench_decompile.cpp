@@ -0,0 +1,95 @@
+#include "bench.h"
+#include "ASTree.h"
+#include <exception>
+#include <new>
+#include <ostream>
+#include <streambuf>
+#include <vector>
+
+/* Every trip through the global allocator, so the cost of building and
+ * tearing down the AST shows up as a count as well as a time */
+static long s_allocations = 0;
+static long s_frees = 0;
+
+void* operator new(size_t size)
+{
+    ++s_allocations;
+    if (void* ptr = malloc(size ? size : 1))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr) {
+        ++s_frees;
+        free(ptr);
+    }
+}
+
+void operator delete(void* ptr, size_t) noexcept
+{
+    operator delete(ptr);
+}
+
+/* Takes everything and keeps nothing, so the printer still formats it all */
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int ch) override { return ch; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+/* Times decompyle() over the .pyc files named on the command line, which
+ * are loaded once up front, and counts the allocations it makes. */
+int main(int argc, char* argv[])
+{
+    int iterations = 20;
+    int first = bench_parse_iterations(argc, argv, iterations);
+    if (first >= argc) {
+        fprintf(stderr, "Usage:  %s [-n iterations] input.pyc [...]\n", argv[0]);
+        return 1;
+    }
+
+    std::vector<PycModule*> modules;
+    for (int arg = first; arg < argc; ++arg) {
+        PycModule* mod = new PycModule;
+        try {
+            mod->loadFromFile(argv[arg]);
+        } catch (std::exception& ex) {
+            fprintf(stderr, "Error loading %s: %s\n", argv[arg], ex.what());
+        }
+        if (mod->isValid())
+            modules.push_back(mod);
+        else
+            delete mod;
+    }
+
+    NullBuffer buffer;
+    std::ostream out(&buffer);
+    long runs = 0, failed = 0;
+    long allocations = s_allocations, frees = s_frees;
+    double start = bench_now();
+    for (int i = 0; i < iterations; ++i) {
+        for (PycModule* mod : modules) {
+            try {
+                decompyle(mod->code(), mod, out);
+            } catch (std::exception&) {
+                ++failed;
+            }
+            ++runs;
+        }
+    }
+    double elapsed = bench_now() - start;
+    allocations = s_allocations - allocations;
+    frees = s_frees - frees;
+
+    printf("%ld decompiles of %zu modules (%ld failed)\n", runs, modules.size(), failed);
+    bench_report("decompyle", elapsed, runs);
+    printf("%-28s %12.1f\n", "allocations per module", runs ? (double)allocations / runs : 0.0);
+    printf("%-28s %12.1f\n", "frees per module", runs ? (double)frees / runs : 0.0);
+    bench_report_rss();
+
+    for (PycModule* mod : modules)
+        delete mod;
+    return 0;
+}
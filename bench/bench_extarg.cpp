@@ -0,0 +1,176 @@
+#include "bench.h"
+#include "bytecode.h"
+#include <random>
+#include <string>
+#include <vector>
+
+/* One instruction as the interpreter sees it, EXTENDED_ARG prefixes and all */
+struct RefInsn {
+    int offset, opcode, operand, next;
+};
+
+/* The straightforward decoder: each prefix shifts what it has so far up by
+ * one argument's width, 8 bits in wordcode and 16 before, in a 32 bit int
+ * like ceval's oparg. */
+static std::vector<RefInsn> ref_decode(const std::string& code, PycModule* mod)
+{
+    const int* map = mod->opcodeMap();
+    const bool wordcode = mod->has(PycModule::FEAT_WORDCODE);
+    std::vector<RefInsn> result;
+    uint32_t ext = 0;
+    int start = 0;
+    size_t pos = 0;
+    while (pos < code.size()) {
+        int opcode = Pyc::DecodeOpcode(map, (unsigned char)code[pos]);
+        uint32_t arg = 0;
+        if (wordcode) {
+            arg = (unsigned char)code[pos + 1];
+            pos += 2;
+        } else if (opcode >= Pyc::PYC_HAVE_ARG) {
+            arg = (unsigned char)code[pos + 1] | ((unsigned char)code[pos + 2] << 8);
+            pos += 3;
+        } else {
+            pos += 1;
+        }
+        ext = (ext << (wordcode ? 8 : 16)) | arg;
+        if (opcode == Pyc::EXTENDED_ARG_A)
+            continue;
+        result.push_back({ start, opcode, (int)ext, (int)pos });
+        ext = 0;
+        start = (int)pos;
+    }
+    return result;
+}
+
+/* Random code for a version: opcodes it knows, each behind a run of
+ * prefixes that is usually short and now and then far longer than an
+ * instruction length can hold. */
+static std::string make_code(PycModule* mod, std::mt19937& rng, size_t count)
+{
+    const int* map = mod->opcodeMap();
+    const bool wordcode = mod->has(PycModule::FEAT_WORDCODE);
+    std::vector<int> plain, with_arg;
+    int extended = -1;
+    for (int byte = 0; byte < 256; ++byte) {
+        int opcode = Pyc::DecodeOpcode(map, byte);
+        if (opcode == Pyc::EXTENDED_ARG_A)
+            extended = byte;
+        else if (opcode >= Pyc::PYC_HAVE_ARG)
+            with_arg.push_back(byte);
+        else if (opcode != Pyc::PYC_INVALID_OPCODE)
+            plain.push_back(byte);
+    }
+
+    std::string code;
+    for (size_t i = 0; i < count; ++i) {
+        unsigned roll = rng() % 1000;
+        int prefixes = (roll < 500) ? 0 : (roll < 800) ? 1 : (roll < 950) ? 2
+                     : (roll < 995) ? 3 + (int)(rng() % 3) : 100 + (int)(rng() % 200);
+        if (extended < 0 || (!wordcode && with_arg.empty()))
+            prefixes = 0;
+        for (int p = 0; p < prefixes; ++p) {
+            code += (char)extended;
+            code += (char)rng();
+            if (!wordcode)
+                code += (char)rng();
+        }
+
+        bool has_arg = wordcode || prefixes > 0 || plain.empty() || (rng() & 1);
+        const std::vector<int>& pool = has_arg ? with_arg : plain;
+        code += (char)pool[rng() % pool.size()];
+        if (wordcode) {
+            code += (char)rng();
+        } else if (has_arg) {
+            code += (char)rng();
+            code += (char)rng();
+        }
+    }
+    return code;
+}
+
+/* Checks bc_decode() against the reference.  Where it splits up a long
+ * prefix run, the pieces must be bare EXTENDED_ARGs running straight into
+ * the folded instruction. */
+static bool check(const std::string& bytes, PycModule* mod, const char* label)
+{
+    PycRef<PycString> code = new PycString;
+    code->setValue(bytes);
+    PycInstructions insns;
+    bc_decode(code, mod, insns);
+    std::vector<RefInsn> expected = ref_decode(bytes, mod);
+
+    size_t idx = 0;
+    for (const RefInsn& ref : expected) {
+        int start = (idx < insns.size()) ? insns.offset(idx) : -1;
+        while (idx + 1 < insns.size() && insns.opcode(idx) == Pyc::EXTENDED_ARG_A
+                && insns.operand(idx) == 0 && insns.next(idx) == insns.offset(idx + 1)
+                && insns.next(idx) < ref.next)
+            ++idx;
+        if (idx >= insns.size() || start != ref.offset || insns.opcode(idx) != ref.opcode
+                || insns.operand(idx) != ref.operand || insns.next(idx) != ref.next
+                || insns.length(idx) > PycInstructions::MAX_LENGTH) {
+            fprintf(stderr, "%s: mismatch at offset %d: expected %s %d\n", label, ref.offset,
+                    Pyc::OpcodeName(ref.opcode), ref.operand);
+            return false;
+        }
+        ++idx;
+    }
+    if (idx != insns.size()) {
+        fprintf(stderr, "%s: %zu extra instructions\n", label, insns.size() - idx);
+        return false;
+    }
+    return true;
+}
+
+/* Fuzzes EXTENDED_ARG folding in bc_decode() against a plain reference
+ * decoder, then times it on huge synthetic functions. */
+int main(int argc, char* argv[])
+{
+    int iterations = 20;
+    bench_parse_iterations(argc, argv, iterations);
+
+    static const struct {
+        const char* label;
+        unsigned int magic;
+    } versions[] = {
+        { "2.7", MAGIC_2_7 },
+        { "3.6", MAGIC_3_6 },
+        { "3.11", MAGIC_3_11 },
+        { "3.12", MAGIC_3_12 },
+    };
+
+    std::mt19937 rng(20161);
+    int failures = 0;
+    for (const auto& version : versions) {
+        PycModule mod;
+        mod.setVersion(version.magic);
+        for (int round = 0; round < 2000; ++round) {
+            if (!check(make_code(&mod, rng, 1 + rng() % 64), &mod, version.label)) {
+                ++failures;
+                break;
+            }
+        }
+    }
+    printf("fuzz: %s\n", failures ? "FAILED" : "ok");
+
+    for (const auto& version : versions) {
+        PycModule mod;
+        mod.setVersion(version.magic);
+        PycRef<PycString> code = new PycString;
+        code->setValue(make_code(&mod, rng, 1000000));
+
+        long instructions = 0;
+        double start = bench_now();
+        for (int i = 0; i < iterations; ++i) {
+            PycInstructions insns;
+            bc_decode(code, &mod, insns);
+            instructions += (long)insns.size();
+        }
+        double elapsed = bench_now() - start;
+
+        char label[32];
+        snprintf(label, sizeof(label), "bc_decode %s", version.label);
+        bench_report(label, elapsed, instructions);
+    }
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,59 @@
+#include "bench.h"
+#include "pyc_module.h"
+#include <exception>
+
+/* Measures the marshal load phase (PycModule::loadFromFile) over the .pyc
+ * files named on the command line.  With --lazy, nested code objects are
+ * only scanned, as for a "list/find one function" workload.  With --arena,
+ * objects come from a per-module arena that is released in bulk.  With
+ * --header-only, just the headers are read (PycModule::loadHeaderFromFile). */
+int main(int argc, char* argv[])
+{
+    int iterations = 20;
+    int first = bench_parse_iterations(argc, argv, iterations);
+    bool lazy = false, arena = false, header_only = false;
+    for (; first < argc && argv[first][0] == '-'; ++first) {
+        if (strcmp(argv[first], "--lazy") == 0)
+            lazy = true;
+        else if (strcmp(argv[first], "--arena") == 0)
+            arena = true;
+        else if (strcmp(argv[first], "--header-only") == 0)
+            header_only = true;
+        else
+            break;
+    }
+    if (first >= argc) {
+        fprintf(stderr, "Usage:  %s [-n iterations] [--lazy] [--arena] [--header-only]"
+                        " input.pyc [...]\n", argv[0]);
+        return 1;
+    }
+
+    long loads = 0, failed = 0;
+    double start = bench_now();
+    for (int i = 0; i < iterations; ++i) {
+        for (int arg = first; arg < argc; ++arg) {
+            PycModule mod;
+            mod.setLazyCode(lazy);
+            mod.setUseArena(arena);
+            try {
+                if (header_only) {
+                    if (!mod.loadHeaderFromFile(argv[arg]))
+                        ++failed;
+                } else {
+                    mod.loadFromFile(argv[arg]);
+                }
+            } catch (std::exception&) {
+                ++failed;
+            }
+            ++loads;
+        }
+    }
+    double elapsed = bench_now() - start;
+
+    printf("%ld loads of %d files (%ld failed)\n", loads, argc - first, failed);
+    bench_report(header_only ? "load (header only)"
+                 : lazy ? (arena ? "load (lazy, arena)" : "load (lazy)")
+                 : (arena ? "load (arena)" : "load"), elapsed, loads);
+    bench_report_rss();
+    return 0;
+}
@@ -0,0 +1,106 @@
+#include "bench.h"
+#include "ASTree.h"
+#include <atomic>
+#include <exception>
+#include <ostream>
+#include <streambuf>
+#include <thread>
+#include <vector>
+
+#ifdef PYC_ATOMIC_REFS
+#define REFCOUNTS "atomic"
+#else
+#define REFCOUNTS "plain"
+#endif
+
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int ch) override { return ch; }
+    std::streamsize xsputn(const char*, std::streamsize count) override { return count; }
+};
+
+/* Swaps references to two objects around a ring of slots, so every step is
+ * one count up and one down, and never the last */
+static void bench_refs(const char* label, PycRef<PycObject> obj, PycRef<PycObject> other,
+                       long steps)
+{
+    std::vector<PycRef<PycObject>> slots(64, obj);
+    double start = bench_now();
+    for (long i = 0; i < steps; ++i) {
+        PycRef<PycObject>& slot = slots[i & 63];
+        slot = (slot == obj) ? other : obj;
+    }
+    bench_report(label, bench_now() - start, steps);
+}
+
+/* Loads and decompiles every file with the given number of threads, each
+ * with its own modules and DecompileContext */
+static void bench_pool(int threads, int iterations, char* files[], int count)
+{
+    std::atomic<long> next(0), failed(0);
+    const long total = (long)iterations * count;
+    auto worker = [&]() {
+        NullBuffer buffer;
+        std::ostream out(&buffer);
+        for (long job = next++; job < total; job = next++) {
+            const char* filename = files[job % count];
+            try {
+                PycModule mod;
+                mod.loadFromFile(filename);
+                if (!mod.isValid()) {
+                    ++failed;
+                    continue;
+                }
+                DecompileContext ctx;
+                decompyle(mod.code(), &mod, out, ctx);
+            } catch (std::exception&) {
+                ++failed;
+            }
+        }
+    };
+
+    double start = bench_now();
+    std::vector<std::thread> pool;
+    for (int i = 0; i < threads; ++i)
+        pool.emplace_back(worker);
+    for (std::thread& thread : pool)
+        thread.join();
+    double elapsed = bench_now() - start;
+
+    char label[64];
+    snprintf(label, sizeof(label), "load+decompyle, %d thread%s", threads,
+             threads == 1 ? "" : "s");
+    bench_report(label, elapsed, total);
+    if (failed)
+        printf("  (%ld failed)\n", (long)failed);
+}
+
+/* Shows what the refcount mode costs: reference traffic on its own, then
+ * whole modules loaded and decompiled on one thread and on several.
+ * Build with and without ENABLE_ATOMIC_REFS to compare. */
+int main(int argc, char* argv[])
+{
+    int iterations = 3;
+    int first = bench_parse_iterations(argc, argv, iterations);
+    int threads = (int)std::thread::hardware_concurrency();
+    if (first + 1 < argc && strcmp(argv[first], "-j") == 0) {
+        threads = atoi(argv[first + 1]);
+        first += 2;
+    }
+    if (threads < 1)
+        threads = 1;
+    if (first >= argc) {
+        fprintf(stderr, "Usage:  %s [-n iterations] [-j threads] input.pyc [...]\n", argv[0]);
+        return 1;
+    }
+
+    printf("refcounts: " REFCOUNTS "\n");
+    const long steps = 50000000;
+    bench_refs("PycRef assign", new PycObject, new PycObject, steps);
+    bench_refs("PycRef assign (immortal)", Pyc_None, Pyc_True, steps);
+
+    bench_pool(1, iterations, argv + first, argc - first);
+    if (threads > 1)
+        bench_pool(threads, iterations, argv + first, argc - first);
+    return 0;
+}
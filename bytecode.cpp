@@ -1,6 +1,7 @@
 #include "pyc_numeric.h"
 #include "bytecode.h"
 #include <stdexcept>
+#include <algorithm>
 #include <cstdint>
 #include <cmath>
 
@@ -9,7 +10,7 @@
 #endif
 
 #define DECLARE_PYTHON(maj, min) \
-    extern int python_##maj##_##min##_map(int);
+    extern const int python_##maj##_##min##_map[256];
 
 DECLARE_PYTHON(1, 0)
 DECLARE_PYTHON(1, 1)
@@ -40,6 +41,13 @@ DECLARE_PYTHON(3, 11)
 DECLARE_PYTHON(3, 12)
 DECLARE_PYTHON(3, 13)
 
+#define DECLARE_CACHES(maj, min) \
+    extern const unsigned char python_##maj##_##min##_caches[256];
+
+DECLARE_CACHES(3, 11)
+DECLARE_CACHES(3, 12)
+DECLARE_CACHES(3, 13)
+
 const char* Pyc::OpcodeName(int opcode)
 {
     static const char* opcode_names[] = {
@@ -63,56 +71,84 @@ const char* Pyc::OpcodeName(int opcode)
     if (opcode < PYC_LAST_OPCODE)
         return opcode_names[opcode];
 
-    static char badcode[16];
+    static thread_local char badcode[16];
     snprintf(badcode, sizeof(badcode), "<%d>", opcode);
     return badcode;
 };
 
-int Pyc::ByteToOpcode(int maj, int min, int opcode)
+static constexpr int invalid_lookup(int)
+{
+    return Pyc::PYC_INVALID_OPCODE;
+}
+
+static constexpr int invalid_map[256] = { PYC_OPCODE_TABLE(invalid_lookup) };
+
+const int* Pyc::OpcodeMap(int maj, int min)
 {
     switch (maj) {
     case 1:
         switch (min) {
-        case 0: return python_1_0_map(opcode);
-        case 1: return python_1_1_map(opcode);
-        case 3: return python_1_3_map(opcode);
-        case 4: return python_1_4_map(opcode);
-        case 5: return python_1_5_map(opcode);
-        case 6: return python_1_6_map(opcode);
+        case 0: return python_1_0_map;
+        case 1: return python_1_1_map;
+        case 3: return python_1_3_map;
+        case 4: return python_1_4_map;
+        case 5: return python_1_5_map;
+        case 6: return python_1_6_map;
         }
         break;
     case 2:
         switch (min) {
-        case 0: return python_2_0_map(opcode);
-        case 1: return python_2_1_map(opcode);
-        case 2: return python_2_2_map(opcode);
-        case 3: return python_2_3_map(opcode);
-        case 4: return python_2_4_map(opcode);
-        case 5: return python_2_5_map(opcode);
-        case 6: return python_2_6_map(opcode);
-        case 7: return python_2_7_map(opcode);
+        case 0: return python_2_0_map;
+        case 1: return python_2_1_map;
+        case 2: return python_2_2_map;
+        case 3: return python_2_3_map;
+        case 4: return python_2_4_map;
+        case 5: return python_2_5_map;
+        case 6: return python_2_6_map;
+        case 7: return python_2_7_map;
         }
         break;
     case 3:
         switch (min) {
-        case 0: return python_3_0_map(opcode);
-        case 1: return python_3_1_map(opcode);
-        case 2: return python_3_2_map(opcode);
-        case 3: return python_3_3_map(opcode);
-        case 4: return python_3_4_map(opcode);
-        case 5: return python_3_5_map(opcode);
-        case 6: return python_3_6_map(opcode);
-        case 7: return python_3_7_map(opcode);
-        case 8: return python_3_8_map(opcode);
-        case 9: return python_3_9_map(opcode);
-        case 10: return python_3_10_map(opcode);
-        case 11: return python_3_11_map(opcode);
-        case 12: return python_3_12_map(opcode);
-        case 13: return python_3_13_map(opcode);
+        case 0: return python_3_0_map;
+        case 1: return python_3_1_map;
+        case 2: return python_3_2_map;
+        case 3: return python_3_3_map;
+        case 4: return python_3_4_map;
+        case 5: return python_3_5_map;
+        case 6: return python_3_6_map;
+        case 7: return python_3_7_map;
+        case 8: return python_3_8_map;
+        case 9: return python_3_9_map;
+        case 10: return python_3_10_map;
+        case 11: return python_3_11_map;
+        case 12: return python_3_12_map;
+        case 13: return python_3_13_map;
         }
         break;
     }
-    return PYC_INVALID_OPCODE;
+    return invalid_map;
+}
+
+static constexpr unsigned char no_caches[256] = { };
+
+const unsigned char* Pyc::CacheMap(int maj, int min)
+{
+    if (maj == 3) {
+        switch (min) {
+        case 11: return python_3_11_caches;
+        case 12: return python_3_12_caches;
+        case 13: return python_3_13_caches;
+        }
+    }
+    return no_caches;
+}
+
+int Pyc::ByteToOpcode(int maj, int min, int opcode)
+{
+    if (opcode < 0 || opcode > 255)
+        return PYC_INVALID_OPCODE;
+    return OpcodeMap(maj, min)[opcode];
 }
 
 void print_const(std::ostream& pyc_output, PycRef<PycObject> obj, PycModule* mod,
@@ -269,39 +305,240 @@ void print_const(std::ostream& pyc_output, PycRef<PycObject> obj, PycModule* mod
         break;
     case PycObject::TYPE_CODE:
     case PycObject::TYPE_CODE2:
-        pyc_output << "<CODE> " << obj.cast<PycCode>()->name()->value();
+        pyc_output << "<CODE> " << obj.cast<PycCode>()->name()->strValue();
         break;
     default:
         formatted_print(pyc_output, "<TYPE: %d>\n", obj->type());
     }
 }
 
+/* PycData::get16(), but with the byte reads inlined */
+static inline int bc_get16(PycBuffer& source)
+{
+    int result = source.getByte() & 0xFF;
+    result |= (source.getByte() & 0xFF) << 8;
+    return result;
+}
+
 void bc_next(PycBuffer& source, PycModule* mod, int& opcode, int& operand, int& pos)
 {
-    opcode = Pyc::ByteToOpcode(mod->majorVer(), mod->minorVer(), source.getByte());
-    if (mod->verCompare(3, 6) >= 0) {
+    /* Any number of EXTENDED_ARG prefixes are folded into the instruction
+     * they precede, each shifting the operand up by one argument's width.
+     * Bits shifted past 32 are lost, as they are in ceval's int oparg. */
+    const int* map = mod->opcodeMap();
+    int byte = source.getByte();
+    opcode = Pyc::DecodeOpcode(map, byte);
+    if (mod->has(PycModule::FEAT_WORDCODE)) {
         operand = source.getByte();
         pos += 2;
         if (opcode == Pyc::EXTENDED_ARG_A) {
-            opcode = Pyc::ByteToOpcode(mod->majorVer(), mod->minorVer(), source.getByte());
-            operand = (operand << 8) | source.getByte();
-            pos += 2;
+            unsigned arg = (unsigned)operand;
+            do {
+                byte = source.getByte();
+                opcode = Pyc::DecodeOpcode(map, byte);
+                arg = (arg << 8) | (source.getByte() & 0xFF);
+                pos += 2;
+            } while (opcode == Pyc::EXTENDED_ARG_A && !source.atEof());
+            operand = (int)arg;
         }
+
+        /* The inline CACHE entries of 3.11+ are stepped over in one go, as
+         * part of the instruction.  Relative jumps count from past them. */
+        const int caches = (byte >= 0) ? mod->cacheMap()[byte] : 0;
+        source.skip(caches * sizeof(uint16_t));
+        pos += caches * (int)sizeof(uint16_t);
     } else {
         operand = 0;
         pos += 1;
         if (opcode == Pyc::EXTENDED_ARG_A) {
-            operand = source.get16() << 16;
-            opcode = Pyc::ByteToOpcode(mod->majorVer(), mod->minorVer(), source.getByte());
-            pos += 3;
+            unsigned arg = 0;
+            do {
+                arg = (arg << 16) | (unsigned)bc_get16(source);
+                opcode = Pyc::DecodeOpcode(map, source.getByte());
+                pos += 3;
+            } while (opcode == Pyc::EXTENDED_ARG_A && !source.atEof());
+            operand = (int)(arg << 16);
         }
         if (opcode >= Pyc::PYC_HAVE_ARG) {
-            operand |= source.get16();
+            operand |= bc_get16(source);
             pos += 2;
         }
     }
 }
 
+int bc_jump_target(PycModule* mod, int opcode, int operand, int next)
+{
+    switch (opcode) {
+    case Pyc::JUMP_FORWARD_A:
+    case Pyc::JUMP_IF_FALSE_A:
+    case Pyc::JUMP_IF_TRUE_A:
+    case Pyc::SETUP_LOOP_A:
+    case Pyc::SETUP_FINALLY_A:
+    case Pyc::SETUP_EXCEPT_A:
+    case Pyc::FOR_LOOP_A:
+    case Pyc::FOR_ITER_A:
+    case Pyc::SETUP_WITH_A:
+    case Pyc::SETUP_ASYNC_WITH_A:
+    case Pyc::POP_JUMP_FORWARD_IF_FALSE_A:
+    case Pyc::POP_JUMP_FORWARD_IF_TRUE_A:
+    case Pyc::SEND_A:
+    case Pyc::POP_JUMP_FORWARD_IF_NOT_NONE_A:
+    case Pyc::POP_JUMP_FORWARD_IF_NONE_A:
+    case Pyc::POP_JUMP_IF_NOT_NONE_A:
+    case Pyc::POP_JUMP_IF_NONE_A:
+    case Pyc::INSTRUMENTED_POP_JUMP_IF_NOT_NONE_A:
+    case Pyc::INSTRUMENTED_POP_JUMP_IF_NONE_A:
+    case Pyc::INSTRUMENTED_JUMP_FORWARD_A:
+    case Pyc::INSTRUMENTED_FOR_ITER_A:
+    case Pyc::INSTRUMENTED_POP_JUMP_IF_FALSE_A:
+    case Pyc::INSTRUMENTED_POP_JUMP_IF_TRUE_A:
+        if (mod->has(PycModule::FEAT_JUMPS_IN_UNITS))
+            return next + operand * (int)sizeof(uint16_t); // BPO-27129
+        return next + operand;
+    case Pyc::JUMP_BACKWARD_NO_INTERRUPT_A:
+    case Pyc::JUMP_BACKWARD_A:
+    case Pyc::POP_JUMP_BACKWARD_IF_NOT_NONE_A:
+    case Pyc::POP_JUMP_BACKWARD_IF_NONE_A:
+    case Pyc::POP_JUMP_BACKWARD_IF_FALSE_A:
+    case Pyc::POP_JUMP_BACKWARD_IF_TRUE_A:
+    case Pyc::INSTRUMENTED_JUMP_BACKWARD_A:
+        // BACKWARD jumps were only introduced in Python 3.11
+        return next - operand * (int)sizeof(uint16_t);
+    case Pyc::JUMP_IF_FALSE_OR_POP_A:
+    case Pyc::JUMP_IF_TRUE_OR_POP_A:
+        // Relative forward jumps in 3.11, their last version
+        if (mod->has(PycModule::FEAT_CACHES))
+            return next + operand * (int)sizeof(uint16_t);
+        if (mod->has(PycModule::FEAT_JUMPS_IN_UNITS))
+            return operand * (int)sizeof(uint16_t);
+        return operand;
+    case Pyc::POP_JUMP_IF_FALSE_A:
+    case Pyc::POP_JUMP_IF_TRUE_A:
+    case Pyc::JUMP_ABSOLUTE_A:
+    case Pyc::JUMP_IF_NOT_EXC_MATCH_A:
+    case Pyc::CONTINUE_LOOP_A:
+        if (mod->has(PycModule::FEAT_RELATIVE_JUMPS))
+            return next + operand * (int)sizeof(uint16_t); // Now relative as well
+        if (mod->has(PycModule::FEAT_JUMPS_IN_UNITS))
+            return operand * (int)sizeof(uint16_t); // BPO-27129
+        return operand;
+    default:
+        return -1;
+    }
+}
+
+void bc_decode(PycRef<PycString> code, PycModule* mod, PycInstructions& insns)
+{
+    PycBuffer source(code->data(), code->length());
+
+    // Instructions take two bytes from 3.6 on, and one or three before
+    insns.reserve(code->length() / 2 + 1);
+
+    /* Lengths are kept in a byte.  A longer run of prefixes is split, with
+     * the leading ones left as operand-less EXTENDED_ARGs; their bits have
+     * been shifted out of the folded operand by then anyway.  The pieces
+     * split off are whole prefixes, and never reach the instruction itself
+     * or its caches. */
+    const int prefix_len = mod->has(PycModule::FEAT_WORDCODE) ? 2 : 3;
+    const int max_len = (PycInstructions::MAX_LENGTH / prefix_len) * prefix_len;
+
+    int opcode, operand;
+    int pos = 0;
+    while (!source.atEof()) {
+        int start_pos = pos;
+        bc_next(source, mod, opcode, operand, pos);
+        while (pos - start_pos > PycInstructions::MAX_LENGTH) {
+            int excess = pos - start_pos - PycInstructions::MAX_LENGTH;
+            int split = std::min(max_len, (excess + prefix_len - 1) / prefix_len * prefix_len);
+            insns.append(start_pos, Pyc::EXTENDED_ARG_A, 0, split, -1);
+            start_pos += split;
+        }
+        insns.append(start_pos, opcode, operand, pos - start_pos,
+                     bc_jump_target(mod, opcode, operand, pos));
+    }
+}
+
+void bc_lower(const PycInstructions& insns, PycModule* mod, PycInstructions& ir)
+{
+    // Settle the version questions once per code object, not per instruction
+    const bool names_for_locals = !mod->has(PycModule::FEAT_LOCAL_NAMES);
+    const bool kw_names_call = mod->has(PycModule::FEAT_NULL_PUSH);
+    const bool null_bit_global = mod->has(PycModule::FEAT_NULL_PUSH);
+    const bool null_bit_attr = mod->has(PycModule::FEAT_SHIFTED_LOAD_ATTR);
+    const int compare_shift = mod->compareShift();
+
+    ir.reserve(insns.size());
+    for (size_t i = 0; i < insns.size(); ++i) {
+        int opcode = insns.opcode(i);
+        int operand = insns.operand(i);
+        unsigned flags = 0;
+
+        switch (opcode) {
+        case Pyc::POP_JUMP_FORWARD_IF_FALSE_A:
+        case Pyc::INSTRUMENTED_POP_JUMP_IF_FALSE_A:
+            opcode = Pyc::POP_JUMP_IF_FALSE_A;
+            break;
+        case Pyc::POP_JUMP_FORWARD_IF_TRUE_A:
+        case Pyc::INSTRUMENTED_POP_JUMP_IF_TRUE_A:
+            opcode = Pyc::POP_JUMP_IF_TRUE_A;
+            break;
+        case Pyc::INSTRUMENTED_JUMP_FORWARD_A:
+            opcode = Pyc::JUMP_FORWARD_A;
+            break;
+        case Pyc::INSTRUMENTED_FOR_ITER_A:
+            opcode = Pyc::FOR_ITER_A;
+            break;
+        case Pyc::INSTRUMENTED_RETURN_VALUE_A:
+            opcode = Pyc::RETURN_VALUE;
+            break;
+        case Pyc::INSTRUMENTED_RETURN_CONST_A:
+            opcode = Pyc::RETURN_CONST_A;
+            break;
+        case Pyc::INSTRUMENTED_YIELD_VALUE_A:
+            opcode = Pyc::YIELD_VALUE;
+            break;
+        case Pyc::INSTRUMENTED_RESUME_A:
+            opcode = Pyc::RESUME_A;
+            break;
+        case Pyc::CALL_FUNCTION_A:
+        case Pyc::CALL_A:
+        case Pyc::INSTRUMENTED_CALL_A:
+            /* Before 3.6 the operand packs the keyword pair count above
+               the positional count; from 3.6 to 3.10 it is just the
+               positional count */
+            opcode = Pyc::CALL_A;
+            if (kw_names_call)
+                flags = PycInstructions::FLAG_KW_NAMES | PycInstructions::FLAG_POP_NULL;
+            break;
+        case Pyc::LOAD_FAST_A:
+            // Before 1.3, fast locals are looked up in co_names
+            if (names_for_locals)
+                opcode = Pyc::LOAD_NAME_A;
+            break;
+        case Pyc::LOAD_GLOBAL_A:
+            if (null_bit_global) {
+                if (operand & 1)
+                    flags = PycInstructions::FLAG_PUSH_NULL;
+                operand >>= 1;
+            }
+            break;
+        case Pyc::LOAD_ATTR_A:
+            if (null_bit_attr) {
+                if (operand & 1)
+                    flags = PycInstructions::FLAG_PUSH_NULL;
+                operand >>= 1;
+            }
+            break;
+        case Pyc::COMPARE_OP_A:
+            operand >>= compare_shift;
+            break;
+        }
+
+        ir.append(insns.offset(i), opcode, operand, insns.length(i),
+                  insns.target(i), flags);
+    }
+}
+
 void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
                int indent, unsigned flags)
 {
@@ -338,19 +575,41 @@ void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
     };
     static const size_t format_value_names_len = sizeof(format_value_names) / sizeof(format_value_names[0]);
 
-    PycBuffer source(code->code()->value(), code->code()->length());
+    const bool hide_caches = mod->has(PycModule::FEAT_CACHES)
+            && (flags & Pyc::DISASM_SHOW_CACHES) == 0;
 
-    int opcode, operand;
-    int pos = 0;
-    while (!source.atEof()) {
-        int start_pos = pos;
-        bc_next(source, mod, opcode, operand, pos);
-        if (opcode == Pyc::CACHE && (flags & Pyc::DISASM_SHOW_CACHES) == 0)
-            continue;
+    const PycLineTable* lines = nullptr;
+    if ((flags & Pyc::DISASM_SHOW_LINES) != 0)
+        lines = &code->lineIndex(mod);
+    int last_line = -2;
 
+    auto print_start = [&](int start_pos, int opcode) {
         for (int i=0; i<indent; i++)
             pyc_output << "    ";
+        if (lines) {
+            // Like dis, only the first instruction of each line gets it
+            int line = lines->lineAt(start_pos);
+            if (line == last_line)
+                pyc_output << "      ";
+            else if (line < 0)
+                pyc_output << "    - ";
+            else
+                formatted_print(pyc_output, "%5d ", line);
+            last_line = line;
+        }
         formatted_print(pyc_output, "%-7d %-30s  ", start_pos, Pyc::OpcodeName(opcode));
+    };
+
+    const PycInstructions& insns = code->instructions(mod);
+    const unsigned char* bytes = (const unsigned char*)code->code()->data();
+    for (size_t i = 0; i < insns.size(); ++i) {
+        int start_pos = insns.offset(i);
+        int opcode = insns.opcode(i);
+        int operand = insns.operand(i);
+        if (hide_caches && opcode == Pyc::CACHE)
+            continue;
+
+        print_start(start_pos, opcode);
 
         if (opcode >= Pyc::PYC_HAVE_ARG) {
             switch (opcode) {
@@ -370,13 +629,13 @@ void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
             case Pyc::LOAD_GLOBAL_A:
                 try {
                     // Special case for Python 3.11+
-                    if (mod->verCompare(3, 11) >= 0) {
+                    if (mod->has(PycModule::FEAT_NULL_PUSH)) {
                         if (operand & 1)
-                            formatted_print(pyc_output, "%d: NULL + %s", operand, code->getName(operand >> 1)->value());
+                            formatted_print(pyc_output, "%d: NULL + %s", operand, code->getName(operand >> 1)->strValue().c_str());
                         else
-                            formatted_print(pyc_output, "%d: %s", operand, code->getName(operand >> 1)->value());
+                            formatted_print(pyc_output, "%d: %s", operand, code->getName(operand >> 1)->strValue().c_str());
                     } else {
-                        formatted_print(pyc_output, "%d: %s", operand, code->getName(operand)->value());
+                        formatted_print(pyc_output, "%d: %s", operand, code->getName(operand)->strValue().c_str());
                     }
                 } catch (const std::out_of_range &) {
                     formatted_print(pyc_output, "%d <INVALID>", operand);
@@ -398,9 +657,9 @@ void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
             case Pyc::LOAD_FROM_DICT_OR_GLOBALS_A:
                 try {
                     auto arg = operand;
-                    if (opcode == Pyc::LOAD_ATTR_A && mod->verCompare(3, 12) >= 0)
+                    if (opcode == Pyc::LOAD_ATTR_A && mod->has(PycModule::FEAT_SHIFTED_LOAD_ATTR))
                         arg >>= 1;
-                    formatted_print(pyc_output, "%d: %s", operand, code->getName(arg)->value());
+                    formatted_print(pyc_output, "%d: %s", operand, code->getName(arg)->strValue().c_str());
                 } catch (const std::out_of_range &) {
                     formatted_print(pyc_output, "%d <INVALID>", operand);
                 }
@@ -408,7 +667,7 @@ void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
             case Pyc::LOAD_SUPER_ATTR_A:
             case Pyc::INSTRUMENTED_LOAD_SUPER_ATTR_A:
                 try {
-                    formatted_print(pyc_output, "%d: %s", operand, code->getName(operand >> 2)->value());
+                    formatted_print(pyc_output, "%d: %s", operand, code->getName(operand >> 2)->strValue().c_str());
                 } catch (const std::out_of_range &) {
                     formatted_print(pyc_output, "%d <INVALID>", operand);
                 }
@@ -419,7 +678,7 @@ void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
             case Pyc::LOAD_FAST_CHECK_A:
             case Pyc::LOAD_FAST_AND_CLEAR_A:
                 try {
-                    formatted_print(pyc_output, "%d: %s", operand, code->getLocal(operand)->value());
+                    formatted_print(pyc_output, "%d: %s", operand, code->getLocal(operand)->strValue().c_str());
                 } catch (const std::out_of_range &) {
                     formatted_print(pyc_output, "%d <INVALID>", operand);
                 }
@@ -429,8 +688,8 @@ void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
             case Pyc::STORE_FAST_STORE_FAST_A:
                 try {
                     formatted_print(pyc_output, "%d: %s, %s", operand,
-                                    code->getLocal(operand >> 4)->value(),
-                                    code->getLocal(operand & 0xF)->value());
+                                    code->getLocal(operand >> 4)->strValue().c_str(),
+                                    code->getLocal(operand & 0xF)->strValue().c_str());
                 } catch (const std::out_of_range &) {
                     formatted_print(pyc_output, "%d <INVALID>", operand);
                 }
@@ -443,7 +702,7 @@ void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
             case Pyc::CALL_FINALLY_A:
             case Pyc::LOAD_FROM_DICT_OR_DEREF_A:
                 try {
-                    formatted_print(pyc_output, "%d: %s", operand, code->getCellVar(mod, operand)->value());
+                    formatted_print(pyc_output, "%d: %s", operand, code->getCellVar(mod, operand)->strValue().c_str());
                 } catch (const std::out_of_range &) {
                     formatted_print(pyc_output, "%d <INVALID>", operand);
                 }
@@ -471,12 +730,7 @@ void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
             case Pyc::INSTRUMENTED_FOR_ITER_A:
             case Pyc::INSTRUMENTED_POP_JUMP_IF_FALSE_A:
             case Pyc::INSTRUMENTED_POP_JUMP_IF_TRUE_A:
-                {
-                    int offs = operand;
-                    if (mod->verCompare(3, 10) >= 0)
-                        offs *= sizeof(uint16_t); // BPO-27129
-                    formatted_print(pyc_output, "%d (to %d)", operand, pos+offs);
-                }
+                formatted_print(pyc_output, "%d (to %d)", operand, insns.target(i));
                 break;
             case Pyc::JUMP_BACKWARD_NO_INTERRUPT_A:
             case Pyc::JUMP_BACKWARD_A:
@@ -485,11 +739,7 @@ void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
             case Pyc::POP_JUMP_BACKWARD_IF_FALSE_A:
             case Pyc::POP_JUMP_BACKWARD_IF_TRUE_A:
             case Pyc::INSTRUMENTED_JUMP_BACKWARD_A:
-                {
-                    // BACKWARD jumps were only introduced in Python 3.11
-                    int offs = operand * sizeof(uint16_t); // BPO-27129
-                    formatted_print(pyc_output, "%d (to %d)", operand, pos-offs);
-                }
+                formatted_print(pyc_output, "%d (to %d)", operand, insns.target(i));
                 break;
             case Pyc::POP_JUMP_IF_FALSE_A:
             case Pyc::POP_JUMP_IF_TRUE_A:
@@ -497,25 +747,14 @@ void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
             case Pyc::JUMP_IF_TRUE_OR_POP_A:
             case Pyc::JUMP_ABSOLUTE_A:
             case Pyc::JUMP_IF_NOT_EXC_MATCH_A:
-                if (mod->verCompare(3, 12) >= 0) {
-                    // These are now relative as well
-                    int offs = operand * sizeof(uint16_t);
-                    formatted_print(pyc_output, "%d (to %d)", operand, pos+offs);
-                } else if (mod->verCompare(3, 10) >= 0) {
-                    // BPO-27129
-                    formatted_print(pyc_output, "%d (to %d)", operand,
-                                    int(operand * sizeof(uint16_t)));
-                } else {
+                if (mod->has(PycModule::FEAT_JUMPS_IN_UNITS))
+                    formatted_print(pyc_output, "%d (to %d)", operand, insns.target(i));
+                else
                     formatted_print(pyc_output, "%d", operand);
-                }
                 break;
             case Pyc::COMPARE_OP_A:
                 {
-                    auto arg = operand;
-                    if (mod->verCompare(3, 12) == 0)
-                        arg >>= 4; // changed under GH-100923
-                    else if (mod->verCompare(3, 13) >= 0)
-                        arg >>= 5;
+                    auto arg = operand >> mod->compareShift();
                     if (static_cast<size_t>(arg) < cmp_strings_len)
                         formatted_print(pyc_output, "%d (%s)", operand, cmp_strings[arg]);
                     else
@@ -594,5 +833,18 @@ void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
             }
         }
         pyc_output << "\n";
+
+        /* The decoder folds an instruction's caches into it; they're the
+         * words after its opcode, past any EXTENDED_ARG prefixes */
+        if (!hide_caches && mod->has(PycModule::FEAT_CACHES) && opcode != Pyc::EXTENDED_ARG_A) {
+            int op_pos = start_pos;
+            while (op_pos + 2 < insns.next(i) && (size_t)op_pos < code->code()->length()
+                    && Pyc::DecodeOpcode(mod->opcodeMap(), bytes[op_pos]) == Pyc::EXTENDED_ARG_A)
+                op_pos += 2;
+            for (int cache_pos = op_pos + 2; cache_pos < insns.next(i); cache_pos += 2) {
+                print_start(cache_pos, Pyc::CACHE);
+                pyc_output << "\n";
+            }
+        }
     }
 }
@@ -20,15 +20,44 @@ enum Opcode {
 enum DisassemblyFlags {
     DISASM_PYCODE_VERBOSE = 0x1,
     DISASM_SHOW_CACHES = 0x2,
+    DISASM_SHOW_CFG = 0x4,
+    DISASM_SHOW_LINES = 0x8,
 };
 
 const char* OpcodeName(int opcode);
 int ByteToOpcode(int maj, int min, int opcode);
 
+/* Returns the table mapping each opcode byte of a Python version to an
+ * Opcode.  Unknown versions get a table of PYC_INVALID_OPCODE. */
+const int* OpcodeMap(int maj, int min);
+
+/* Returns the table of how many inline CACHE entries follow each opcode
+ * byte of a Python version.  It is all zeros before 3.11. */
+const unsigned char* CacheMap(int maj, int min);
+
+/* Decodes a byte as returned by PycData::getByte(), which is EOF (-1) past
+ * the end of the data */
+inline int DecodeOpcode(const int* map, int byte)
+{
+    return (byte >= 0) ? map[byte] : PYC_INVALID_OPCODE;
 }
 
+}
+
+/* Expands fn(0) ... fn(255), for building opcode tables */
+#define PYC_OPCODE_TABLE_4(fn, i) fn(i), fn(i + 1), fn(i + 2), fn(i + 3)
+#define PYC_OPCODE_TABLE_16(fn, i) PYC_OPCODE_TABLE_4(fn, i), PYC_OPCODE_TABLE_4(fn, i + 4), \
+        PYC_OPCODE_TABLE_4(fn, i + 8), PYC_OPCODE_TABLE_4(fn, i + 12)
+#define PYC_OPCODE_TABLE_64(fn, i) PYC_OPCODE_TABLE_16(fn, i), PYC_OPCODE_TABLE_16(fn, i + 16), \
+        PYC_OPCODE_TABLE_16(fn, i + 32), PYC_OPCODE_TABLE_16(fn, i + 48)
+#define PYC_OPCODE_TABLE(fn) PYC_OPCODE_TABLE_64(fn, 0), PYC_OPCODE_TABLE_64(fn, 64), \
+        PYC_OPCODE_TABLE_64(fn, 128), PYC_OPCODE_TABLE_64(fn, 192)
+
 void print_const(std::ostream& pyc_output, PycRef<PycObject> obj, PycModule* mod,
                  const char* parent_f_string_quote = nullptr);
 void bc_next(PycBuffer& source, PycModule* mod, int& opcode, int& operand, int& pos);
+int bc_jump_target(PycModule* mod, int opcode, int operand, int next);
+void bc_decode(PycRef<PycString> code, PycModule* mod, PycInstructions& insns);
+void bc_lower(const PycInstructions& insns, PycModule* mod, PycInstructions& ir);
 void bc_disasm(std::ostream& pyc_output, PycRef<PycCode> code, PycModule* mod,
                int indent, unsigned flags);
@@ -1,14 +1,32 @@
 #include "bytecode.h"
 
+/* Each map's MAP_OP list becomes one constexpr lookup expression, which is
+ * expanded into a 256-entry table at compile time.  Decoding a byte is then
+ * a single indexed load (see Pyc::OpcodeMap). */
 #define BEGIN_MAP(maj, min) \
-    int python_##maj##_##min##_map(int id) \
+    static constexpr int lookup(int id) \
     { \
-        switch (id) {
+        return
 
 #define MAP_OP(op, name) \
-        case op: return Pyc::name;
+        (id == op) ? Pyc::name :
 
-#define END_MAP() \
-        default: return Pyc::PYC_INVALID_OPCODE; \
-        } \
-    }
+#define END_MAP(maj, min) \
+        Pyc::PYC_INVALID_OPCODE; \
+    } \
+    extern constexpr int python_##maj##_##min##_map[256] = { PYC_OPCODE_TABLE(lookup) };
+
+/* Inline CACHE entries (3.11+) are listed by opcode name after the map, and
+ * become a 256-entry table of how many follow each opcode byte. */
+#define BEGIN_CACHES(maj, min) \
+    static constexpr unsigned char cache_lookup(int id) \
+    { \
+        return
+
+#define CACHE_OP(name, count) \
+        (lookup(id) == Pyc::name) ? count :
+
+#define END_CACHES(maj, min) \
+        0; \
+    } \
+    extern constexpr unsigned char python_##maj##_##min##_caches[256] = { PYC_OPCODE_TABLE(cache_lookup) };
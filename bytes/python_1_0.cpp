@@ -86,4 +86,4 @@ BEGIN_MAP(1, 0)
     MAP_OP(125, STORE_FAST_A)
     MAP_OP(126, DELETE_FAST_A)
     MAP_OP(127, SET_LINENO_A)
-END_MAP()
+END_MAP(1, 0)
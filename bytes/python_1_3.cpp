@@ -84,4 +84,4 @@ BEGIN_MAP(1, 3)
     MAP_OP(130, RAISE_VARARGS_A)
     MAP_OP(131, CALL_FUNCTION_A)
     MAP_OP(132, MAKE_FUNCTION_A)
-END_MAP()
+END_MAP(1, 3)
@@ -86,4 +86,4 @@ BEGIN_MAP(1, 4)
     MAP_OP(131, CALL_FUNCTION_A)
     MAP_OP(132, MAKE_FUNCTION_A)
     MAP_OP(133, BUILD_SLICE_A)
-END_MAP()
+END_MAP(1, 4)
@@ -84,4 +84,4 @@ BEGIN_MAP(1, 6)
     MAP_OP(140, CALL_FUNCTION_VAR_A)
     MAP_OP(141, CALL_FUNCTION_KW_A)
     MAP_OP(142, CALL_FUNCTION_VAR_KW_A)
-END_MAP()
+END_MAP(1, 6)
@@ -100,4 +100,4 @@ BEGIN_MAP(2, 0)
     MAP_OP(141, CALL_FUNCTION_KW_A)
     MAP_OP(142, CALL_FUNCTION_VAR_KW_A)
     MAP_OP(143, EXTENDED_ARG_A)
-END_MAP()
+END_MAP(2, 0)
@@ -105,4 +105,4 @@ BEGIN_MAP(2, 1)
     MAP_OP(141, CALL_FUNCTION_KW_A)
     MAP_OP(142, CALL_FUNCTION_VAR_KW_A)
     MAP_OP(143, EXTENDED_ARG_A)
-END_MAP()
+END_MAP(2, 1)
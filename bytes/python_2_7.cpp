@@ -120,4 +120,4 @@ BEGIN_MAP(2, 7)
     MAP_OP(145, EXTENDED_ARG_A)
     MAP_OP(146, SET_ADD_A)
     MAP_OP(147, MAP_ADD_A)
-END_MAP()
+END_MAP(2, 7)
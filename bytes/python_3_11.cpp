@@ -111,4 +111,18 @@ BEGIN_MAP(3, 11)
     MAP_OP(174, POP_JUMP_BACKWARD_IF_NONE_A)
     MAP_OP(175, POP_JUMP_BACKWARD_IF_FALSE_A)
     MAP_OP(176, POP_JUMP_BACKWARD_IF_TRUE_A)
-END_MAP()
+END_MAP(3, 11)
+
+BEGIN_CACHES(3, 11)
+    CACHE_OP(BINARY_SUBSCR, 4)
+    CACHE_OP(STORE_SUBSCR, 1)
+    CACHE_OP(UNPACK_SEQUENCE_A, 1)
+    CACHE_OP(STORE_ATTR_A, 4)
+    CACHE_OP(LOAD_ATTR_A, 4)
+    CACHE_OP(COMPARE_OP_A, 2)
+    CACHE_OP(LOAD_GLOBAL_A, 5)
+    CACHE_OP(BINARY_OP_A, 1)
+    CACHE_OP(LOAD_METHOD_A, 10)
+    CACHE_OP(PRECALL_A, 1)
+    CACHE_OP(CALL_A, 4)
+END_CACHES(3, 11)
@@ -130,4 +130,19 @@ BEGIN_MAP(3, 12)
     MAP_OP(252, INSTRUMENTED_END_SEND_A)
     MAP_OP(253, INSTRUMENTED_INSTRUCTION_A)
     MAP_OP(254, INSTRUMENTED_LINE_A)
-END_MAP()
+END_MAP(3, 12)
+
+BEGIN_CACHES(3, 12)
+    CACHE_OP(BINARY_SUBSCR, 1)
+    CACHE_OP(STORE_SUBSCR, 1)
+    CACHE_OP(UNPACK_SEQUENCE_A, 1)
+    CACHE_OP(FOR_ITER_A, 1)
+    CACHE_OP(STORE_ATTR_A, 4)
+    CACHE_OP(LOAD_ATTR_A, 9)
+    CACHE_OP(COMPARE_OP_A, 1)
+    CACHE_OP(LOAD_GLOBAL_A, 4)
+    CACHE_OP(BINARY_OP_A, 1)
+    CACHE_OP(SEND_A, 1)
+    CACHE_OP(LOAD_SUPER_ATTR_A, 1)
+    CACHE_OP(CALL_A, 3)
+END_CACHES(3, 12)
@@ -139,4 +139,26 @@ BEGIN_MAP(3, 13)
     MAP_OP(252, INSTRUMENTED_POP_JUMP_IF_NONE_A)
     MAP_OP(253, INSTRUMENTED_POP_JUMP_IF_NOT_NONE_A)
     MAP_OP(254, INSTRUMENTED_LINE_A)
-END_MAP()
+END_MAP(3, 13)
+
+BEGIN_CACHES(3, 13)
+    CACHE_OP(TO_BOOL, 3)
+    CACHE_OP(BINARY_SUBSCR, 1)
+    CACHE_OP(STORE_SUBSCR, 1)
+    CACHE_OP(CALL_A, 3)
+    CACHE_OP(BINARY_OP_A, 1)
+    CACHE_OP(COMPARE_OP_A, 1)
+    CACHE_OP(CONTAINS_OP_A, 1)
+    CACHE_OP(FOR_ITER_A, 1)
+    CACHE_OP(JUMP_BACKWARD_A, 1)
+    CACHE_OP(LOAD_ATTR_A, 9)
+    CACHE_OP(LOAD_GLOBAL_A, 4)
+    CACHE_OP(LOAD_SUPER_ATTR_A, 1)
+    CACHE_OP(POP_JUMP_IF_FALSE_A, 1)
+    CACHE_OP(POP_JUMP_IF_NONE_A, 1)
+    CACHE_OP(POP_JUMP_IF_NOT_NONE_A, 1)
+    CACHE_OP(POP_JUMP_IF_TRUE_A, 1)
+    CACHE_OP(SEND_A, 1)
+    CACHE_OP(STORE_ATTR_A, 4)
+    CACHE_OP(UNPACK_SEQUENCE_A, 1)
+END_CACHES(3, 13)
@@ -102,4 +102,4 @@ BEGIN_MAP(3, 3)
     MAP_OP(145, LIST_APPEND_A)
     MAP_OP(146, SET_ADD_A)
     MAP_OP(147, MAP_ADD_A)
-END_MAP()
+END_MAP(3, 3)
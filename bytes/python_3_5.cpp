@@ -115,4 +115,4 @@ BEGIN_MAP(3, 5)
     MAP_OP(152, BUILD_TUPLE_UNPACK_A)
     MAP_OP(153, BUILD_SET_UNPACK_A)
     MAP_OP(154, SETUP_ASYNC_WITH_A)
-END_MAP()
+END_MAP(3, 5)
@@ -119,4 +119,4 @@ BEGIN_MAP(3, 6)
     MAP_OP(156, BUILD_CONST_KEY_MAP_A)
     MAP_OP(157, BUILD_STRING_A)
     MAP_OP(158, BUILD_TUPLE_UNPACK_WITH_CALL_A)
-END_MAP()
+END_MAP(3, 6)
@@ -120,4 +120,4 @@ BEGIN_MAP(3, 7)
     MAP_OP(158, BUILD_TUPLE_UNPACK_WITH_CALL_A)
     MAP_OP(160, LOAD_METHOD_A)
     MAP_OP(161, CALL_METHOD_A)
-END_MAP()
+END_MAP(3, 7)
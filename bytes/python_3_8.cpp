@@ -121,4 +121,4 @@ BEGIN_MAP(3, 8)
     MAP_OP(161, CALL_METHOD_A)
     MAP_OP(162, CALL_FINALLY_A)
     MAP_OP(163, POP_FINALLY_A)
-END_MAP()
+END_MAP(3, 8)
@@ -120,4 +120,4 @@ BEGIN_MAP(3, 9)
     MAP_OP(163, SET_UPDATE_A)
     MAP_OP(164, DICT_MERGE_A)
     MAP_OP(165, DICT_UPDATE_A)
-END_MAP()
+END_MAP(3, 9)
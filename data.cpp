@@ -2,6 +2,14 @@
 #include <cstring>
 #include <cstdarg>
 #include <vector>
+#include <cstdint>
+
+#ifndef WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
 
 /* PycData */
 int PycData::get16()
@@ -58,25 +66,16 @@ int PycFile::getByte()
     return ch;
 }
 
-int PycFile::getBuffer(int bytes, void* buffer)
+size_t PycFile::getBuffer(size_t bytes, void* buffer)
 {
-    return (int)fread(buffer, 1, bytes, m_stream);
+    return fread(buffer, 1, bytes, m_stream);
 }
 
 
 /* PycBuffer */
-int PycBuffer::getByte()
-{
-    if (atEof())
-        return EOF;
-    int ch = (int)(*(m_buffer + m_pos));
-    ++m_pos;
-    return ch & 0xFF;   // Make sure it's just a byte!
-}
-
-int PycBuffer::getBuffer(int bytes, void* buffer)
+size_t PycBuffer::getBuffer(size_t bytes, void* buffer)
 {
-    if (m_pos + bytes > m_size)
+    if (bytes > m_size - m_pos)
         bytes = m_size - m_pos;
     if (bytes != 0)
         memcpy(buffer, (m_buffer + m_pos), bytes);
@@ -84,6 +83,108 @@ int PycBuffer::getBuffer(int bytes, void* buffer)
     return bytes;
 }
 
+
+/* PycMappedFile */
+PycMappedFile::PycMappedFile(const char* filename)
+    : m_mapped(false)
+{
+#ifndef WIN32
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+            && st.st_size > 0 && (uintmax_t)st.st_size <= SIZE_MAX) {
+        size_t size = (size_t)st.st_size;
+        if (size < MAP_THRESHOLD) {
+            // Faulting in a fresh mapping costs more than one read() here
+            m_data.resize(size);
+            if (read(fd, m_data.data(), size) == (ssize_t)size) {
+                m_buffer = m_data.data();
+                m_size = size;
+            }
+        } else {
+            void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                m_buffer = (const unsigned char*)map;
+                m_size = size;
+                m_mapped = true;
+            }
+        }
+    }
+    close(fd);
+#else
+    (void)filename;
+#endif
+}
+
+PycMappedFile::~PycMappedFile()
+{
+#ifndef WIN32
+    if (m_mapped)
+        munmap((void*)m_buffer, m_size);
+#endif
+}
+
+/* PycOwnedBuffer */
+void PycOwnedBuffer::setData(std::vector<unsigned char> data)
+{
+    m_data = std::move(data);
+
+    // An empty buffer still counts as open, just with no data
+    static const unsigned char empty = 0;
+    m_buffer = m_data.empty() ? &empty : m_data.data();
+    m_size = m_data.size();
+    m_pos = 0;
+}
+
+/* PycStreamBuffer */
+PycStreamBuffer::PycStreamBuffer(PycData& stream)
+{
+    std::vector<unsigned char> data;
+    unsigned char chunk[4096];
+    size_t count;
+    while ((count = stream.getBuffer(sizeof(chunk), chunk)) > 0)
+        data.insert(data.end(), chunk, chunk + count);
+    setData(std::move(data));
+}
+
+std::unique_ptr<PycBuffer> OpenInputFile(const char* filename)
+{
+    std::unique_ptr<PycBuffer> in(new PycMappedFile(filename));
+    if (!in->isOpen()) {
+        // Not mappable (e.g. a pipe) -- fall back to reading through stdio
+        PycFile file(filename);
+        if (file.isOpen())
+            in.reset(new PycStreamBuffer(file));
+    }
+    return in;
+}
+
+bool ReadFileHead(const char* filename, void* buffer, size_t& size)
+{
+#ifndef WIN32
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0)
+        return false;
+    ssize_t count = read(fd, buffer, size);
+    close(fd);
+    if (count < 0)
+        return false;
+    size = (size_t)count;
+    return true;
+#else
+    FILE* stream = fopen(filename, "rb");
+    if (!stream)
+        return false;
+    size = fread(buffer, 1, size, stream);
+    bool ok = !ferror(stream);
+    fclose(stream);
+    return ok;
+#endif
+}
+
 int formatted_print(std::ostream& stream, const char* format, ...)
 {
     va_list args;
@@ -1,8 +1,14 @@
 #ifndef _PYC_FILE_H
 #define _PYC_FILE_H
 
+#include <algorithm>
 #include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
 #include <ostream>
+#include <stdexcept>
+#include <vector>
 
 #ifdef WIN32
 typedef __int64 Pyc_INT64;
@@ -19,7 +25,7 @@ public:
     virtual bool atEof() const = 0;
 
     virtual int getByte() = 0;
-    virtual int getBuffer(int bytes, void* buffer) = 0;
+    virtual size_t getBuffer(size_t bytes, void* buffer) = 0;
     int get16();
     int get32();
     Pyc_INT64 get64();
@@ -34,7 +40,7 @@ public:
     bool atEof() const override;
 
     int getByte() override;
-    int getBuffer(int bytes, void* buffer) override;
+    size_t getBuffer(size_t bytes, void* buffer) override;
 
 private:
     FILE* m_stream;
@@ -42,19 +48,178 @@ private:
 
 class PycBuffer : public PycData {
 public:
-    PycBuffer(const void* buffer, int size)
+    PycBuffer(const void* buffer, size_t size)
         : m_buffer((const unsigned char*)buffer), m_size(size), m_pos(0) { }
     ~PycBuffer() { }
 
     bool isOpen() const override { return (m_buffer != 0); }
-    bool atEof() const override { return (m_pos == m_size); }
 
-    int getByte() override;
-    int getBuffer(int bytes, void* buffer) override;
+    // Final, so byte-at-a-time readers like bc_next() can inline these
+    bool atEof() const final { return (m_pos == m_size); }
+
+    int getByte() final
+    {
+        if (atEof())
+            return EOF;
+        return m_buffer[m_pos++];
+    }
+
+    size_t getBuffer(size_t bytes, void* buffer) override;
+
+    // Moves past up to the given number of bytes
+    void skip(size_t bytes) { m_pos += std::min(bytes, m_size - m_pos); }
+
+    const unsigned char* data() const { return m_buffer; }
+    size_t size() const { return m_size; }
+
+protected:
+    PycBuffer() : m_buffer(), m_size(), m_pos() { }
 
-private:
     const unsigned char* m_buffer;
-    int m_size, m_pos;
+    size_t m_size, m_pos;
+};
+
+/* Maps a whole regular file into memory and reads it as a PycBuffer.
+ * Files smaller than MAP_THRESHOLD are read with a single read() instead.
+ * Pipes, empty files and platforms without mmap() leave the object closed,
+ * in which case callers should fall back to a PycFile stream. */
+class PycMappedFile : public PycBuffer {
+public:
+    enum { MAP_THRESHOLD = 64 * 1024 };
+
+    PycMappedFile(const char* filename);
+    ~PycMappedFile();
+
+private:
+    PycMappedFile(const PycMappedFile&) = delete;
+    PycMappedFile& operator=(const PycMappedFile&) = delete;
+
+    std::vector<unsigned char> m_data;
+    bool m_mapped;
+};
+
+/* A PycBuffer over bytes it owns, such as an inflated archive member */
+class PycOwnedBuffer : public PycBuffer {
+public:
+    explicit PycOwnedBuffer(std::vector<unsigned char> data) { setData(std::move(data)); }
+
+protected:
+    PycOwnedBuffer() { }
+    void setData(std::vector<unsigned char> data);
+
+private:
+    std::vector<unsigned char> m_data;
+};
+
+/* A PycBuffer holding its own copy of everything left in a stream, for
+ * sources that can't be mapped directly. */
+class PycStreamBuffer : public PycOwnedBuffer {
+public:
+    PycStreamBuffer(PycData& stream);
+};
+
+/* Opens a whole file as a PycBuffer: mapped if possible, otherwise read
+ * through a PycFile stream.  Check isOpen() on the result. */
+std::unique_ptr<PycBuffer> OpenInputFile(const char* filename);
+
+/* Reads up to size bytes from the start of a file, in as few system calls
+ * as possible, and sets size to the number read.  Returns false if the file
+ * can't be opened or read. */
+bool ReadFileHead(const char* filename, void* buffer, size_t& size);
+
+/* Concrete, non-virtual reader over an in-memory span, used by the marshal
+ * loaders so every primitive read can be inlined.  Reads are bounds-checked
+ * and throw on truncated input.  Stream sources go through PycData instead. */
+class PycReader {
+public:
+    PycReader(const void* data, size_t size)
+        : m_begin((const unsigned char*)data), m_pos(m_begin), m_end(m_begin + size) { }
+
+    bool atEof() const { return m_pos == m_end; }
+    size_t pos() const { return (size_t)(m_pos - m_begin); }
+    size_t size() const { return (size_t)(m_end - m_begin); }
+    size_t remaining() const { return (size_t)(m_end - m_pos); }
+
+    void seek(size_t pos)
+    {
+        if (pos > size())
+            throw std::runtime_error("Seek past end of marshalled data");
+        m_pos = m_begin + pos;
+    }
+
+    unsigned u8()
+    {
+        require(1);
+        return *m_pos++;
+    }
+
+    unsigned u16()
+    {
+        require(2);
+        unsigned result = m_pos[0] | (m_pos[1] << 8);
+        m_pos += 2;
+        return result;
+    }
+
+    uint32_t u32()
+    {
+        require(4);
+        uint32_t result = (uint32_t)m_pos[0]
+                        | ((uint32_t)m_pos[1] <<  8)
+                        | ((uint32_t)m_pos[2] << 16)
+                        | ((uint32_t)m_pos[3] << 24);
+        m_pos += 4;
+        return result;
+    }
+
+    /* Big-endian, for container formats (marshal itself is little-endian) */
+    uint32_t u32be()
+    {
+        require(4);
+        uint32_t result = ((uint32_t)m_pos[0] << 24)
+                        | ((uint32_t)m_pos[1] << 16)
+                        | ((uint32_t)m_pos[2] <<  8)
+                        | (uint32_t)m_pos[3];
+        m_pos += 4;
+        return result;
+    }
+
+    uint64_t u64()
+    {
+        uint64_t lo = u32();
+        uint64_t hi = u32();
+        return lo | (hi << 32);
+    }
+
+    /* Reads a 32-bit element count.  Every element takes at least one byte,
+     * so a count larger than the rest of the input is rejected up front
+     * rather than turned into a huge allocation. */
+    size_t count32()
+    {
+        size_t count = u32();
+        require(count);
+        return count;
+    }
+
+    /* Returns a pointer to the next n bytes and skips past them */
+    const unsigned char* read(size_t n)
+    {
+        require(n);
+        const unsigned char* result = m_pos;
+        m_pos += n;
+        return result;
+    }
+
+private:
+    void require(size_t n) const
+    {
+        if ((size_t)(m_end - m_pos) < n)
+            throw std::runtime_error("Unexpected end of marshalled data");
+    }
+
+    const unsigned char* m_begin;
+    const unsigned char* m_pos;
+    const unsigned char* m_end;
 };
 
 int formatted_print(std::ostream& stream, const char* format, ...);
@@ -0,0 +1,521 @@
+#include "pyc_archive.h"
+#include "pyc_module.h"
+#include "pyc_numeric.h"
+#include "pyc_sequence.h"
+#include "pyc_string.h"
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* Every .pyc magic since Python 1.3 ends in "\r\n" */
+static bool hasPycMagic(const unsigned char* data, size_t size)
+{
+    return size >= 4 && data[2] == '\r' && data[3] == '\n';
+}
+
+/* PycArchive */
+std::unique_ptr<PycArchive> PycArchive::fromBuffer(std::unique_ptr<PycBuffer>& source)
+{
+    const unsigned char* data = source->data();
+    size_t size = source->size();
+    if (PycZipArchive::isZipData(data, size))
+        return std::unique_ptr<PycArchive>(new PycZipArchive(std::move(source)));
+    if (PycPyzArchive::isPyzData(data, size))
+        return std::unique_ptr<PycArchive>(new PycPyzArchive(std::move(source)));
+
+    // A CArchive is only found by scanning back from the end, which isn't
+    // worth doing for every plain .pyc
+    if (!hasPycMagic(data, size)) {
+        size_t cookiePos = PycCArchive::findCookie(data, size);
+        if (cookiePos != SIZE_MAX)
+            return std::unique_ptr<PycArchive>(new PycCArchive(std::move(source), cookiePos));
+    }
+    return nullptr;
+}
+
+void PycArchive::loadModule(const Entry& entry, PycModule& mod) const
+{
+    std::unique_ptr<PycBuffer> data = open(entry);
+
+    // Some PyInstaller releases strip the header from their modules; such
+    // archives know the version to load them with
+    bool headerless = entry.format == FORMAT_PYC && m_maj >= 0
+                      && !hasPycMagic(data->data(), data->size());
+    if (entry.format == FORMAT_PYC && !headerless)
+        mod.loadFromBuffer(std::move(data));
+    else if (isModule(entry))
+        mod.loadFromMarshalledBuffer(std::move(data), m_maj, m_min);
+    else
+        throw std::runtime_error(entry.name + " is not a compiled module");
+}
+
+bool PycArchive::isPycName(const std::string& name)
+{
+    if (name.size() < 4)
+        return false;
+    std::string ext = name.substr(name.size() - 4);
+    return ext == ".pyc" || ext == ".pyo";
+}
+
+
+/* PycZipArchive */
+enum {
+    ZIP_LOCAL_HEADER = 0x04034b50,
+    ZIP_CENTRAL_HEADER = 0x02014b50,
+    ZIP_END_OF_DIR = 0x06054b50,
+    ZIP64_END_OF_DIR = 0x06064b50,
+    ZIP64_END_LOCATOR = 0x07064b50,
+    ZIP64_EXTRA_ID = 0x0001,
+
+    ZIP_END_SIZE = 22,
+    ZIP_FLAG_ENCRYPTED = 0x1,
+};
+
+bool PycZipArchive::isZipData(const unsigned char* data, size_t size)
+{
+    // A local file header, or the end record of an empty archive
+    return size >= 4 && data[0] == 'P' && data[1] == 'K'
+           && ((data[2] == 3 && data[3] == 4) || (data[2] == 5 && data[3] == 6));
+}
+
+static size_t findEndOfDirectory(const PycBuffer& source)
+{
+    // The end record is followed only by a comment of up to 64K
+    if (source.size() < ZIP_END_SIZE)
+        throw std::runtime_error("Truncated zip archive");
+
+    PycReader in(source.data(), source.size());
+    size_t pos = source.size() - ZIP_END_SIZE;
+    size_t limit = (pos > 0xFFFF) ? pos - 0xFFFF : 0;
+    for (;;) {
+        in.seek(pos);
+        if (in.u32() == ZIP_END_OF_DIR) {
+            in.seek(pos + 20);
+            if (pos + ZIP_END_SIZE + in.u16() == source.size())
+                return pos;
+        }
+        if (pos == limit)
+            throw std::runtime_error("Missing zip end of central directory record");
+        --pos;
+    }
+}
+
+PycZipArchive::PycZipArchive(std::unique_ptr<PycBuffer> source)
+    : PycArchive(std::move(source))
+{
+    PycReader in(m_source->data(), m_source->size());
+
+    size_t endPos = findEndOfDirectory(*m_source);
+    in.seek(endPos + 10);
+    size_t count = in.u16();
+    size_t dirSize = in.u32();
+    size_t dirOffset = in.u32();
+
+    if (count == 0xFFFF || dirSize == 0xFFFFFFFF || dirOffset == 0xFFFFFFFF) {
+        // Zip64: the real values live in a second end record
+        if (endPos < 20)
+            throw std::runtime_error("Missing zip64 end of central directory locator");
+        in.seek(endPos - 20);
+        if (in.u32() != ZIP64_END_LOCATOR)
+            throw std::runtime_error("Missing zip64 end of central directory locator");
+        in.u32();
+        in.seek((size_t)in.u64());
+        if (in.u32() != ZIP64_END_OF_DIR)
+            throw std::runtime_error("Bad zip64 end of central directory record");
+        in.read(20);
+        in.u64();
+        count = (size_t)in.u64();
+        dirSize = (size_t)in.u64();
+        dirOffset = (size_t)in.u64();
+    }
+
+    in.seek(dirOffset);
+    if (count > dirSize / 46)
+        throw std::runtime_error("Bad zip central directory size");
+    m_entries.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (in.u32() != ZIP_CENTRAL_HEADER)
+            throw std::runtime_error("Bad zip central directory entry");
+
+        Entry entry;
+        in.read(4);
+        unsigned flags = in.u16();
+        entry.method = (int)in.u16();
+        in.read(4);
+        entry.crc = in.u32();
+        entry.compressedSize = in.u32();
+        entry.size = in.u32();
+        size_t nameLen = in.u16();
+        size_t extraLen = in.u16();
+        size_t commentLen = in.u16();
+        in.read(8);
+        entry.offset = in.u32();
+        entry.name.assign((const char*)in.read(nameLen), nameLen);
+
+        // Sizes and offsets that don't fit in 32 bits move to a zip64 extra
+        size_t extraEnd = in.pos() + extraLen;
+        while (in.pos() + 4 <= extraEnd) {
+            unsigned id = in.u16();
+            size_t fieldEnd = in.pos() + 2;
+            fieldEnd += in.u16();
+            if (id == ZIP64_EXTRA_ID) {
+                if (entry.size == 0xFFFFFFFF)
+                    entry.size = (size_t)in.u64();
+                if (entry.compressedSize == 0xFFFFFFFF)
+                    entry.compressedSize = (size_t)in.u64();
+                if (entry.offset == 0xFFFFFFFF)
+                    entry.offset = (size_t)in.u64();
+            }
+            in.seek(fieldEnd);
+        }
+        in.seek(extraEnd);
+        in.read(commentLen);
+
+        if (flags & ZIP_FLAG_ENCRYPTED)
+            entry.method = METHOD_ENCRYPTED;
+        entry.format = isPycName(entry.name) ? FORMAT_PYC : FORMAT_DATA;
+        m_entries.push_back(std::move(entry));
+    }
+}
+
+#ifdef HAVE_ZLIB
+/* Inflates size bytes of deflate data, either raw (as in zips) or wrapped
+ * in a zlib header (windowBits as for inflateInit2).  If expected is
+ * SIZE_MAX the output grows as needed, otherwise it must come out at
+ * exactly that size. */
+static std::vector<unsigned char> inflateData(const unsigned char* data, size_t size,
+                                              int windowBits, size_t expected,
+                                              const std::string& name)
+{
+    z_stream zs = z_stream();
+    if (inflateInit2(&zs, windowBits) != Z_OK)
+        throw std::runtime_error("Could not initialize zlib");
+
+    std::vector<unsigned char> out(expected != SIZE_MAX ? expected
+                                   : std::max<size_t>(size * 4, 256));
+
+    // zlib counts in uInt, so very large members are fed in pieces.  Once
+    // the output is full, inflate() is still called to finish the stream.
+    unsigned char empty;
+    size_t inLeft = size, outPos = 0;
+    zs.next_in = const_cast<Bytef*>(data);
+    zs.next_out = out.empty() ? &empty : out.data();
+    int ret = Z_OK;
+    while (ret == Z_OK) {
+        if (zs.avail_in == 0 && inLeft != 0) {
+            zs.avail_in = (uInt)std::min<size_t>(inLeft, UINT_MAX);
+            inLeft -= zs.avail_in;
+        }
+        if (zs.avail_out == 0) {
+            if (outPos == out.size() && expected == SIZE_MAX)
+                out.resize(out.size() * 2);
+            if (outPos < out.size()) {
+                zs.next_out = out.data() + outPos;
+                zs.avail_out = (uInt)std::min<size_t>(out.size() - outPos, UINT_MAX);
+                outPos += zs.avail_out;
+            }
+        }
+        ret = inflate(&zs, Z_NO_FLUSH);
+    }
+    size_t produced = outPos - zs.avail_out;
+    inflateEnd(&zs);
+    if (ret != Z_STREAM_END || (expected != SIZE_MAX && produced != expected))
+        throw std::runtime_error("Corrupt compressed data in " + name);
+    out.resize(produced);
+    return out;
+}
+#endif
+
+/* Opens a member whose data is either stored or wrapped in zlib */
+static std::unique_ptr<PycBuffer> openZlibEntry(const unsigned char* data,
+                                                const PycArchive::Entry& entry,
+                                                bool compressed)
+{
+    if (!compressed)
+        return std::unique_ptr<PycBuffer>(new PycBuffer(data, entry.compressedSize));
+#ifdef HAVE_ZLIB
+    return std::unique_ptr<PycBuffer>(new PycOwnedBuffer(
+            inflateData(data, entry.compressedSize, MAX_WBITS, entry.size, entry.name)));
+#else
+    throw std::runtime_error("Compressed entry " + entry.name + " needs zlib support");
+#endif
+}
+
+std::unique_ptr<PycBuffer> PycZipArchive::open(const Entry& entry) const
+{
+    PycReader in(m_source->data(), m_source->size());
+    in.seek(entry.offset);
+    if (in.u32() != ZIP_LOCAL_HEADER)
+        throw std::runtime_error("Bad zip local header for " + entry.name);
+    in.read(22);
+    size_t nameLen = in.u16();
+    size_t extraLen = in.u16();
+    in.read(nameLen + extraLen);
+    const unsigned char* data = in.read(entry.compressedSize);
+
+    switch (entry.method) {
+    case METHOD_STORED:
+        if (entry.compressedSize != entry.size)
+            throw std::runtime_error("Bad size for stored entry " + entry.name);
+        return std::unique_ptr<PycBuffer>(new PycBuffer(data, entry.size));
+    case METHOD_DEFLATED:
+#ifdef HAVE_ZLIB
+        {
+            std::vector<unsigned char> out = inflateData(data, entry.compressedSize,
+                                                         -MAX_WBITS, entry.size, entry.name);
+            uLong crc = crc32(0L, Z_NULL, 0);
+            for (size_t pos = 0; pos < out.size(); ) {
+                uInt len = (uInt)std::min<size_t>(out.size() - pos, UINT_MAX);
+                crc = crc32(crc, out.data() + pos, len);
+                pos += len;
+            }
+            if ((uint32_t)crc != entry.crc)
+                throw std::runtime_error("CRC mismatch in " + entry.name);
+            return std::unique_ptr<PycBuffer>(new PycOwnedBuffer(std::move(out)));
+        }
+#else
+        throw std::runtime_error("Deflated entry " + entry.name + " needs zlib support");
+#endif
+    case METHOD_ENCRYPTED:
+        throw std::runtime_error("Encrypted entry " + entry.name + " is not supported");
+    default:
+        throw std::runtime_error("Unsupported compression method for " + entry.name);
+    }
+}
+
+
+/* PycCArchive */
+static const unsigned char CARCHIVE_MAGIC[] = { 'M', 'E', 'I', 014, 013, 012, 013, 016 };
+
+enum {
+    // PyInstaller 2.0 cookies end after the version; later ones add the
+    // name of the Python library
+    CARCHIVE_COOKIE_SIZE = 88,
+    CARCHIVE_OLD_COOKIE_SIZE = 24,
+    CARCHIVE_ENTRY_SIZE = 18,
+};
+
+/* Returns the cookie's size if a valid one starts at pos, or 0 */
+static size_t carchiveCookieSize(const unsigned char* data, size_t size, size_t pos)
+{
+    for (size_t cookieSize : { (size_t)CARCHIVE_COOKIE_SIZE, (size_t)CARCHIVE_OLD_COOKIE_SIZE }) {
+        if (size - pos < cookieSize)
+            continue;
+        PycReader in(data + pos + sizeof(CARCHIVE_MAGIC), cookieSize - sizeof(CARCHIVE_MAGIC));
+        size_t pkgSize = in.u32be();
+        size_t tocOffset = in.u32be();
+        size_t tocSize = in.u32be();
+        if (pkgSize >= cookieSize && pkgSize <= pos + cookieSize
+                && tocOffset <= pkgSize - cookieSize
+                && tocSize <= pkgSize - cookieSize - tocOffset)
+            return cookieSize;
+    }
+    return 0;
+}
+
+size_t PycCArchive::findCookie(const unsigned char* data, size_t size)
+{
+    // The bootloader carries the magic too, so take the last valid match
+    const unsigned char* end = data + size;
+    for (;;) {
+        const unsigned char* pos = std::find_end(data, end, CARCHIVE_MAGIC,
+                                                 CARCHIVE_MAGIC + sizeof(CARCHIVE_MAGIC));
+        if (pos == end)
+            return SIZE_MAX;
+        if (carchiveCookieSize(data, size, (size_t)(pos - data)) != 0)
+            return (size_t)(pos - data);
+        end = pos + sizeof(CARCHIVE_MAGIC) - 1;
+    }
+}
+
+/* Reads the Python version from a magic number, or returns false */
+static bool versionFromMagic(uint32_t magic, int& major, int& minor)
+{
+    PycModule mod;
+    mod.setVersion(magic);
+    if (!mod.isValid())
+        return false;
+    major = mod.majorVer();
+    minor = mod.minorVer();
+    return true;
+}
+
+PycCArchive::PycCArchive(std::unique_ptr<PycBuffer> source, size_t cookiePos)
+    : PycArchive(std::move(source))
+{
+    const unsigned char* data = m_source->data();
+    size_t cookieSize = carchiveCookieSize(data, m_source->size(), cookiePos);
+    if (cookieSize == 0)
+        throw std::runtime_error("Bad PyInstaller archive cookie");
+
+    PycReader in(data, m_source->size());
+    in.seek(cookiePos + sizeof(CARCHIVE_MAGIC));
+    size_t pkgSize = in.u32be();
+    size_t tocOffset = in.u32be();
+    size_t tocSize = in.u32be();
+    unsigned pyvers = in.u32be();
+
+    size_t pkgStart = cookiePos + cookieSize - pkgSize;
+    PycReader toc(data + pkgStart + tocOffset, tocSize);
+    while (!toc.atEof()) {
+        size_t entrySize = toc.u32be();
+        if (entrySize < CARCHIVE_ENTRY_SIZE)
+            throw std::runtime_error("Bad PyInstaller archive entry");
+
+        Entry entry;
+        entry.offset = pkgStart + toc.u32be();
+        entry.compressedSize = toc.u32be();
+        entry.size = toc.u32be();
+        entry.crc = 0;
+        entry.method = toc.u8() ? METHOD_ZLIB : METHOD_STORED;
+        char typecode = (char)toc.u8();
+
+        // Names are NUL padded to keep the entries aligned
+        size_t nameLen = entrySize - CARCHIVE_ENTRY_SIZE;
+        const char* name = (const char*)toc.read(nameLen);
+        entry.name.assign(name, strnlen(name, nameLen));
+
+        switch (typecode) {
+        case 's':   // Entry point scripts
+            entry.format = FORMAT_MARSHAL;
+            break;
+        case 'm':   // Modules and packages kept outside the PYZ
+        case 'M':
+            entry.format = FORMAT_PYC;
+            break;
+        case 'z':   // PYZ
+        case 'Z':   // Zip
+            entry.format = FORMAT_ARCHIVE;
+            break;
+        default:
+            entry.format = FORMAT_DATA;
+            break;
+        }
+        m_entries.push_back(std::move(entry));
+    }
+
+    // The cookie only gives major and minor, as major * 100 + minor in
+    // current releases but major * 10 + minor in older ones, so the magic of
+    // an embedded PYZ or module takes precedence
+    for (const auto& entry : m_entries) {
+        if (entry.format != FORMAT_ARCHIVE && entry.format != FORMAT_PYC)
+            continue;
+        try {
+            std::unique_ptr<PycBuffer> member = open(entry);
+            PycReader magic(member->data(), member->size());
+            if (PycPyzArchive::isPyzData(member->data(), member->size()))
+                magic.seek(4);
+            else if (!hasPycMagic(member->data(), member->size()))
+                continue;
+            if (versionFromMagic(magic.u32(), m_maj, m_min))
+                return;
+        } catch (std::runtime_error&) {
+            // Unreadable here (e.g. without zlib); try the next one
+        }
+    }
+    if (pyvers >= 100) {
+        m_maj = (int)(pyvers / 100);
+        m_min = (int)(pyvers % 100);
+    } else {
+        m_maj = (int)(pyvers / 10);
+        m_min = (int)(pyvers % 10);
+    }
+}
+
+std::unique_ptr<PycBuffer> PycCArchive::open(const Entry& entry) const
+{
+    PycReader in(m_source->data(), m_source->size());
+    in.seek(entry.offset);
+    const unsigned char* data = in.read(entry.compressedSize);
+    return openZlibEntry(data, entry, entry.method == METHOD_ZLIB);
+}
+
+
+/* PycPyzArchive */
+static const unsigned char PYZ_MAGIC[] = { 'P', 'Y', 'Z', 0 };
+
+enum {
+    PYZ_ITEM_MODULE = 0,
+    PYZ_ITEM_PKG = 1,
+};
+
+bool PycPyzArchive::isPyzData(const unsigned char* data, size_t size)
+{
+    return size >= 12 && memcmp(data, PYZ_MAGIC, sizeof(PYZ_MAGIC)) == 0;
+}
+
+/* TOC numbers are ints, except that some releases store bools */
+static int pyzTocInt(PycRef<PycObject> obj)
+{
+    if (obj.type() == PycObject::TYPE_TRUE)
+        return 1;
+    if (obj.type() == PycObject::TYPE_FALSE)
+        return 0;
+    return obj.cast<PycInt>()->value();
+}
+
+PycPyzArchive::PycPyzArchive(std::unique_ptr<PycBuffer> source)
+    : PycArchive(std::move(source))
+{
+    PycReader in(m_source->data(), m_source->size());
+    in.seek(sizeof(PYZ_MAGIC));
+    uint32_t magic = in.u32();
+    size_t tocOffset = in.u32be();
+    if (!versionFromMagic(magic, m_maj, m_min))
+        throw std::runtime_error("Unknown Python version in PYZ archive");
+
+    // The table of contents is itself marshalled: a dict of
+    // name -> (ispkg, offset, size) in old releases, and a list of
+    // (name, (typecode, offset, size)) tuples in newer ones
+    PycModule tocModule;
+    tocModule.setVersion(magic);
+    tocModule.setSource(std::unique_ptr<PycBuffer>(
+            new PycBuffer(m_source->data(), m_source->size())));
+    PycRef<PycObject> toc = tocModule.loadAt(tocOffset);
+
+    std::vector<std::pair<PycRef<PycObject>, PycRef<PycObject>>> items;
+    if (toc.type() == PycObject::TYPE_DICT) {
+        for (const auto& item : toc.cast<PycDict>()->values())
+            items.emplace_back(std::get<0>(item), std::get<1>(item));
+    } else {
+        PycRef<PycSimpleSequence> list = toc.cast<PycSimpleSequence>();
+        for (size_t i = 0; i < list->size(); ++i) {
+            PycRef<PycSimpleSequence> item = list->get(i).cast<PycSimpleSequence>();
+            if (item->size() != 2)
+                throw std::runtime_error("Bad PYZ table of contents");
+            items.emplace_back(item->get(0), item->get(1));
+        }
+    }
+
+    m_entries.reserve(items.size());
+    for (const auto& item : items) {
+        PycRef<PycSimpleSequence> info = item.second.cast<PycSimpleSequence>();
+        if (info->size() != 3)
+            throw std::runtime_error("Bad PYZ table of contents");
+
+        Entry entry;
+        entry.name = item.first.cast<PycString>()->strValue();
+        int typecode = pyzTocInt(info->get(0));
+        entry.offset = (size_t)(unsigned)pyzTocInt(info->get(1));
+        entry.compressedSize = (size_t)(unsigned)pyzTocInt(info->get(2));
+        entry.size = SIZE_MAX;
+        entry.crc = 0;
+        entry.method = PycCArchive::METHOD_ZLIB;
+        entry.format = (typecode == PYZ_ITEM_MODULE || typecode == PYZ_ITEM_PKG)
+                     ? FORMAT_MARSHAL : FORMAT_DATA;
+        m_entries.push_back(std::move(entry));
+    }
+}
+
+std::unique_ptr<PycBuffer> PycPyzArchive::open(const Entry& entry) const
+{
+    PycReader in(m_source->data(), m_source->size());
+    in.seek(entry.offset);
+    const unsigned char* data = in.read(entry.compressedSize);
+    return openZlibEntry(data, entry, true);
+}
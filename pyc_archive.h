@@ -0,0 +1,119 @@
+#ifndef _PYC_ARCHIVE_H
+#define _PYC_ARCHIVE_H
+
+#include "data.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+class PycModule;
+
+/* A bundle of files (e.g. a zip) read straight from memory, so its members
+ * can be loaded without extracting them first. */
+class PycArchive {
+public:
+    enum Format {
+        FORMAT_DATA,        // Anything that isn't compiled Python
+        FORMAT_PYC,         // A .pyc image, header included
+        FORMAT_MARSHAL,     // A bare marshalled code object
+        FORMAT_ARCHIVE,     // Another archive, e.g. a PYZ inside a CArchive
+    };
+
+    struct Entry {
+        std::string name;
+        size_t offset;          // Where the member's header or data starts
+        size_t compressedSize;
+        size_t size;            // SIZE_MAX if the format doesn't record it
+        uint32_t crc;
+        int method;
+        Format format;
+    };
+
+    virtual ~PycArchive() { }
+
+    const std::vector<Entry>& entries() const { return m_entries; }
+
+    /* The Python version of FORMAT_MARSHAL entries, or -1 if unknown */
+    int majorVer() const { return m_maj; }
+    int minorVer() const { return m_min; }
+
+    /* Returns the contents of an entry.  Stored entries are views into the
+     * archive, so the archive must outlive the returned buffer. */
+    virtual std::unique_ptr<PycBuffer> open(const Entry& entry) const = 0;
+
+    static bool isModule(const Entry& entry)
+    {
+        return entry.format == FORMAT_PYC || entry.format == FORMAT_MARSHAL;
+    }
+
+    /* Loads a FORMAT_PYC or FORMAT_MARSHAL entry into mod */
+    void loadModule(const Entry& entry, PycModule& mod) const;
+
+    /* Takes over source if it holds an archive of a supported format.  For
+     * anything else (e.g. a plain .pyc file) it returns nullptr and leaves
+     * source alone.  Throws for archives it can't parse. */
+    static std::unique_ptr<PycArchive> fromBuffer(std::unique_ptr<PycBuffer>& source);
+
+    /* True for the names of compiled modules (.pyc/.pyo) */
+    static bool isPycName(const std::string& name);
+
+protected:
+    PycArchive(std::unique_ptr<PycBuffer> source)
+        : m_source(std::move(source)), m_maj(-1), m_min(-1) { }
+
+    std::unique_ptr<PycBuffer> m_source;
+    std::vector<Entry> m_entries;
+    int m_maj, m_min;
+};
+
+/* Zip archives, including .egg/.whl files and zipimport bundles.  Entries
+ * are stored or deflated; deflate needs zlib (HAVE_ZLIB). */
+class PycZipArchive : public PycArchive {
+public:
+    enum Method {
+        METHOD_STORED = 0,
+        METHOD_DEFLATED = 8,
+
+        // Not a zip method: stands in for any method on an encrypted entry
+        METHOD_ENCRYPTED = -1,
+    };
+
+    explicit PycZipArchive(std::unique_ptr<PycBuffer> source);
+
+    std::unique_ptr<PycBuffer> open(const Entry& entry) const override;
+
+    static bool isZipData(const unsigned char* data, size_t size);
+};
+
+/* The archive PyInstaller appends to frozen executables (CArchive).  Scripts
+ * are bare marshalled code objects, modules are .pyc images, and the bulk of
+ * the code usually sits in an embedded PYZ archive.  Compressed entries need
+ * zlib (HAVE_ZLIB). */
+class PycCArchive : public PycArchive {
+public:
+    enum Method {
+        METHOD_STORED = 0,
+        METHOD_ZLIB = 1,
+    };
+
+    explicit PycCArchive(std::unique_ptr<PycBuffer> source, size_t cookiePos);
+
+    std::unique_ptr<PycBuffer> open(const Entry& entry) const override;
+
+    /* Returns the offset of the trailing cookie that locates the archive,
+     * or SIZE_MAX if there is none. */
+    static size_t findCookie(const unsigned char* data, size_t size);
+};
+
+/* PyInstaller's PYZ archive: zlib-compressed marshalled code objects, all
+ * for the Python version whose magic is in the header.  Needs zlib. */
+class PycPyzArchive : public PycArchive {
+public:
+    explicit PycPyzArchive(std::unique_ptr<PycBuffer> source);
+
+    std::unique_ptr<PycBuffer> open(const Entry& entry) const override;
+
+    static bool isPyzData(const unsigned char* data, size_t size);
+};
+
+#endif
@@ -0,0 +1,39 @@
+#include "pyc_arena.h"
+
+void PycArena::newBlock(size_t size)
+{
+    // Oversized requests get a dedicated block
+    size_t blockSize = (size > BLOCK_SIZE) ? size : (size_t)BLOCK_SIZE;
+    char* block = static_cast<char*>(::operator new(blockSize));
+    m_blocks.push_back(block);
+    m_blockSizes.push_back(blockSize);
+    m_cur = block;
+    m_end = block + blockSize;
+    m_reserved += blockSize;
+}
+
+bool PycArena::owns(const void* ptr) const
+{
+    const char* p = static_cast<const char*>(ptr);
+    for (size_t i = 0; i < m_blocks.size(); ++i) {
+        const char* block = m_blocks[i];
+        if (p >= block && p < block + m_blockSizes[i])
+            return true;
+    }
+    return false;
+}
+
+void PycArena::release()
+{
+    // Oldest first, so containers go before the objects they hold
+    for (Header* hdr = m_first; hdr; hdr = hdr->next)
+        hdr->destroy(hdr + 1);
+    for (char* block : m_blocks)
+        ::operator delete(block);
+
+    m_blocks.clear();
+    m_blockSizes.clear();
+    m_cur = m_end = nullptr;
+    m_first = m_last = nullptr;
+    m_count = m_used = m_reserved = 0;
+}
@@ -0,0 +1,82 @@
+#ifndef _PYC_ARENA_H
+#define _PYC_ARENA_H
+
+#include <cstddef>
+#include <new>
+#include <utility>
+#include <vector>
+
+/* Bump allocator for objects that all die together.  Memory is carved out
+ * of large blocks and only returned when the arena is released, at which
+ * point every object's destructor is run and the blocks are freed in bulk. */
+class PycArena {
+public:
+    PycArena()
+        : m_cur(), m_end(), m_first(), m_last(), m_count(), m_used(), m_reserved() { }
+    ~PycArena() { release(); }
+
+    PycArena(const PycArena&) = delete;
+    PycArena& operator=(const PycArena&) = delete;
+
+    template <class T, class... Args>
+    T* create(Args&&... args)
+    {
+        Header* hdr = static_cast<Header*>(allocate(sizeof(Header) + sizeof(T)));
+        T* obj = new (hdr + 1) T(std::forward<Args>(args)...);
+        hdr->destroy = &destroyObject<T>;
+        hdr->next = nullptr;
+        if (m_last)
+            m_last->next = hdr;
+        else
+            m_first = hdr;
+        m_last = hdr;
+        ++m_count;
+        return obj;
+    }
+
+    /* Raw memory, freed with the arena.  Nothing is run on it at release;
+     * whoever constructs an object there destroys it. */
+    void* allocate(size_t size)
+    {
+        size = (size + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1);
+        if ((size_t)(m_end - m_cur) < size)
+            newBlock(size);
+        void* result = m_cur;
+        m_cur += size;
+        m_used += size;
+        return result;
+    }
+
+    /* True if the pointer is into one of the arena's blocks */
+    bool owns(const void* ptr) const;
+
+    /* Runs all destructors and frees every block */
+    void release();
+
+    size_t objectCount() const { return m_count; }
+    size_t bytesUsed() const { return m_used; }
+    size_t bytesReserved() const { return m_reserved; }
+
+private:
+    enum { BLOCK_SIZE = 64 * 1024 };
+
+    struct Header {
+        void (*destroy)(void*);
+        Header* next;
+    };
+
+    template <class T>
+    static void destroyObject(void* obj) { static_cast<T*>(obj)->~T(); }
+
+    void newBlock(size_t size);
+
+    std::vector<char*> m_blocks;
+    std::vector<size_t> m_blockSizes;
+    char* m_cur;
+    char* m_end;
+    Header* m_first;
+    Header* m_last;
+    size_t m_count, m_used, m_reserved;
+};
+
+#endif
@@ -0,0 +1,254 @@
+#include "pyc_cfg.h"
+#include "bytecode.h"
+#include "pyc_code.h"
+#include <utility>
+
+namespace {
+
+enum FlowKind {
+    FLOW_NEXT,      // Falls through to the next instruction only
+    FLOW_BRANCH,    // Either falls through or goes to its target
+    FLOW_JUMP,      // Always goes to its target
+    FLOW_EXIT,      // Leaves the code object
+};
+
+FlowKind flowKind(int opcode, int target)
+{
+    switch (opcode) {
+    case Pyc::JUMP_FORWARD_A:
+    case Pyc::JUMP_ABSOLUTE_A:
+    case Pyc::JUMP_BACKWARD_A:
+    case Pyc::JUMP_BACKWARD_NO_INTERRUPT_A:
+    case Pyc::INSTRUMENTED_JUMP_FORWARD_A:
+    case Pyc::INSTRUMENTED_JUMP_BACKWARD_A:
+    case Pyc::CONTINUE_LOOP_A:
+    case Pyc::BREAK_LOOP:
+        return FLOW_JUMP;
+    case Pyc::RETURN_VALUE:
+    case Pyc::RETURN_CONST_A:
+    case Pyc::INSTRUMENTED_RETURN_VALUE_A:
+    case Pyc::INSTRUMENTED_RETURN_CONST_A:
+    case Pyc::RAISE_EXCEPTION:
+    case Pyc::RAISE_VARARGS_A:
+    case Pyc::RERAISE:
+    case Pyc::RERAISE_A:
+        return FLOW_EXIT;
+    case Pyc::SETUP_LOOP_A:
+        // The target is where BREAK_LOOP goes, not a branch
+        return FLOW_NEXT;
+    default:
+        return (target >= 0) ? FLOW_BRANCH : FLOW_NEXT;
+    }
+}
+
+void addEdge(std::vector<PycCFG::Block>& blocks, int from, int to)
+{
+    std::vector<int>& succs = blocks[from].succs;
+    for (int succ : succs) {
+        if (succ == to)
+            return;
+    }
+    succs.push_back(to);
+    blocks[to].preds.push_back(from);
+}
+
+}
+
+void PycCFG::build(const PycInstructions& insns, const PycExceptionTable& exceptions)
+{
+    m_blocks.clear();
+    m_blockOf.clear();
+    const size_t count = insns.size();
+    if (count == 0)
+        return;
+
+    const int codeLen = insns.next(count - 1);
+    std::vector<char> isInsn(codeLen, 0), isLeader(codeLen, 0);
+    for (size_t i = 0; i < count; ++i)
+        isInsn[insns.offset(i)] = 1;
+    auto validTarget = [&](int offset) {
+        return offset >= 0 && offset < codeLen && isInsn[offset];
+    };
+
+    /* Find where each instruction goes and mark the leaders.  BREAK_LOOP
+     * goes to the end of the innermost SETUP_LOOP, which nests lexically. */
+    std::vector<int> jumpTo(count, -1);
+    std::vector<int> loopEnds;
+    isLeader[insns.offset(0)] = 1;
+    for (size_t i = 0; i < count; ++i) {
+        const int offset = insns.offset(i);
+        const int opcode = insns.opcode(i);
+        while (!loopEnds.empty() && offset >= loopEnds.back())
+            loopEnds.pop_back();
+
+        int target = insns.target(i);
+        if (opcode == Pyc::BREAK_LOOP)
+            target = loopEnds.empty() ? -1 : loopEnds.back();
+        if (!validTarget(target))
+            continue;
+
+        // Block ends the decompiler works with start blocks here too
+        isLeader[target] = 1;
+        if (opcode == Pyc::SETUP_LOOP_A)
+            loopEnds.push_back(target);
+        FlowKind kind = flowKind(opcode, target);
+        if (kind == FLOW_BRANCH || kind == FLOW_JUMP)
+            jumpTo[i] = target;
+    }
+    for (size_t i = 0; i + 1 < count; ++i) {
+        if (flowKind(insns.opcode(i), insns.target(i)) != FLOW_NEXT)
+            isLeader[insns.next(i)] = 1;
+    }
+    for (size_t i = 0; i < exceptions.size(); ++i) {
+        const PycExceptionTable::Entry& entry = exceptions.entry(i);
+        if (!validTarget(entry.target))
+            continue;
+        isLeader[entry.target] = 1;
+        if (validTarget(entry.start))
+            isLeader[entry.start] = 1;
+        if (validTarget(entry.end))
+            isLeader[entry.end] = 1;
+    }
+
+    m_blockOf.assign(codeLen, -1);
+    for (size_t i = 0; i < count; ++i) {
+        if (isLeader[insns.offset(i)]) {
+            if (!m_blocks.empty())
+                m_blocks.back().last = i;
+            Block blk;
+            blk.start = blk.end = insns.offset(i);
+            blk.first = blk.last = i;
+            blk.idom = blk.ipdom = -1;
+            m_blocks.push_back(blk);
+        }
+        Block& cur = m_blocks.back();
+        cur.end = insns.next(i);
+        for (int off = insns.offset(i); off < cur.end && off < codeLen; ++off)
+            m_blockOf[off] = (int)m_blocks.size() - 1;
+    }
+    m_blocks.back().last = count;
+
+    for (size_t idx = 0; idx < m_blocks.size(); ++idx) {
+        const size_t last = m_blocks[idx].last - 1;
+        FlowKind kind = flowKind(insns.opcode(last), insns.target(last));
+        if ((kind == FLOW_NEXT || kind == FLOW_BRANCH) && idx + 1 < m_blocks.size())
+            addEdge(m_blocks, (int)idx, (int)idx + 1);
+        if (jumpTo[last] >= 0)
+            addEdge(m_blocks, (int)idx, m_blockOf[jumpTo[last]]);
+    }
+    for (size_t i = 0; i < exceptions.size(); ++i) {
+        const PycExceptionTable::Entry& entry = exceptions.entry(i);
+        if (!validTarget(entry.target) || entry.start < 0)
+            continue;
+        const int handler = m_blockOf[entry.target];
+        for (int idx = blockAt(entry.start);
+                idx >= 0 && (size_t)idx < m_blocks.size() && m_blocks[idx].start < entry.end; ++idx)
+            addEdge(m_blocks, idx, handler);
+    }
+
+    computeDominators(false);
+    computeDominators(true);
+}
+
+/* Cooper, Harvey and Kennedy's iterative algorithm.  For post-dominators it
+ * runs on the reversed graph, from a virtual exit node that every block
+ * without successors leads to. */
+void PycCFG::computeDominators(bool post)
+{
+    const int nblocks = (int)m_blocks.size();
+    const int nodes = nblocks + (post ? 1 : 0);
+    const int root = post ? nblocks : 0;
+
+    std::vector<std::vector<int>> fwd(nodes), back(nodes);
+    for (int b = 0; b < nblocks; ++b) {
+        for (int s : m_blocks[b].succs) {
+            fwd[post ? s : b].push_back(post ? b : s);
+            back[post ? b : s].push_back(post ? s : b);
+        }
+        if (post && m_blocks[b].succs.empty()) {
+            fwd[root].push_back(b);
+            back[b].push_back(root);
+        }
+    }
+
+    // Postorder numbers, from an iterative depth-first walk
+    std::vector<int> order(nodes, -1), rpo;
+    std::vector<std::pair<int, size_t>> walk;
+    std::vector<char> seen(nodes, 0);
+    walk.emplace_back(root, 0);
+    seen[root] = 1;
+    while (!walk.empty()) {
+        int node = walk.back().first;
+        size_t& edge = walk.back().second;
+        if (edge < fwd[node].size()) {
+            int next = fwd[node][edge++];
+            if (!seen[next]) {
+                seen[next] = 1;
+                walk.emplace_back(next, 0);
+            }
+        } else {
+            order[node] = (int)rpo.size();
+            rpo.push_back(node);
+            walk.pop_back();
+        }
+    }
+
+    std::vector<int> idom(nodes, -1);
+    idom[root] = root;
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (auto it = rpo.rbegin(); it != rpo.rend(); ++it) {
+            int node = *it;
+            if (node == root)
+                continue;
+            int dom = -1;
+            for (int pred : back[node]) {
+                if (idom[pred] < 0)
+                    continue;
+                if (dom < 0) {
+                    dom = pred;
+                    continue;
+                }
+                int a = pred;
+                while (a != dom) {
+                    while (order[a] < order[dom])
+                        a = idom[a];
+                    while (order[dom] < order[a])
+                        dom = idom[dom];
+                }
+            }
+            if (idom[node] != dom) {
+                idom[node] = dom;
+                changed = true;
+            }
+        }
+    }
+
+    for (int b = 0; b < nblocks; ++b) {
+        if (post)
+            m_blocks[b].ipdom = (idom[b] == root) ? -1 : idom[b];
+        else
+            m_blocks[b].idom = (b == root) ? -1 : idom[b];
+    }
+}
+
+bool PycCFG::dominates(int a, int b) const
+{
+    if (!reachable(b))
+        return false;
+    for (; b >= 0; b = m_blocks[b].idom) {
+        if (b == a)
+            return true;
+    }
+    return false;
+}
+
+bool PycCFG::postDominates(int b, int a) const
+{
+    for (; a >= 0; a = m_blocks[a].ipdom) {
+        if (a == b)
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,65 @@
+#ifndef _PYC_CFG_H
+#define _PYC_CFG_H
+
+#include <cstddef>
+#include <vector>
+
+class PycInstructions;
+class PycExceptionTable;
+
+/* Basic-block control-flow graph of one code object, with immediate
+ * dominators and post-dominators.  Blocks are numbered in code order, so
+ * block 0 is the entry.  Exception edges come from the SETUP_* handler
+ * targets before 3.11, and from the exception table after: every block in
+ * a protected range has an edge to its handler. */
+class PycCFG {
+public:
+    struct Block {
+        int start, end;             // Byte offsets, [start, end)
+        size_t first, last;         // Instruction indices, [first, last)
+        std::vector<int> succs;
+        std::vector<int> preds;
+        int idom;                   // -1 for the entry and unreachable blocks
+        int ipdom;                  // -1 if the block only leads to the exit
+    };
+
+    void build(const PycInstructions& insns, const PycExceptionTable& exceptions);
+
+    size_t size() const { return m_blocks.size(); }
+    const Block& block(size_t idx) const { return m_blocks[idx]; }
+
+    /* The block holding the given byte offset, or -1 if it is out of range */
+    int blockAt(int offset) const
+    {
+        return (offset >= 0 && (size_t)offset < m_blockOf.size()) ? m_blockOf[offset] : -1;
+    }
+
+    /* True if a block starts at the offset */
+    bool isLeader(int offset) const
+    {
+        int idx = blockAt(offset);
+        return idx >= 0 && m_blocks[idx].start == offset;
+    }
+
+    /* True if a block starts at the offset and more than one edge enters it */
+    bool isJoin(int offset) const
+    {
+        return isLeader(offset) && m_blocks[m_blockOf[offset]].preds.size() > 1;
+    }
+
+    bool reachable(int idx) const { return idx == 0 || m_blocks[idx].idom >= 0; }
+
+    /* True if every path from the entry to b goes through a */
+    bool dominates(int a, int b) const;
+
+    /* True if every path from a to the exit goes through b */
+    bool postDominates(int b, int a) const;
+
+private:
+    void computeDominators(bool post);
+
+    std::vector<Block> m_blocks;
+    std::vector<int> m_blockOf;
+};
+
+#endif
@@ -1,6 +1,9 @@
 #include "pyc_code.h"
 #include "pyc_module.h"
+#include "bytecode.h"
 #include "data.h"
+#include <algorithm>
+#include <stdexcept>
 
 /* == Marshal structure for Code object ==
                 1.0     1.3     1.5     2.1     2.3     3.0     3.8     3.11
@@ -26,105 +29,448 @@ lntable                         Obj     Obj     Obj     Obj     Obj     Obj
 exceptiontable                                                          Obj
 */
 
-void PycCode::load(PycData* stream, PycModule* mod)
-{
-    if (mod->verCompare(1, 3) >= 0 && mod->verCompare(2, 3) < 0)
-        m_argCount = stream->get16();
-    else if (mod->verCompare(2, 3) >= 0)
-        m_argCount = stream->get32();
-
-    if (mod->verCompare(3, 8) >= 0)
-        m_posOnlyArgCount = stream->get32();
-    else
-        m_posOnlyArgCount = 0;
-
-    if (mod->majorVer() >= 3)
-        m_kwOnlyArgCount = stream->get32();
-    else
-        m_kwOnlyArgCount = 0;
-
-    if (mod->verCompare(1, 3) >= 0 && mod->verCompare(2, 3) < 0)
-        m_numLocals = stream->get16();
-    else if (mod->verCompare(2, 3) >= 0 && mod->verCompare(3, 11) < 0)
-        m_numLocals = stream->get32();
-    else
-        m_numLocals = 0;
-
-    if (mod->verCompare(1, 5) >= 0 && mod->verCompare(2, 3) < 0)
-        m_stackSize = stream->get16();
-    else if (mod->verCompare(2, 3) >= 0)
-        m_stackSize = stream->get32();
-    else
-        m_stackSize = 0;
-
-    if (mod->verCompare(1, 3) >= 0 && mod->verCompare(2, 3) < 0)
-        m_flags = stream->get16();
-    else if (mod->verCompare(2, 3) >= 0)
-        m_flags = stream->get32();
-    else
-        m_flags = 0;
-
-    if (mod->verCompare(3, 8) < 0) {
+namespace {
+
+enum CodeField {
+    FIELD_ARGCOUNT, FIELD_POSONLYARGCOUNT, FIELD_KWONLYARGCOUNT, FIELD_NUMLOCALS,
+    FIELD_STACKSIZE, FIELD_FLAGS, FIELD_CODE, FIELD_CONSTS, FIELD_NAMES,
+    FIELD_LOCALNAMES, FIELD_LOCALKINDS, FIELD_FREEVARS, FIELD_CELLVARS,
+    FIELD_FILENAME, FIELD_NAME, FIELD_QUALNAME, FIELD_FIRSTLINE, FIELD_LNTABLE,
+    FIELD_EXCEPTTABLE,
+};
+
+enum FieldFormat { FMT_SHORT, FMT_LONG, FMT_OBJECT };
+
+/* One row of the table above: the field is present for versions with all
+ * of the required features and none of the excluded ones. */
+struct CodeLayoutEntry {
+    CodeField field;
+    FieldFormat format;
+    unsigned required, excluded;
+
+    bool appliesTo(const PycModule* mod) const
+    {
+        return mod->has(required) && !mod->has(excluded);
+    }
+};
+
+// The feature that starts each column of the table above
+enum {
+    V1_3 = PycModule::FEAT_LOCAL_NAMES,
+    V1_5 = PycModule::FEAT_LINE_TABLE,
+    V2_1 = PycModule::FEAT_CLOSURES,
+    V2_3 = PycModule::FEAT_LONG_CODE_FIELDS,
+    V3_0 = PycModule::FEAT_KWONLY,
+    V3_8 = PycModule::FEAT_POSONLY,
+    V3_11 = PycModule::FEAT_LOCALS_PLUS,
+    NEVER = ~0u,
+};
+
+const CodeLayoutEntry code_layout[] = {
+    { FIELD_ARGCOUNT,           FMT_SHORT,  V1_3,   V2_3 },
+    { FIELD_ARGCOUNT,           FMT_LONG,   V2_3,   NEVER },
+    { FIELD_POSONLYARGCOUNT,    FMT_LONG,   V3_8,   NEVER },
+    { FIELD_KWONLYARGCOUNT,     FMT_LONG,   V3_0,   NEVER },
+    { FIELD_NUMLOCALS,          FMT_SHORT,  V1_3,   V2_3 },
+    { FIELD_NUMLOCALS,          FMT_LONG,   V2_3,   V3_11 },
+    { FIELD_STACKSIZE,          FMT_SHORT,  V1_5,   V2_3 },
+    { FIELD_STACKSIZE,          FMT_LONG,   V2_3,   NEVER },
+    { FIELD_FLAGS,              FMT_SHORT,  V1_3,   V2_3 },
+    { FIELD_FLAGS,              FMT_LONG,   V2_3,   NEVER },
+    { FIELD_CODE,               FMT_OBJECT, 0,      NEVER },
+    { FIELD_CONSTS,             FMT_OBJECT, 0,      NEVER },
+    { FIELD_NAMES,              FMT_OBJECT, 0,      NEVER },
+    { FIELD_LOCALNAMES,         FMT_OBJECT, V1_3,   NEVER },
+    { FIELD_LOCALKINDS,         FMT_OBJECT, V3_11,  NEVER },
+    { FIELD_FREEVARS,           FMT_OBJECT, V2_1,   V3_11 },
+    { FIELD_CELLVARS,           FMT_OBJECT, V2_1,   V3_11 },
+    { FIELD_FILENAME,           FMT_OBJECT, 0,      NEVER },
+    { FIELD_NAME,               FMT_OBJECT, 0,      NEVER },
+    { FIELD_QUALNAME,           FMT_OBJECT, V3_11,  NEVER },
+    { FIELD_FIRSTLINE,          FMT_SHORT,  V1_5,   V2_3 },
+    { FIELD_FIRSTLINE,          FMT_LONG,   V2_3,   NEVER },
+    { FIELD_LNTABLE,            FMT_OBJECT, V1_5,   NEVER },
+    { FIELD_EXCEPTTABLE,        FMT_OBJECT, V3_11,  NEVER },
+};
+
+}
+
+/* Reads the plain fields from the cursor on, handing each to assign(), and
+ * stops at the next object field.  Returns false at the end of the layout. */
+template <class AssignFn>
+static bool nextObjectField(PycReader& stream, PycModule* mod, size_t& cursor,
+                            AssignFn assign)
+{
+    const size_t count = sizeof(code_layout) / sizeof(code_layout[0]);
+    for (; cursor < count; ++cursor) {
+        const CodeLayoutEntry& entry = code_layout[cursor];
+        if (!entry.appliesTo(mod))
+            continue;
+        if (entry.format == FMT_OBJECT)
+            return true;
+
+        int value = (entry.format == FMT_SHORT) ? (int)stream.u16()
+                                                : (int)stream.u32();
+        assign(entry.field, value);
+    }
+    return false;
+}
+
+bool PycCode::nextChild(PycReader& stream, PycModule* mod, size_t& cursor)
+{
+    bool more = nextObjectField(stream, mod, cursor, [this](CodeField field, int value) {
+        switch (field) {
+        case FIELD_ARGCOUNT:        m_argCount = value; break;
+        case FIELD_POSONLYARGCOUNT: m_posOnlyArgCount = value; break;
+        case FIELD_KWONLYARGCOUNT:  m_kwOnlyArgCount = value; break;
+        case FIELD_NUMLOCALS:       m_numLocals = value; break;
+        case FIELD_STACKSIZE:       m_stackSize = value; break;
+        case FIELD_FLAGS:           m_flags = value; break;
+        case FIELD_FIRSTLINE:       m_firstLine = value; break;
+        default:
+            throw std::runtime_error("Bad code object layout");
+        }
+    });
+    if (more)
+        return true;
+
+    if (!mod->has(PycModule::FEAT_SHIFTED_FUTURE_FLAGS)) {
         // Remap flags to new values introduced in 3.8
         if (m_flags & 0xF0000000)
             throw std::runtime_error("Cannot remap unexpected flags");
         m_flags = (m_flags & 0xFFFF) | ((m_flags & 0xFFF0000) << 4);
     }
 
-    m_code = LoadObject(stream, mod).cast<PycString>();
-    m_consts = LoadObject(stream, mod).cast<PycSequence>();
-    m_names = LoadObject(stream, mod).cast<PycSequence>();
-
-    if (mod->verCompare(1, 3) >= 0)
-        m_localNames = LoadObject(stream, mod).cast<PycSequence>();
-    else
+    // Fill in the fields this version doesn't marshal
+    if (m_localNames == NULL)
         m_localNames = new PycTuple;
-
-    if (mod->verCompare(3, 11) >= 0)
-        m_localKinds = LoadObject(stream, mod).cast<PycString>();
-    else
+    if (m_localKinds == NULL)
         m_localKinds = new PycString;
-
-    if (mod->verCompare(2, 1) >= 0 && mod->verCompare(3, 11) < 0)
-        m_freeVars = LoadObject(stream, mod).cast<PycSequence>();
-    else
+    if (m_freeVars == NULL)
         m_freeVars = new PycTuple;
-
-    if (mod->verCompare(2, 1) >= 0 && mod->verCompare(3, 11) < 0)
-        m_cellVars = LoadObject(stream, mod).cast<PycSequence>();
-    else
+    if (m_cellVars == NULL)
         m_cellVars = new PycTuple;
-
-    m_fileName = LoadObject(stream, mod).cast<PycString>();
-    m_name = LoadObject(stream, mod).cast<PycString>();
-
-    if (mod->verCompare(3, 11) >= 0)
-        m_qualName = LoadObject(stream, mod).cast<PycString>();
-    else
+    if (m_qualName == NULL)
         m_qualName = new PycString;
-
-    if (mod->verCompare(1, 5) >= 0 && mod->verCompare(2, 3) < 0)
-        m_firstLine = stream->get16();
-    else if (mod->verCompare(2, 3) >= 0)
-        m_firstLine = stream->get32();
-
-    if (mod->verCompare(1, 5) >= 0)
-        m_lnTable = LoadObject(stream, mod).cast<PycString>();
-    else
+    if (m_lnTable == NULL)
         m_lnTable = new PycString;
-
-    if (mod->verCompare(3, 11) >= 0)
-        m_exceptTable = LoadObject(stream, mod).cast<PycString>();
-    else
+    if (m_exceptTable == NULL)
         m_exceptTable = new PycString;
+    return false;
+}
+
+void PycCode::setChild(size_t cursor, PycRef<PycObject> obj)
+{
+    switch (code_layout[cursor].field) {
+    case FIELD_CODE:        m_code = obj.cast<PycString>(); break;
+    case FIELD_CONSTS:      m_consts = obj.cast<PycSequence>(); break;
+    case FIELD_NAMES:       m_names = obj.cast<PycSequence>(); break;
+    case FIELD_LOCALNAMES:  m_localNames = obj.cast<PycSequence>(); break;
+    case FIELD_LOCALKINDS:  m_localKinds = obj.cast<PycString>(); break;
+    case FIELD_FREEVARS:    m_freeVars = obj.cast<PycSequence>(); break;
+    case FIELD_CELLVARS:    m_cellVars = obj.cast<PycSequence>(); break;
+    case FIELD_FILENAME:    m_fileName = obj.cast<PycString>(); break;
+    case FIELD_NAME:        m_name = obj.cast<PycString>(); break;
+    case FIELD_QUALNAME:    m_qualName = obj.cast<PycString>(); break;
+    case FIELD_LNTABLE:     m_lnTable = obj.cast<PycString>(); break;
+    case FIELD_EXCEPTTABLE: m_exceptTable = obj.cast<PycString>(); break;
+    default:
+        throw std::runtime_error("Bad code object layout");
+    }
+}
+
+bool PycCode::skipFields(PycReader& stream, PycModule* mod, size_t& cursor)
+{
+    return nextObjectField(stream, mod, cursor, [](CodeField, int) { });
 }
 
 PycRef<PycString> PycCode::getCellVar(PycModule* mod, int idx) const
 {
-    if (mod->verCompare(3, 11) >= 0)
+    if (mod->has(PycModule::FEAT_LOCALS_PLUS))
         return getLocal(idx);
 
-    return (idx >= m_cellVars->size())
+    return ((size_t)idx >= m_cellVars->size())
         ? m_freeVars->get(idx - m_cellVars->size()).cast<PycString>()
         : m_cellVars->get(idx).cast<PycString>();
 }
+
+const PycInstructions& PycCode::instructions(PycModule* mod) const
+{
+    if (!m_instructions) {
+        m_instructions.reset(new PycInstructions);
+        bc_decode(m_code, mod, *m_instructions);
+    }
+    return *m_instructions;
+}
+
+const PycInstructions& PycCode::lowered(PycModule* mod) const
+{
+    if (!m_lowered) {
+        m_lowered.reset(new PycInstructions);
+        bc_lower(instructions(mod), mod, *m_lowered);
+    }
+    return *m_lowered;
+}
+
+const PycCFG& PycCode::cfg(PycModule* mod) const
+{
+    if (!m_cfg) {
+        m_cfg.reset(new PycCFG);
+        m_cfg->build(instructions(mod), exceptionIndex());
+    }
+    return *m_cfg;
+}
+
+const PycExceptionTable& PycCode::exceptionIndex() const
+{
+    if (!m_exceptionIndex) {
+        m_exceptionIndex.reset(new PycExceptionTable);
+        m_exceptionIndex->decode(m_exceptTable->data(), m_exceptTable->length());
+    }
+    return *m_exceptionIndex;
+}
+
+const PycStackDepth& PycCode::stackDepth(PycModule* mod) const
+{
+    if (!m_stackDepth) {
+        m_stackDepth.reset(new PycStackDepth);
+        m_stackDepth->analyze(instructions(mod), exceptionIndex(), mod);
+    }
+    return *m_stackDepth;
+}
+
+const PycLineTable& PycCode::lineIndex(PycModule* mod) const
+{
+    if (!m_lineIndex) {
+        m_lineIndex.reset(new PycLineTable);
+        if (!mod->has(PycModule::FEAT_LINE_TABLE)) {
+            m_lineIndex->fromSetLineno(instructions(mod));
+        } else {
+            PycLineTable::Format format = PycLineTable::FORMAT_LNOTAB;
+            if (mod->has(PycModule::FEAT_LOCATION_TABLE))
+                format = PycLineTable::FORMAT_LOCATIONS;
+            else if (mod->has(PycModule::FEAT_LINE_RANGES))
+                format = PycLineTable::FORMAT_LINETABLE;
+            else if (mod->has(PycModule::FEAT_SIGNED_LINE_DELTAS))
+                format = PycLineTable::FORMAT_LNOTAB_SIGNED;
+            m_lineIndex->decode(m_lnTable->data(), m_lnTable->length(), m_firstLine, format);
+        }
+    }
+    return *m_lineIndex;
+}
+
+
+/* PycInstructions */
+void PycInstructions::reserve(size_t count)
+{
+    m_offsets.reserve(count);
+    m_opcodes.reserve(count);
+    m_operands.reserve(count);
+    m_lengths.reserve(count);
+    m_targets.reserve(count);
+    m_flags.reserve(count);
+}
+
+void PycInstructions::append(int offset, int opcode, int operand, int length, int target,
+                             unsigned flags)
+{
+    m_offsets.push_back(offset);
+    m_opcodes.push_back((int16_t)opcode);
+    m_operands.push_back(operand);
+    m_lengths.push_back((uint8_t)length);
+    m_targets.push_back(target);
+    m_flags.push_back((uint8_t)flags);
+}
+
+
+/* PycExceptionTable */
+void PycExceptionTable::decode(const char* data, size_t length)
+{
+    m_entries.clear();
+    m_handlers.clear();
+
+    /* Each value is big-endian in 6 bit groups, with 0x40 set on all but
+     * the last group (and 0x80 marking the first byte of an entry) */
+    size_t pos = 0;
+    auto varint = [&](int& value) {
+        if (pos >= length)
+            return false;
+        unsigned char byte = data[pos++];
+        value = byte & 0x3F;
+        while (byte & 0x40) {
+            // Nothing real comes near this, and it keeps offsets in range
+            if (pos >= length || value >= (1 << 24))
+                return false;
+            byte = data[pos++];
+            value = (value << 6) | (byte & 0x3F);
+        }
+        return true;
+    };
+
+    for (;;) {
+        int start, size, target, depthLasti;
+        if (!varint(start) || !varint(size) || !varint(target) || !varint(depthLasti))
+            break;
+
+        // Offsets are stored in code units
+        Entry entry;
+        entry.start = start * 2;
+        entry.end = (start + size) * 2;
+        entry.target = target * 2;
+        entry.depth = depthLasti >> 1;
+        entry.lasti = (depthLasti & 1) != 0;
+        m_entries.push_back(entry);
+        m_handlers.push_back(entry.target);
+    }
+
+    // CPython writes them in order; don't count on it for odd input
+    std::stable_sort(m_entries.begin(), m_entries.end(),
+                     [](const Entry& a, const Entry& b) { return a.start < b.start; });
+    std::sort(m_handlers.begin(), m_handlers.end());
+    m_handlers.erase(std::unique(m_handlers.begin(), m_handlers.end()), m_handlers.end());
+}
+
+const PycExceptionTable::Entry* PycExceptionTable::find(int offset) const
+{
+    auto it = std::upper_bound(m_entries.begin(), m_entries.end(), offset,
+                               [](int off, const Entry& entry) { return off < entry.start; });
+    if (it == m_entries.begin())
+        return nullptr;
+    --it;
+    return (offset < it->end) ? &*it : nullptr;
+}
+
+int PycExceptionTable::nextHandler(int offset) const
+{
+    auto it = std::lower_bound(m_handlers.begin(), m_handlers.end(), offset);
+    return (it != m_handlers.end()) ? *it : -1;
+}
+
+
+/* PycLineTable */
+void PycLineTable::add(int start, int line)
+{
+    // Only keep the offsets where the line changes
+    if (!m_lines.empty() && m_lines.back() == line)
+        return;
+    m_starts.push_back(start);
+    m_lines.push_back(line);
+}
+
+void PycLineTable::decode(const char* data, size_t length, int firstLine, Format format)
+{
+    m_starts.clear();
+    m_lines.clear();
+
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(data);
+    int offset = 0;
+    int line = firstLine;
+
+    if (format == FORMAT_LNOTAB || format == FORMAT_LNOTAB_SIGNED) {
+        // The line only takes effect once the offset moves past it
+        for (size_t pos = 0; pos + 1 < length; pos += 2) {
+            if (bytes[pos] != 0) {
+                add(offset, line);
+                offset += bytes[pos];
+            }
+            int lineIncr = bytes[pos + 1];
+            if (format == FORMAT_LNOTAB_SIGNED && lineIncr >= 0x80)
+                lineIncr -= 0x100;
+            line += lineIncr;
+        }
+        add(offset, line);
+        return;
+    }
+
+    if (format == FORMAT_LINETABLE) {
+        // A delta of -128 means no line, without moving the running line
+        for (size_t pos = 0; pos + 1 < length; pos += 2) {
+            int size = bytes[pos];
+            int delta = static_cast<signed char>(bytes[pos + 1]);
+            if (delta != -128)
+                line += delta;
+            if (size != 0) {
+                add(offset, (delta == -128) ? -1 : line);
+                offset += size;
+            }
+        }
+        if (offset != 0)
+            add(offset, -1);
+        return;
+    }
+
+    /* FORMAT_LOCATIONS: each entry starts with a byte with 0x80 set, then
+     * a 4 bit kind and the length - 1 in code units.  Varints here are
+     * little-endian in 6 bit groups, with 0x40 set on all but the last. */
+    size_t pos = 0;
+    auto varint = [&](int& value) {
+        if (pos >= length)
+            return false;
+        unsigned char byte = bytes[pos++];
+        value = byte & 0x3F;
+        for (int shift = 6; byte & 0x40; shift += 6) {
+            if (pos >= length || shift > 24)
+                return false;
+            byte = bytes[pos++];
+            value |= (byte & 0x3F) << shift;
+        }
+        return true;
+    };
+    auto svarint = [&](int& value) {
+        if (!varint(value))
+            return false;
+        value = (value & 1) ? -(value >> 1) : (value >> 1);
+        return true;
+    };
+
+    while (pos < length && (bytes[pos] & 0x80) != 0) {
+        const int kind = (bytes[pos] >> 3) & 0x0F;
+        const int size = ((bytes[pos] & 0x07) + 1) * 2;
+        ++pos;
+
+        int entryLine = line, delta, ignored;
+        if (kind == 15) {
+            // No location
+            entryLine = -1;
+        } else if (kind == 14) {
+            // Long form: line delta, end line delta, column and end column
+            if (!svarint(delta) || !varint(ignored) || !varint(ignored) || !varint(ignored))
+                break;
+            entryLine = (line += delta);
+        } else if (kind == 13) {
+            // No column
+            if (!svarint(delta))
+                break;
+            entryLine = (line += delta);
+        } else if (kind >= 10) {
+            // One line form, with the line delta in the kind
+            entryLine = (line += kind - 10);
+            pos += 2;
+        } else {
+            // Short form, on the same line
+            pos += 1;
+        }
+        add(offset, entryLine);
+        offset += size;
+    }
+    if (offset != 0)
+        add(offset, -1);
+}
+
+void PycLineTable::fromSetLineno(const PycInstructions& insns)
+{
+    m_starts.clear();
+    m_lines.clear();
+    for (size_t i = 0; i < insns.size(); ++i) {
+        if (insns.opcode(i) == Pyc::SET_LINENO_A)
+            add(insns.offset(i), insns.operand(i));
+    }
+}
+
+int PycLineTable::lineAt(int offset) const
+{
+    auto it = std::upper_bound(m_starts.begin(), m_starts.end(), offset);
+    if (it == m_starts.begin())
+        return -1;
+    return m_lines[(it - m_starts.begin()) - 1];
+}
@@ -3,11 +3,118 @@
 
 #include "pyc_sequence.h"
 #include "pyc_string.h"
+#include "pyc_cfg.h"
+#include "pyc_stack.h"
+#include <cstdint>
+#include <memory>
 #include <vector>
 
-class PycData;
+class PycReader;
 class PycModule;
 
+/* A code object's instructions, decoded once by bc_decode() and kept as
+ * parallel arrays.  Offsets are byte offsets into the code string, and an
+ * instruction's length includes its EXTENDED_ARG prefixes, up to MAX_LENGTH.
+ *
+ * The same layout holds the lowered form built by bc_lower(), where each
+ * version's spelling of an operation is replaced by one canonical opcode
+ * and operand, and the extra stack effects it encoded become flags. */
+class PycInstructions {
+public:
+    enum Flags {
+        FLAG_PUSH_NULL = 0x1,   // Push NULL before the result (3.11+ LOAD_GLOBAL, 3.12+ LOAD_ATTR)
+        FLAG_KW_NAMES = 0x2,    // CALL takes its keyword names from KW_NAMES, not the operand
+        FLAG_POP_NULL = 0x4,    // CALL pops the NULL pushed before its callable, if any
+    };
+
+    enum { MAX_LENGTH = UINT8_MAX };
+
+    size_t size() const { return m_opcodes.size(); }
+
+    int offset(size_t idx) const { return m_offsets[idx]; }
+    int opcode(size_t idx) const { return m_opcodes[idx]; }
+    int operand(size_t idx) const { return m_operands[idx]; }
+    int length(size_t idx) const { return m_lengths[idx]; }
+    int next(size_t idx) const { return m_offsets[idx] + m_lengths[idx]; }
+
+    /* The absolute offset a jump goes to, or -1 if the instruction doesn't
+     * jump */
+    int target(size_t idx) const { return m_targets[idx]; }
+
+    unsigned flags(size_t idx) const { return m_flags[idx]; }
+
+    void reserve(size_t count);
+    void append(int offset, int opcode, int operand, int length, int target,
+                unsigned flags = 0);
+
+private:
+    std::vector<int> m_offsets;
+    std::vector<int16_t> m_opcodes;
+    std::vector<int> m_operands;
+    std::vector<uint8_t> m_lengths;
+    std::vector<int> m_targets;
+    std::vector<uint8_t> m_flags;
+};
+
+/* The 3.11+ exception table (co_exceptiontable), decoded from its varint
+ * form into ranges sorted by start.  A range covers [start, end) and sends
+ * exceptions to target with the stack cut to depth, after pushing the
+ * faulting offset if lasti is set. */
+class PycExceptionTable {
+public:
+    struct Entry {
+        int start, end, target, depth;
+        bool lasti;
+    };
+
+    void decode(const char* data, size_t length);
+
+    size_t size() const { return m_entries.size(); }
+    const Entry& entry(size_t idx) const { return m_entries[idx]; }
+
+    /* The range covering the offset, or nullptr if there is none */
+    const Entry* find(int offset) const;
+
+    /* The first handler target at or after the offset, or -1 */
+    int nextHandler(int offset) const;
+
+private:
+    std::vector<Entry> m_entries;
+    std::vector<int> m_handlers;    // Distinct targets, sorted
+};
+
+/* Source line numbers by bytecode offset.  Whichever form the version
+ * keeps them in (SET_LINENO instructions, co_lnotab, or the 3.10 or 3.11+
+ * co_linetable) is decoded into the offsets where the line changes, so a
+ * lookup is one binary search. */
+class PycLineTable {
+public:
+    enum Format {
+        FORMAT_LNOTAB,          // 1.5 - 3.5: (offset, line) increments
+        FORMAT_LNOTAB_SIGNED,   // 3.6 - 3.9: the line increment is signed
+        FORMAT_LINETABLE,       // 3.10: (length, line delta) ranges
+        FORMAT_LOCATIONS,       // 3.11 ->: PEP 657 location entries
+    };
+
+    void decode(const char* data, size_t length, int firstLine, Format format);
+
+    /* Before 1.5 there is no table, only SET_LINENO instructions */
+    void fromSetLineno(const PycInstructions& insns);
+
+    size_t size() const { return m_starts.size(); }
+    int start(size_t idx) const { return m_starts[idx]; }
+    int line(size_t idx) const { return m_lines[idx]; }
+
+    /* The source line of the offset, or -1 if it has none */
+    int lineAt(int offset) const;
+
+private:
+    void add(int start, int line);
+
+    std::vector<int> m_starts;      // Sorted
+    std::vector<int> m_lines;       // -1 where there is no line
+};
+
 class PycCode : public PycObject {
 public:
     typedef std::vector<PycRef<PycString>> globals_t;
@@ -25,7 +132,7 @@ public:
         CO_GENERATOR_ALLOWED = 0x1000,                      // 2.3 only
 
         // The FUTURE flags are shifted left 4 bits starting from Python 3.8
-        // Older versions are automatically mapped to the new values in load()
+        // Older versions are automatically mapped to the new values when loaded
         CO_FUTURE_DIVISION = 0x20000,                       // 2.3 - 2.7, 3.1 ->
         CO_FUTURE_ABSOLUTE_IMPORT = 0x40000,                // 2.5 - 2.7, 3.1 ->
         CO_FUTURE_WITH_STATEMENT = 0x80000,                 // 2.5 - 2.7, 3.1 ->
@@ -41,7 +148,12 @@ public:
         : PycObject(type), m_argCount(), m_posOnlyArgCount(), m_kwOnlyArgCount(),
           m_numLocals(), m_stackSize(), m_flags(), m_firstLine() { }
 
-    void load(PycData* stream, PycModule* mod) override;
+    bool nextChild(PycReader& stream, PycModule* mod, size_t& cursor) override;
+    void setChild(size_t cursor, PycRef<PycObject> obj) override;
+
+    /* Skips the plain fields of a marshalled code object from the cursor on,
+     * for SkipObject.  Returns false after the last field. */
+    static bool skipFields(PycReader& stream, PycModule* mod, size_t& cursor);
 
     int argCount() const { return m_argCount; }
     int posOnlyArgCount() const { return m_posOnlyArgCount; }
@@ -80,6 +192,24 @@ public:
 
     PycRef<PycString> getCellVar(PycModule* mod, int idx) const;
 
+    /* The decoded instructions, built on first use and then kept */
+    const PycInstructions& instructions(PycModule* mod) const;
+
+    /* The lowered instructions the decompiler works from, also kept */
+    const PycInstructions& lowered(PycModule* mod) const;
+
+    /* The control-flow graph over the instructions, also kept */
+    const PycCFG& cfg(PycModule* mod) const;
+
+    /* The decoded exception table (empty before 3.11), also kept */
+    const PycExceptionTable& exceptionIndex() const;
+
+    /* The decoded line numbers, also kept */
+    const PycLineTable& lineIndex(PycModule* mod) const;
+
+    /* The stack depth at each instruction, also kept */
+    const PycStackDepth& stackDepth(PycModule* mod) const;
+
     const globals_t& getGlobals() const { return m_globalsUsed; }
 
     void markGlobal(PycRef<PycString> varname)
@@ -104,6 +234,12 @@ private:
     PycRef<PycString> m_lnTable;
     PycRef<PycString> m_exceptTable;
     globals_t m_globalsUsed; /* Global vars used in this code */
+    mutable std::unique_ptr<PycInstructions> m_instructions;
+    mutable std::unique_ptr<PycInstructions> m_lowered;
+    mutable std::unique_ptr<PycCFG> m_cfg;
+    mutable std::unique_ptr<PycExceptionTable> m_exceptionIndex;
+    mutable std::unique_ptr<PycLineTable> m_lineIndex;
+    mutable std::unique_ptr<PycStackDepth> m_stackDepth;
 };
 
 #endif
@@ -1,6 +1,10 @@
 #include "pyc_module.h"
+#include "bytecode.h"
 #include "data.h"
 #include <stdexcept>
+#include <cstring>
+#include <memory>
+#include <algorithm>
 
 void PycModule::setVersion(unsigned int magic)
 {
@@ -187,6 +191,52 @@ void PycModule::setVersion(unsigned int magic)
         m_maj = -1;
         m_min = -1;
     }
+    versionChanged();
+}
+
+/* Works out everything that follows from the version alone */
+void PycModule::versionChanged()
+{
+    static const struct {
+        Feature feature;
+        int maj, min;
+    } feature_versions[] = {
+        { FEAT_LOCAL_NAMES,             1, 3 },
+        { FEAT_LINE_TABLE,              1, 5 },
+        { FEAT_CLOSURES,                2, 1 },
+        { FEAT_LONG_CODE_FIELDS,        2, 3 },
+        { FEAT_UNIFIED_INTS,            3, 0 },
+        { FEAT_KWONLY,                  3, 0 },
+        { FEAT_SOURCE_SIZE,             3, 3 },
+        { FEAT_WORDCODE,                3, 6 },
+        { FEAT_HEADER_FLAGS,            3, 7 },
+        { FEAT_SHIFTED_FUTURE_FLAGS,    3, 8 },
+        { FEAT_POSONLY,                 3, 8 },
+        { FEAT_NO_SETUP_LOOP,           3, 8 },
+        { FEAT_JUMPS_IN_UNITS,          3, 10 },
+        { FEAT_CACHES,                  3, 11 },
+        { FEAT_EXCEPTION_TABLE,         3, 11 },
+        { FEAT_QUALNAME,                3, 11 },
+        { FEAT_LOCALS_PLUS,             3, 11 },
+        { FEAT_RELATIVE_JUMPS,          3, 12 },
+        { FEAT_SIGNED_LINE_DELTAS,      3, 6 },
+        { FEAT_LINE_RANGES,             3, 10 },
+        { FEAT_LOCATION_TABLE,          3, 11 },
+        { FEAT_NULL_PUSH,               3, 11 },
+        { FEAT_SHIFTED_LOAD_ATTR,       3, 12 },
+        { FEAT_COMPARE_SHIFT_4,         3, 12 },
+        { FEAT_COMPARE_SHIFT_5,         3, 13 },
+    };
+
+    m_features = 0;
+    if (isValid()) {
+        for (const auto& entry : feature_versions) {
+            if (verCompare(entry.maj, entry.min) >= 0)
+                m_features |= entry.feature;
+        }
+    }
+    m_opcodeMap = Pyc::OpcodeMap(m_maj, m_min);
+    m_cacheMap = Pyc::CacheMap(m_maj, m_min);
 }
 
 bool PycModule::isSupportedVersion(int major, int minor)
@@ -205,42 +255,77 @@ bool PycModule::isSupportedVersion(int major, int minor)
 
 void PycModule::loadFromFile(const char* filename)
 {
-    PycFile in(filename);
-    if (!in.isOpen()) {
+    std::unique_ptr<PycBuffer> source = OpenInputFile(filename);
+    if (!source->isOpen()) {
         fprintf(stderr, "Error opening file %s\n", filename);
         return;
     }
-    setVersion(in.get32());
-    if (!isValid()) {
+    loadFromBuffer(std::move(source));
+}
+
+bool PycModule::loadHeaderFromFile(const char* filename)
+{
+    unsigned char buffer[Header::MAX_SIZE];
+    size_t size = sizeof(buffer);
+    if (!ReadFileHead(filename, buffer, size))
+        return false;
+
+    PycReader in(buffer, size);
+    readHeader(in);
+    return true;
+}
+
+void PycModule::loadFromBuffer(std::unique_ptr<PycBuffer> source)
+{
+    m_source = std::move(source);
+    PycReader in(m_source->data(), m_source->size());
+    if (!readHeader(in)) {
         fputs("Bad MAGIC!\n", stderr);
         return;
     }
 
-    int flags = 0;
-    if (verCompare(3, 7) >= 0)
-        flags = in.get32();
+    m_code = LoadObject(in, this).cast<PycCode>();
+}
 
-    if (flags & 0x1) {
+/* Sets the version from the magic and reads the rest of the header.
+ * Returns false (having read only the magic) if the magic is unknown. */
+bool PycModule::readHeader(PycReader& in)
+{
+    m_header = Header();
+    m_header.magic = in.u32();
+    setVersion(m_header.magic);
+    if (!isValid())
+        return false;
+
+    if (has(FEAT_HEADER_FLAGS))
+        m_header.flags = in.u32();
+
+    if (m_header.flags & Header::FLAG_HASH_BASED) {
         // Optional checksum added in Python 3.7
-        in.get32();
-        in.get32();
+        memcpy(m_header.hash, in.read(sizeof(m_header.hash)), sizeof(m_header.hash));
     } else {
-        in.get32(); // Timestamp -- who cares?
+        m_header.timestamp = in.u32();
 
-        if (verCompare(3, 3) >= 0)
-            in.get32(); // Size parameter added in Python 3.3
+        if (has(FEAT_SOURCE_SIZE))
+            m_header.sourceSize = in.u32(); // Size parameter added in Python 3.3
     }
-
-    m_code = LoadObject(&in, this).cast<PycCode>();
+    return true;
 }
 
 void PycModule::loadFromMarshalledFile(const char* filename, int major, int minor)
 {
-    PycFile in (filename);
-    if (!in.isOpen()) {
+    std::unique_ptr<PycBuffer> source = OpenInputFile(filename);
+    if (!source->isOpen()) {
         fprintf(stderr, "Error opening file %s\n", filename);
         return;
     }
+    loadFromMarshalledBuffer(std::move(source), major, minor);
+}
+
+void PycModule::loadFromMarshalledBuffer(std::unique_ptr<PycBuffer> source,
+                                         int major, int minor)
+{
+    m_source = std::move(source);
     if (!isSupportedVersion(major, minor)) {
         fprintf(stderr, "Unsupported version %d.%d\n", major, minor);
         return;
@@ -248,19 +333,104 @@ void PycModule::loadFromMarshalledFile(const char* filename, int major, int mino
     m_maj = major;
     m_min = minor;
     m_unicode = (major >= 3);
-    m_code = LoadObject(&in, this).cast<PycCode>();
+    versionChanged();
+
+    PycReader in(m_source->data(), m_source->size());
+    m_code = LoadObject(in, this).cast<PycCode>();
+}
+
+/* Adds a slot for the object at offset, or fills in the existing one when
+ * a region the lazy loader skipped over is loaded later. */
+void PycModule::bindSlot(std::vector<RefSlot>& slots, PycRef<PycObject> obj,
+                         size_t offset)
+{
+    if (slots.empty() || offset > slots.back().offset) {
+        slots.push_back({ std::move(obj), offset });
+        return;
+    }
+
+    auto it = std::lower_bound(slots.begin(), slots.end(), offset,
+                [](const RefSlot& slot, size_t off) { return slot.offset < off; });
+    if (it == slots.end() || it->offset != offset)
+        throw std::runtime_error("Inconsistent marshal references");
+    if (obj != NULL)
+        it->obj = std::move(obj);
+}
+
+const PycModule::RefSlot& PycModule::getSlot(const std::vector<RefSlot>& slots,
+                                             size_t ref, const char* what)
+{
+    if (ref >= slots.size())
+        throw std::out_of_range(what);
+    return slots[ref];
+}
+
+void PycModule::intern(PycRef<PycString> str, size_t offset)
+{
+    bindSlot(m_interns, str.cast<PycObject>(), offset);
+}
+
+void PycModule::skipIntern(size_t offset)
+{
+    bindSlot(m_interns, nullptr, offset);
+}
+
+PycRef<PycString> PycModule::getIntern(size_t ref)
+{
+    const RefSlot& slot = getSlot(m_interns, ref, "Intern index out of range");
+    if (slot.obj == NULL)
+        return loadAt(slot.offset).cast<PycString>();
+    return slot.obj.cast<PycString>();
+}
+
+void PycModule::refObject(PycRef<PycObject> obj, size_t offset)
+{
+    bindSlot(m_refs, std::move(obj), offset);
+}
+
+void PycModule::skipRef(size_t offset)
+{
+    bindSlot(m_refs, nullptr, offset);
+}
+
+PycRef<PycObject> PycModule::getRef(size_t ref)
+{
+    const RefSlot& slot = getSlot(m_refs, ref, "Ref index out of range");
+    if (slot.obj == NULL)
+        return loadAt(slot.offset);
+    return slot.obj;
+}
+
+PycRef<PycObject> PycModule::findRef(size_t offset) const
+{
+    // Objects are only revisited when loading a lazily skipped region
+    if (m_refs.empty() || offset > m_refs.back().offset)
+        return nullptr;
+
+    auto it = std::lower_bound(m_refs.begin(), m_refs.end(), offset,
+                [](const RefSlot& slot, size_t off) { return slot.offset < off; });
+    return (it != m_refs.end() && it->offset == offset) ? it->obj : nullptr;
+}
+
+size_t PycModule::codeExtent(size_t offset) const
+{
+    auto it = std::lower_bound(m_codeExtents.begin(), m_codeExtents.end(), offset,
+                [](const CodeExtent& ext, size_t off) { return ext.offset < off; });
+    return (it != m_codeExtents.end() && it->offset == offset) ? it->size : 0;
 }
 
-PycRef<PycString> PycModule::getIntern(int ref) const
+void PycModule::addCodeExtent(size_t offset, size_t size)
 {
-    if (ref < 0 || (size_t)ref >= m_interns.size())
-        throw std::out_of_range("Intern index out of range");
-    return m_interns[(size_t)ref];
+    // Nested code objects finish (and get recorded) before their parent
+    auto it = std::lower_bound(m_codeExtents.begin(), m_codeExtents.end(), offset,
+                [](const CodeExtent& ext, size_t off) { return ext.offset < off; });
+    if (it == m_codeExtents.end() || it->offset != offset)
+        m_codeExtents.insert(it, { offset, size });
 }
 
-PycRef<PycObject> PycModule::getRef(int ref) const
+PycRef<PycObject> PycModule::loadAt(size_t offset)
 {
-    if (ref < 0 || (size_t)ref >= m_refs.size())
-        throw std::out_of_range("Ref index out of range");
-    return m_refs[(size_t)ref];
+    PycReader in(m_source->data(), m_source->size());
+    in.seek(offset);
+    return LoadObject(in, this);
 }
@@ -2,6 +2,9 @@
 #define _PYC_MODULE_H
 
 #include "pyc_code.h"
+#include "data.h"
+#include "pyc_arena.h"
+#include <memory>
 #include <vector>
 
 enum PycMagic {
@@ -42,10 +45,82 @@ enum PycMagic {
 
 class PycModule {
 public:
-    PycModule() : m_maj(-1), m_min(-1), m_unicode(false) { }
+    enum { DEFAULT_MAX_LOAD_DEPTH = 2000 };
+
+    /* The fields of a .pyc header.  Those a version doesn't have stay 0. */
+    struct Header {
+        enum {
+            // Flags added in Python 3.7 (PEP 552)
+            FLAG_HASH_BASED = 0x1,
+            FLAG_CHECK_SOURCE = 0x2,
+
+            MAX_SIZE = 16,
+        };
+
+        uint32_t magic;
+        uint32_t flags;         // Python 3.7 ->
+        uint32_t timestamp;     // Unless hash based
+        uint32_t sourceSize;    // Python 3.3 ->, unless hash based
+        unsigned char hash[8];  // Hash based only, as raw bytes
+    };
+
+    /* What a version's marshal format and bytecode look like, worked out
+     * once when the version is set, so the loader, decoder and decompiler
+     * can test a bit instead of comparing versions. */
+    enum Feature {
+        FEAT_LOCAL_NAMES = 0x1,         // 1.3 -> (argcount, nlocals, flags, varnames)
+        FEAT_LINE_TABLE = 0x2,          // 1.5 -> (stacksize, firstlineno, lnotab)
+        FEAT_CLOSURES = 0x4,            // 2.1 -> (freevars and cellvars)
+        FEAT_LONG_CODE_FIELDS = 0x8,    // 2.3 -> (code object counts are 32 bit)
+        FEAT_UNIFIED_INTS = 0x10,       // 3.0 -> (no 'L' suffix on longs)
+        FEAT_KWONLY = 0x20,             // 3.0 ->
+        FEAT_SOURCE_SIZE = 0x40,        // 3.3 -> (in the .pyc header)
+        FEAT_WORDCODE = 0x80,           // 3.6 -> (every instruction is two bytes)
+        FEAT_HEADER_FLAGS = 0x100,      // 3.7 -> (PEP 552)
+        FEAT_SHIFTED_FUTURE_FLAGS = 0x200,  // 3.8 -> (CO_FUTURE_* stored 4 bits higher)
+        FEAT_POSONLY = 0x400,           // 3.8 ->
+        FEAT_NO_SETUP_LOOP = 0x800,     // 3.8 -> (loop extents are implicit)
+        FEAT_JUMPS_IN_UNITS = 0x1000,   // 3.10 -> (jump arguments count code units)
+        FEAT_CACHES = 0x2000,           // 3.11 -> (inline CACHE entries)
+        FEAT_EXCEPTION_TABLE = 0x4000,  // 3.11 ->
+        FEAT_QUALNAME = 0x8000,         // 3.11 ->
+        FEAT_LOCALS_PLUS = 0x10000,     // 3.11 -> (cells and frees share the locals)
+        FEAT_RELATIVE_JUMPS = 0x20000,  // 3.12 -> (conditional jumps are relative too)
+        FEAT_SIGNED_LINE_DELTAS = 0x40000,  // 3.6 -> (lnotab line increments are signed)
+        FEAT_LINE_RANGES = 0x80000,     // 3.10 -> (co_linetable, PEP 626)
+        FEAT_LOCATION_TABLE = 0x100000, // 3.11 -> (co_linetable holds PEP 657 locations)
+        FEAT_NULL_PUSH = 0x200000,      // 3.11 -> (LOAD_GLOBAL's low bit pushes a NULL for CALL)
+        FEAT_SHIFTED_LOAD_ATTR = 0x400000,  // 3.12 -> (LOAD_ATTR's low bit is the method flag)
+        FEAT_COMPARE_SHIFT_4 = 0x800000,    // 3.12 -> (COMPARE_OP operand shifted, GH-100923)
+        FEAT_COMPARE_SHIFT_5 = 0x1000000,   // 3.13 -> (... by one more bit)
+    };
+
+    PycModule()
+        : m_maj(-1), m_min(-1), m_features(0), m_unicode(false), m_lazyCode(false),
+          m_maxLoadDepth(DEFAULT_MAX_LOAD_DEPTH), m_maxLoadObjects(SIZE_MAX),
+          m_objectCount(0), m_header(), m_opcodeMap(nullptr), m_cacheMap(nullptr) { }
 
     void loadFromFile(const char* filename);
+
+    /* Reads only the header of a .pyc file, leaving code() empty, for
+     * triaging many files quickly.  Returns false if the file can't be
+     * read; check isValid() for whether the magic was recognized. */
+    bool loadHeaderFromFile(const char* filename);
+    const Header& header() const { return m_header; }
     void loadFromMarshalledFile(const char *filename, int major, int minor);
+
+    /* Loads a .pyc image held in memory (e.g. an archive member).  The
+     * module keeps the buffer, since loaded strings point into it. */
+    void loadFromBuffer(std::unique_ptr<PycBuffer> source);
+
+    /* Loads a bare marshalled code object held in memory (e.g. a PyInstaller
+     * bundle member), which carries no header to take the version from. */
+    void loadFromMarshalledBuffer(std::unique_ptr<PycBuffer> source, int major, int minor);
+
+    /* For marshalled data that isn't a module (e.g. an archive's table of
+     * contents): set the version and input, then loadAt() the objects. */
+    void setVersion(unsigned int magic);
+    void setSource(std::unique_ptr<PycBuffer> source) { m_source = std::move(source); }
     bool isValid() const { return (m_maj >= 0) && (m_min >= 0); }
 
     int majorVer() const { return m_maj; }
@@ -58,8 +133,23 @@ public:
         return m_maj - maj;
     }
 
+    /* True if this version has all of the given features */
+    bool has(unsigned features) const { return (m_features & features) == features; }
+
+    /* How far COMPARE_OP's operand is shifted above the comparison */
+    int compareShift() const
+    {
+        return has(FEAT_COMPARE_SHIFT_5) ? 5 : has(FEAT_COMPARE_SHIFT_4) ? 4 : 0;
+    }
+
     bool isUnicode() const { return m_unicode; }
 
+    /* This version's byte -> Pyc::Opcode table, set along with the version */
+    const int* opcodeMap() const { return m_opcodeMap; }
+
+    /* And its byte -> inline CACHE entry count table */
+    const unsigned char* cacheMap() const { return m_cacheMap; }
+
     bool strIsUnicode() const
     {
         return (m_maj >= 3) || (m_code->flags() & PycCode::CO_FUTURE_UNICODE_LITERALS) != 0;
@@ -72,24 +162,95 @@ public:
 
     PycRef<PycCode> code() const { return m_code; }
 
-    void intern(PycRef<PycString> str) { m_interns.emplace_back(std::move(str)); }
-    PycRef<PycString> getIntern(int ref) const;
+    /* Lazy mode: nested code objects are only scanned during the load, and
+     * built when first accessed through their parent's constants. */
+    void setLazyCode(bool lazy) { m_lazyCode = lazy; }
+    bool lazyCode() const { return m_lazyCode; }
 
-    void refObject(PycRef<PycObject> obj) { m_refs.emplace_back(std::move(obj)); }
-    PycRef<PycObject> getRef(int ref) const;
+    /* Arena mode: loaded objects are allocated from a per-module arena and
+     * released in bulk with the module, so no reference to them may outlive
+     * it.  Must be set before loading. */
+    void setUseArena(bool use) { m_arena.reset(use ? new PycArena : nullptr); }
+    PycArena* arena() const { return m_arena.get(); }
+
+    /* Loading throws once objects nest more than maxDepth containers deep
+     * (by default as deep as CPython's marshal allows), or once more than
+     * maxObjects objects have been built (no limit by default). */
+    void setLoadLimits(size_t maxDepth, size_t maxObjects)
+    {
+        m_maxLoadDepth = maxDepth;
+        m_maxLoadObjects = maxObjects;
+    }
+    size_t maxLoadDepth() const { return m_maxLoadDepth; }
+    size_t maxLoadObjects() const { return m_maxLoadObjects; }
+    size_t objectCount() const { return m_objectCount; }
+
+    void countObject()
+    {
+        if (++m_objectCount > m_maxLoadObjects)
+            throw std::runtime_error("Too many objects in marshalled data");
+    }
+
+    /* Reference tables.  Slots are keyed by the byte offset of the object
+     * that created them, so objects skipped by the lazy loader can be
+     * loaded later and bound to the slot they were originally given. */
+    void intern(PycRef<PycString> str, size_t offset);
+    void skipIntern(size_t offset);
+    PycRef<PycString> getIntern(size_t ref);
+
+    void refObject(PycRef<PycObject> obj, size_t offset);
+    void skipRef(size_t offset);
+    PycRef<PycObject> getRef(size_t ref);
+    PycRef<PycObject> findRef(size_t offset) const;
+
+    /* Offset index of the code objects skipped so far (offset -> size) */
+    struct CodeExtent {
+        size_t offset, size;
+    };
+    const std::vector<CodeExtent>& codeExtents() const { return m_codeExtents; }
+    size_t codeExtent(size_t offset) const;
+    void addCodeExtent(size_t offset, size_t size);
+
+    /* Loads the object stored at the given offset of the input */
+    PycRef<PycObject> loadAt(size_t offset);
 
     static bool isSupportedVersion(int major, int minor);
 
 private:
-    void setVersion(unsigned int magic);
+    bool readHeader(PycReader& in);
+    void versionChanged();
+
+    struct RefSlot {
+        PycRef<PycObject> obj;
+        size_t offset;
+    };
+
+    static void bindSlot(std::vector<RefSlot>& slots, PycRef<PycObject> obj,
+                         size_t offset);
+    static const RefSlot& getSlot(const std::vector<RefSlot>& slots, size_t ref,
+                                  const char* what);
 
 private:
+    // Owns the input bytes that loaded strings point into
+    std::unique_ptr<PycBuffer> m_source;
+
+    // Declared before the object references below so it is destroyed last
+    std::unique_ptr<PycArena> m_arena;
+
     int m_maj, m_min;
+    unsigned m_features;
     bool m_unicode;
+    bool m_lazyCode;
+    size_t m_maxLoadDepth, m_maxLoadObjects;
+    size_t m_objectCount;
 
+    Header m_header;
+    const int* m_opcodeMap;
+    const unsigned char* m_cacheMap;
     PycRef<PycCode> m_code;
-    std::vector<PycRef<PycString>> m_interns;
-    std::vector<PycRef<PycObject>> m_refs;
+    std::vector<RefSlot> m_interns;
+    std::vector<RefSlot> m_refs;
+    std::vector<CodeExtent> m_codeExtents;
 };
 
 #endif
@@ -8,30 +8,30 @@
 #endif
 
 /* PycInt */
-void PycInt::load(PycData* stream, PycModule*)
+void PycInt::load(PycReader& stream, PycModule*)
 {
-    m_value = stream->get32();
+    m_value = (int)stream.u32();
 }
 
 
 /* PycLong */
-void PycLong::load(PycData* stream, PycModule*)
+void PycLong::load(PycReader& stream, PycModule*)
 {
     if (type() == TYPE_INT64) {
         m_value.reserve(4);
-        int lo = stream->get32();
-        int hi = stream->get32();
+        int lo = (int)stream.u32();
+        int hi = (int)stream.u32();
         m_value.push_back((lo      ) & 0xFFFF);
         m_value.push_back((lo >> 16) & 0xFFFF);
         m_value.push_back((hi      ) & 0xFFFF);
         m_value.push_back((hi >> 16) & 0xFFFF);
         m_size = (hi & 0x80000000) != 0 ? -4 : 4;
     } else {
-        m_size = stream->get32();
+        m_size = (int)stream.u32();
         int actualSize = m_size >= 0 ? m_size : -m_size;
         m_value.reserve(actualSize);
         for (int i=0; i<actualSize; i++)
-            m_value.push_back(stream->get16());
+            m_value.push_back(stream.u16());
     }
 }
 
@@ -59,7 +59,7 @@ std::string PycLong::repr(PycModule* mod) const
     // arbitrary-length integers to a power of two than an arbitrary base
 
     if (m_size == 0)
-        return (mod->verCompare(3, 0) >= 0) ? "0x0" : "0x0L";
+        return mod->has(PycModule::FEAT_UNIFIED_INTS) ? "0x0" : "0x0L";
 
     // Realign to 32 bits, since Python uses only 15
     std::vector<unsigned> bits;
@@ -90,7 +90,7 @@ std::string PycLong::repr(PycModule* mod) const
     aptr += snprintf(aptr, 9, "%X", *iter++);
     while (iter != bits.rend())
         aptr += snprintf(aptr, 9, "%08X", *iter++);
-    if (mod->verCompare(3, 0) < 0)
+    if (!mod->has(PycModule::FEAT_UNIFIED_INTS))
         *aptr++ = 'L';
     *aptr = 0;
     return accum;
@@ -98,15 +98,10 @@ std::string PycLong::repr(PycModule* mod) const
 
 
 /* PycFloat */
-void PycFloat::load(PycData* stream, PycModule*)
+void PycFloat::load(PycReader& stream, PycModule*)
 {
-    int len = stream->getByte();
-    if (len < 0)
-        throw std::bad_alloc();
-
-    m_value.resize(len);
-    if (len > 0)
-        stream->getBuffer(len, &m_value.front());
+    size_t len = stream.u8();
+    m_value.assign((const char*)stream.read(len), len);
 }
 
 bool PycFloat::isEqual(PycRef<PycObject> obj) const
@@ -120,17 +115,12 @@ bool PycFloat::isEqual(PycRef<PycObject> obj) const
 
 
 /* PycComplex */
-void PycComplex::load(PycData* stream, PycModule* mod)
+void PycComplex::load(PycReader& stream, PycModule* mod)
 {
     PycFloat::load(stream, mod);
 
-    int len = stream->getByte();
-    if (len < 0)
-        throw std::bad_alloc();
-
-    m_imag.resize(len);
-    if (len > 0)
-        stream->getBuffer(len, &m_imag.front());
+    size_t len = stream.u8();
+    m_imag.assign((const char*)stream.read(len), len);
 }
 
 bool PycComplex::isEqual(PycRef<PycObject> obj) const
@@ -144,17 +134,17 @@ bool PycComplex::isEqual(PycRef<PycObject> obj) const
 
 
 /* PycCFloat */
-void PycCFloat::load(PycData* stream, PycModule*)
+void PycCFloat::load(PycReader& stream, PycModule*)
 {
-    Pyc_INT64 bits = stream->get64();
+    Pyc_INT64 bits = (Pyc_INT64)stream.u64();
     memcpy(&m_value, &bits, sizeof(bits));
 }
 
 
 /* PycCComplex */
-void PycCComplex::load(PycData* stream, PycModule* mod)
+void PycCComplex::load(PycReader& stream, PycModule* mod)
 {
     PycCFloat::load(stream, mod);
-    Pyc_INT64 bits = stream->get64();
+    Pyc_INT64 bits = (Pyc_INT64)stream.u64();
     memcpy(&m_imag, &bits, sizeof(bits));
 }
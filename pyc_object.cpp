@@ -3,15 +3,36 @@
 #include "pyc_numeric.h"
 #include "pyc_code.h"
 #include "data.h"
+#include "pyc_arena.h"
 #include <cstdio>
+#include <stdexcept>
+#include <vector>
 
-PycRef<PycObject> Pyc_None = new PycObject(PycObject::TYPE_NONE);
-PycRef<PycObject> Pyc_Ellipsis = new PycObject(PycObject::TYPE_ELLIPSIS);
-PycRef<PycObject> Pyc_StopIteration = new PycObject(PycObject::TYPE_STOPITER);
-PycRef<PycObject> Pyc_False = new PycObject(PycObject::TYPE_FALSE);
-PycRef<PycObject> Pyc_True = new PycObject(PycObject::TYPE_TRUE);
+static PycObject* makeSingleton(int type)
+{
+    PycObject* obj = new PycObject(type);
+    obj->setImmortal();
+    return obj;
+}
+
+PycRef<PycObject> Pyc_None = makeSingleton(PycObject::TYPE_NONE);
+PycRef<PycObject> Pyc_Ellipsis = makeSingleton(PycObject::TYPE_ELLIPSIS);
+PycRef<PycObject> Pyc_StopIteration = makeSingleton(PycObject::TYPE_STOPITER);
+PycRef<PycObject> Pyc_False = makeSingleton(PycObject::TYPE_FALSE);
+PycRef<PycObject> Pyc_True = makeSingleton(PycObject::TYPE_TRUE);
+
+template <class T>
+static PycRef<PycObject> makeObject(PycArena* arena, int type)
+{
+    if (!arena)
+        return new T(type);
 
-PycRef<PycObject> CreateObject(int type)
+    T* obj = arena->create<T>(type);
+    obj->setImmortal();
+    return obj;
+}
+
+PycRef<PycObject> CreateObject(int type, PycArena* arena)
 {
     switch (type) {
     case PycObject::TYPE_NULL:
@@ -27,19 +48,19 @@ PycRef<PycObject> CreateObject(int type)
     case PycObject::TYPE_ELLIPSIS:
         return Pyc_Ellipsis;
     case PycObject::TYPE_INT:
-        return new PycInt(type);
+        return makeObject<PycInt>(arena, type);
     case PycObject::TYPE_INT64:
-        return new PycLong(type);
+        return makeObject<PycLong>(arena, type);
     case PycObject::TYPE_FLOAT:
-        return new PycFloat(type);
+        return makeObject<PycFloat>(arena, type);
     case PycObject::TYPE_BINARY_FLOAT:
-        return new PycCFloat(type);
+        return makeObject<PycCFloat>(arena, type);
     case PycObject::TYPE_COMPLEX:
-        return new PycComplex(type);
+        return makeObject<PycComplex>(arena, type);
     case PycObject::TYPE_BINARY_COMPLEX:
-        return new PycCComplex(type);
+        return makeObject<PycCComplex>(arena, type);
     case PycObject::TYPE_LONG:
-        return new PycLong(type);
+        return makeObject<PycLong>(arena, type);
     case PycObject::TYPE_STRING:
     case PycObject::TYPE_INTERNED:
     case PycObject::TYPE_STRINGREF:
@@ -48,42 +69,250 @@ PycRef<PycObject> CreateObject(int type)
     case PycObject::TYPE_ASCII_INTERNED:
     case PycObject::TYPE_SHORT_ASCII:
     case PycObject::TYPE_SHORT_ASCII_INTERNED:
-        return new PycString(type);
+        return makeObject<PycString>(arena, type);
     case PycObject::TYPE_TUPLE:
     case PycObject::TYPE_SMALL_TUPLE:
-        return new PycTuple(type);
+        return makeObject<PycTuple>(arena, type);
     case PycObject::TYPE_LIST:
-        return new PycList(type);
+        return makeObject<PycList>(arena, type);
     case PycObject::TYPE_DICT:
-        return new PycDict(type);
+        return makeObject<PycDict>(arena, type);
     case PycObject::TYPE_CODE:
     case PycObject::TYPE_CODE2:
-        return new PycCode(type);
+        return makeObject<PycCode>(arena, type);
     case PycObject::TYPE_SET:
     case PycObject::TYPE_FROZENSET:
-        return new PycSet(type);
+        return makeObject<PycSet>(arena, type);
     default:
         fprintf(stderr, "CreateObject: Got unsupported type 0x%X\n", type);
         return NULL;
     }
 }
 
-PycRef<PycObject> LoadObject(PycData* stream, PycModule* mod)
+static bool isSequenceType(int type)
+{
+    return type == PycObject::TYPE_TUPLE || type == PycObject::TYPE_SMALL_TUPLE
+        || type == PycObject::TYPE_LIST || type == PycObject::TYPE_SET
+        || type == PycObject::TYPE_FROZENSET;
+}
+
+static bool isContainerType(int type)
+{
+    return isSequenceType(type) || type == PycObject::TYPE_DICT
+        || type == PycObject::TYPE_CODE || type == PycObject::TYPE_CODE2;
+}
+
+/* Reads one object.  created is set if it was newly built as a container,
+ * whose children the caller still has to load. */
+static PycRef<PycObject> loadOne(PycReader& stream, PycModule* mod, bool deferCode,
+                                 bool& created)
 {
-    int type = stream->getByte();
+    size_t offset = stream.pos();
+    int type = stream.u8();
     PycRef<PycObject> obj;
 
+    created = false;
     if (type == PycObject::TYPE_OBREF) {
-        int index = stream->get32();
-        obj = mod->getRef(index);
+        obj = mod->getRef(stream.u32());
+    } else if ((type & 0x80) && (obj = mod->findRef(offset)) != NULL) {
+        // Already loaded through a back-reference into a skipped region
+        stream.seek(offset);
+        SkipObject(stream, mod);
+    } else if (deferCode && mod->lazyCode()
+            && ((type & 0x7F) == PycObject::TYPE_CODE
+                || (type & 0x7F) == PycObject::TYPE_CODE2)) {
+        stream.seek(offset);
+        SkipObject(stream, mod);
+        obj = new PycLazyCode(mod, offset);
     } else {
-        obj = CreateObject(type & 0x7F);
+        obj = CreateObject(type & 0x7F, mod->arena());
         if (obj != NULL) {
+            mod->countObject();
             if (type & 0x80)
-                mod->refObject(obj);
+                mod->refObject(obj, offset);
             obj->load(stream, mod);
+            created = isContainerType(type & 0x7F);
         }
     }
 
     return obj;
 }
+
+PycRef<PycObject> LoadObject(PycReader& stream, PycModule* mod, bool deferCode)
+{
+    // Containers whose children are still being loaded, innermost last
+    struct Frame {
+        PycRef<PycObject> obj;
+        size_t cursor;
+    };
+    std::vector<Frame> stack;
+
+    for (;;) {
+        bool created;
+        PycRef<PycObject> obj = loadOne(stream, mod, deferCode, created);
+
+        size_t cursor = 0;
+        if (created && obj->nextChild(stream, mod, cursor)) {
+            if (stack.size() >= mod->maxLoadDepth())
+                throw std::runtime_error("Marshalled objects are nested too deeply");
+            stack.push_back({ std::move(obj), cursor });
+        } else {
+            // obj is complete: hand it to its parent, and close every
+            // container that has no children left
+            for (;;) {
+                if (stack.empty())
+                    return obj;
+                Frame& top = stack.back();
+                top.obj->setChild(top.cursor++, std::move(obj));
+                if (top.obj->nextChild(stream, mod, top.cursor))
+                    break;
+                obj = std::move(top.obj);
+                stack.pop_back();
+            }
+        }
+
+        // Code objects directly inside a sequence (i.e. co_consts) may be deferred
+        deferCode = isSequenceType(stack.back().obj.type());
+    }
+}
+
+void SkipObject(PycReader& stream, PycModule* mod)
+{
+    /* Containers still being skipped, innermost last.  The cursor counts the
+     * children left in a sequence, tracks key/value in a dict and walks the
+     * layout table of a code object. */
+    struct Frame {
+        int type;
+        size_t cursor;
+        size_t offset;
+    };
+    std::vector<Frame> stack;
+
+    for (;;) {
+        size_t offset = stream.pos();
+        int type = stream.u8();
+        if (type == PycObject::TYPE_OBREF) {
+            stream.read(4);
+            type = PycObject::TYPE_NULL;
+        } else if (type & 0x80) {
+            mod->skipRef(offset);
+        }
+
+        switch (type & 0x7F) {
+        case PycObject::TYPE_NULL:
+        case PycObject::TYPE_NONE:
+        case PycObject::TYPE_FALSE:
+        case PycObject::TYPE_TRUE:
+        case PycObject::TYPE_STOPITER:
+        case PycObject::TYPE_ELLIPSIS:
+            break;
+        case PycObject::TYPE_INT:
+        case PycObject::TYPE_STRINGREF:
+            stream.read(4);
+            break;
+        case PycObject::TYPE_INT64:
+        case PycObject::TYPE_BINARY_FLOAT:
+            stream.read(8);
+            break;
+        case PycObject::TYPE_BINARY_COMPLEX:
+            stream.read(16);
+            break;
+        case PycObject::TYPE_FLOAT:
+            stream.read(stream.u8());
+            break;
+        case PycObject::TYPE_COMPLEX:
+            stream.read(stream.u8());
+            stream.read(stream.u8());
+            break;
+        case PycObject::TYPE_LONG:
+            {
+                int size = (int)stream.u32();
+                stream.read(2 * (size_t)(size >= 0 ? size : -size));
+            }
+            break;
+        case PycObject::TYPE_INTERNED:
+        case PycObject::TYPE_ASCII_INTERNED:
+            mod->skipIntern(offset);
+            /* Fall through */
+        case PycObject::TYPE_STRING:
+        case PycObject::TYPE_UNICODE:
+        case PycObject::TYPE_ASCII:
+            stream.read(stream.u32());
+            break;
+        case PycObject::TYPE_SHORT_ASCII_INTERNED:
+            mod->skipIntern(offset);
+            /* Fall through */
+        case PycObject::TYPE_SHORT_ASCII:
+            stream.read(stream.u8());
+            break;
+        case PycObject::TYPE_TUPLE:
+        case PycObject::TYPE_LIST:
+        case PycObject::TYPE_SET:
+        case PycObject::TYPE_FROZENSET:
+        case PycObject::TYPE_SMALL_TUPLE:
+            {
+                size_t count = ((type & 0x7F) == PycObject::TYPE_SMALL_TUPLE)
+                             ? stream.u8() : stream.count32();
+                stack.push_back({ PycObject::TYPE_TUPLE, count, offset });
+            }
+            break;
+        case PycObject::TYPE_DICT:
+            stack.push_back({ PycObject::TYPE_DICT, 0, offset });
+            break;
+        case PycObject::TYPE_CODE:
+        case PycObject::TYPE_CODE2:
+            {
+                size_t size = mod->codeExtent(offset);
+                if (size != 0)
+                    stream.seek(offset + size);
+                else
+                    stack.push_back({ PycObject::TYPE_CODE, 0, offset });
+            }
+            break;
+        default:
+            throw std::runtime_error("SkipObject: Got unsupported type");
+        }
+
+        if (stack.size() > mod->maxLoadDepth())
+            throw std::runtime_error("Marshalled objects are nested too deeply");
+
+        // Find the next child to skip, closing every finished container
+        for (;;) {
+            if (stack.empty())
+                return;
+
+            Frame& top = stack.back();
+            bool more = false;
+            if (top.type == PycObject::TYPE_TUPLE) {
+                if (top.cursor != 0) {
+                    --top.cursor;
+                    more = true;
+                }
+            } else if (top.type == PycObject::TYPE_DICT) {
+                // Keys and values alternate until a NULL key
+                if (top.cursor != 0) {
+                    top.cursor = 0;
+                    more = true;
+                } else if ((stream.u8() & 0x7F) != PycObject::TYPE_NULL) {
+                    stream.seek(stream.pos() - 1);
+                    top.cursor = 1;
+                    more = true;
+                }
+            } else if (PycCode::skipFields(stream, mod, top.cursor)) {
+                ++top.cursor;
+                more = true;
+            } else {
+                mod->addCodeExtent(top.offset, stream.pos() - top.offset);
+            }
+
+            if (more)
+                break;
+            stack.pop_back();
+        }
+    }
+}
+
+PycRef<PycObject> PycLazyCode::load() const
+{
+    return m_mod->loadAt(m_offset);
+}
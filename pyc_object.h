@@ -1,7 +1,11 @@
 #ifndef _PYC_OBJECT_H
 #define _PYC_OBJECT_H
 
+#include <cstddef>
 #include <typeinfo>
+#ifdef PYC_ATOMIC_REFS
+#include <atomic>
+#endif
 
 template <class _Obj>
 class PycRef {
@@ -53,8 +57,12 @@ public:
 
     PycRef<_Obj>& operator=(PycRef<_Obj>&& obj) noexcept
     {
-        m_obj = obj.m_obj;
-        obj.m_obj = nullptr;
+        if (this != &obj) {
+            if (m_obj)
+                m_obj->delRef();
+            m_obj = obj.m_obj;
+            obj.m_obj = nullptr;
+        }
         return *this;
     }
 
@@ -88,7 +96,48 @@ private:
 };
 
 
-class PycData;
+/* The reference count of a PycObject or ASTNode.  It is a plain int unless
+ * PYC_ATOMIC_REFS is defined (ENABLE_ATOMIC_REFS in CMake), which makes it
+ * safe for threads to share objects at the cost of an atomic operation per
+ * reference.  Immortal objects are never counted, so they can be shared
+ * either way.  A copied object starts over with no references. */
+class PycRefCount {
+public:
+    PycRefCount() noexcept : m_count(0) { }
+    PycRefCount(const PycRefCount&) noexcept : m_count(0) { }
+    PycRefCount& operator=(const PycRefCount&) noexcept { return *this; }
+
+#ifdef PYC_ATOMIC_REFS
+    bool immortal() const { return m_count.load(std::memory_order_relaxed) == IMMORTAL; }
+    void setImmortal() { m_count.store(IMMORTAL, std::memory_order_relaxed); }
+    void increment() { m_count.fetch_add(1, std::memory_order_relaxed); }
+
+    // The last one out has to see everything the others did to the object
+    bool decrement() { return m_count.fetch_sub(1, std::memory_order_acq_rel) == 1; }
+#else
+    bool immortal() const { return m_count == IMMORTAL; }
+    void setImmortal() { m_count = IMMORTAL; }
+    void increment() { ++m_count; }
+    bool decrement() { return --m_count == 0; }
+#endif
+
+    /* For PycRef: both are no-ops for an immortal object, and release()
+     * returns true when the last reference is gone */
+    void retain() { if (!immortal()) increment(); }
+    bool release() { return !immortal() && decrement(); }
+
+private:
+    enum { IMMORTAL = -1 };
+
+#ifdef PYC_ATOMIC_REFS
+    std::atomic<int> m_count;
+#else
+    int m_count;
+#endif
+};
+
+
+class PycReader;
 class PycModule;
 
 /* Please only hold PycObjects inside PycRefs! */
@@ -127,9 +176,12 @@ public:
         TYPE_SMALL_TUPLE = ')',             // Python 3.4 ->
         TYPE_SHORT_ASCII = 'z',             // Python 3.4 ->
         TYPE_SHORT_ASCII_INTERNED = 'Z',    // Python 3.4 ->
+
+        // Not a marshal type: a nested code object the lazy loader skipped
+        TYPE_LAZY_CODE = 0x100,
     };
 
-    PycObject(int type = TYPE_UNKNOWN) : m_refs(0), m_type(type) { }
+    PycObject(int type = TYPE_UNKNOWN) : m_refs(), m_type(type) { }
     virtual ~PycObject() { }
 
     int type() const { return m_type; }
@@ -139,17 +191,29 @@ public:
         return obj.isIdent(this);
     }
 
-    virtual void load(PycData*, PycModule*) { }
+    virtual void load(PycReader&, PycModule*) { }
+
+    /* Containers don't load their children in load(); LoadObject does that
+     * with an explicit stack.  nextChild() reads any plain fields up to the
+     * next child object and returns true with the cursor identifying it, or
+     * false once the container is complete.  The child is then handed to
+     * setChild() and the loader advances the cursor by one. */
+    virtual bool nextChild(PycReader&, PycModule*, size_t&) { return false; }
+    virtual void setChild(size_t, PycRef<PycObject>) { }
 
 private:
-    int m_refs;
+    PycRefCount m_refs;
 
 protected:
     int m_type;
 
 public:
-    void addRef() { ++m_refs; }
-    void delRef() { if (--m_refs == 0) delete this; }
+    /* Immortal objects (e.g. those owned by a PycArena, and the singletons
+     * below) ignore refcounting */
+    void setImmortal() { m_refs.setImmortal(); }
+
+    void addRef() { m_refs.retain(); }
+    void delRef() { if (m_refs.release()) delete this; }
 };
 
 template <class _Obj>
@@ -158,10 +222,38 @@ int PycRef<_Obj>::type() const
     return m_obj ? m_obj->type() : PycObject::TYPE_NULL;
 }
 
-PycRef<PycObject> CreateObject(int type);
-PycRef<PycObject> LoadObject(PycData* stream, PycModule* mod);
+/* Placeholder left in a sequence for a code object that hasn't been loaded
+ * yet.  Sequences replace it with the real PycCode on first access. */
+class PycLazyCode : public PycObject {
+public:
+    PycLazyCode(PycModule* mod, size_t offset)
+        : PycObject(TYPE_LAZY_CODE), m_mod(mod), m_offset(offset) { }
+
+    size_t offset() const { return m_offset; }
+    PycRef<PycObject> load() const;
+
+private:
+    PycModule* m_mod;
+    size_t m_offset;
+};
+
+class PycArena;
+
+/* Objects are allocated from the arena when one is given */
+PycRef<PycObject> CreateObject(int type, PycArena* arena = nullptr);
+
+/* With deferCode set and lazy loading enabled on the module, code objects
+ * are skipped and returned as PycLazyCode placeholders. */
+PycRef<PycObject> LoadObject(PycReader& stream, PycModule* mod, bool deferCode = false);
+
+/* Walks over one marshalled object without building it, still recording
+ * its reference/intern slots so later back-references resolve.  Like
+ * LoadObject, it keeps an explicit stack and throws once nesting exceeds
+ * the module's load depth limit. */
+void SkipObject(PycReader& stream, PycModule* mod);
 
-/* Static Singleton objects */
+/* Static Singleton objects.  They are immortal, so any number of threads
+ * can hand them out without touching a reference count. */
 extern PycRef<PycObject> Pyc_None;
 extern PycRef<PycObject> Pyc_Ellipsis;
 extern PycRef<PycObject> Pyc_StopIteration;
@@ -4,12 +4,33 @@
 #include <stdexcept>
 
 /* PycSimpleSequence */
-void PycSimpleSequence::load(PycData* stream, PycModule* mod)
+void PycSimpleSequence::load(PycReader& stream, PycModule*)
 {
-    m_size = stream->get32();
-    m_values.reserve(m_size);
-    for (int i=0; i<m_size; i++)
-        m_values.push_back(LoadObject(stream, mod));
+    m_size = stream.count32();
+    m_values.resize(m_size);
+}
+
+void PycSimpleSequence::setChild(size_t cursor, PycRef<PycObject> child)
+{
+    if (child.type() == TYPE_LAZY_CODE)
+        m_hasLazy = true;
+    m_values[cursor] = std::move(child);
+}
+
+PycRef<PycObject> PycSimpleSequence::resolveLazy(size_t idx) const
+{
+    PycRef<PycObject>& obj = m_values.at(idx);
+    obj = obj.cast<PycLazyCode>()->load();
+    return obj;
+}
+
+void PycSimpleSequence::resolveLazy() const
+{
+    for (auto& obj : m_values) {
+        if (obj.type() == TYPE_LAZY_CODE)
+            obj = obj.cast<PycLazyCode>()->load();
+    }
+    m_hasLazy = false;
 }
 
 bool PycSimpleSequence::isEqual(PycRef<PycObject> obj) const
@@ -20,9 +41,11 @@ bool PycSimpleSequence::isEqual(PycRef<PycObject> obj) const
     PycRef<PycSimpleSequence> seqObj = obj.cast<PycSimpleSequence>();
     if (m_size != seqObj->m_size)
         return false;
-    auto it1 = m_values.cbegin();
-    auto it2 = seqObj->m_values.cbegin();
-    while (it1 != m_values.cend()) {
+    const value_t& lhs = values();
+    const value_t& rhs = seqObj->values();
+    auto it1 = lhs.cbegin();
+    auto it2 = rhs.cbegin();
+    while (it1 != lhs.cend()) {
         if (!(*it1)->isEqual(*it2))
             return false;
         ++it1, ++it2;
@@ -32,30 +55,35 @@ bool PycSimpleSequence::isEqual(PycRef<PycObject> obj) const
 
 
 /* PycTuple */
-void PycTuple::load(PycData* stream, PycModule* mod)
+void PycTuple::load(PycReader& stream, PycModule*)
 {
     if (type() == TYPE_SMALL_TUPLE)
-        m_size = stream->getByte();
+        m_size = stream.u8();
     else
-        m_size = stream->get32();
+        m_size = stream.count32();
 
     m_values.resize(m_size);
-    for (int i=0; i<m_size; i++)
-        m_values[i] = LoadObject(stream, mod);
 }
 
 
 /* PycDict */
-void PycDict::load(PycData* stream, PycModule* mod)
+bool PycDict::nextChild(PycReader& stream, PycModule*, size_t& cursor)
 {
-    PycRef<PycObject> key, val;
-    for (;;) {
-        key = LoadObject(stream, mod);
-        if (key == NULL)
-            break;
-        val = LoadObject(stream, mod);
-        m_values.emplace_back(std::make_tuple(key, val));
+    // Keys (even cursors) and values alternate until a NULL key
+    if ((cursor & 1) == 0) {
+        if ((stream.u8() & 0x7F) == TYPE_NULL)
+            return false;
+        stream.seek(stream.pos() - 1);
     }
+    return true;
+}
+
+void PycDict::setChild(size_t cursor, PycRef<PycObject> child)
+{
+    if ((cursor & 1) == 0)
+        m_values.emplace_back(std::make_tuple(std::move(child), PycRef<PycObject>()));
+    else
+        std::get<1>(m_values.back()) = std::move(child);
 }
 
 bool PycDict::isEqual(PycRef<PycObject> obj) const
@@ -9,28 +9,50 @@ class PycSequence : public PycObject {
 public:
     PycSequence(int type) : PycObject(type), m_size(0) { }
 
-    int size() const { return m_size; }
-    virtual PycRef<PycObject> get(int idx) const = 0;
+    size_t size() const { return m_size; }
+    virtual PycRef<PycObject> get(size_t idx) const = 0;
 
 protected:
-    int m_size;
+    size_t m_size;
 };
 
 class PycSimpleSequence : public PycSequence {
 public:
     typedef std::vector<PycRef<PycObject>> value_t;
 
-    PycSimpleSequence(int type) : PycSequence(type) { }
+    PycSimpleSequence(int type) : PycSequence(type), m_hasLazy(false) { }
 
     bool isEqual(PycRef<PycObject> obj) const override;
 
-    void load(class PycData* stream, class PycModule* mod) override;
-
-    const value_t& values() const { return m_values; }
-    PycRef<PycObject> get(int idx) const override { return m_values.at(idx); }
+    void load(class PycReader& stream, class PycModule* mod) override;
+    bool nextChild(class PycReader&, class PycModule*, size_t& cursor) override
+    {
+        return cursor < m_size;
+    }
+    void setChild(size_t cursor, PycRef<PycObject> child) override;
+
+    const value_t& values() const
+    {
+        if (m_hasLazy)
+            resolveLazy();
+        return m_values;
+    }
+
+    PycRef<PycObject> get(size_t idx) const override
+    {
+        const PycRef<PycObject>& obj = m_values.at(idx);
+        if (obj.type() == TYPE_LAZY_CODE)
+            return resolveLazy(idx);
+        return obj;
+    }
 
 protected:
-    value_t m_values;
+    PycRef<PycObject> resolveLazy(size_t idx) const;
+    void resolveLazy() const;
+
+    // Lazily loaded code objects are swapped in on first access
+    mutable value_t m_values;
+    mutable bool m_hasLazy;
 };
 
 class PycTuple : public PycSimpleSequence {
@@ -38,7 +60,7 @@ public:
     typedef PycSimpleSequence::value_t value_t;
     PycTuple(int type = TYPE_TUPLE) : PycSimpleSequence(type) { }
 
-    void load(class PycData* stream, class PycModule* mod) override;
+    void load(class PycReader& stream, class PycModule* mod) override;
 };
 
 class PycList : public PycSimpleSequence {
@@ -62,7 +84,9 @@ public:
 
     bool isEqual(PycRef<PycObject> obj) const override;
 
-    void load(class PycData* stream, class PycModule* mod) override;
+    bool nextChild(class PycReader& stream, class PycModule* mod,
+                   size_t& cursor) override;
+    void setChild(size_t cursor, PycRef<PycObject> child) override;
 
     const value_t& values() const { return m_values; }
 
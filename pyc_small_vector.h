@@ -0,0 +1,199 @@
+#ifndef _PYC_SMALL_VECTOR_H
+#define _PYC_SMALL_VECTOR_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+/* A vector that keeps its first N elements inside itself, so short ones
+ * never touch the heap.  The elements are contiguous, starting at an offset
+ * into the storage, which makes pop_front() as cheap as pop_back(); the
+ * space it leaves is taken back the next time the storage has to grow. */
+template <class T, size_t N>
+class PycSmallVector {
+public:
+    typedef T value_type;
+    typedef size_t size_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
+    PycSmallVector() : m_data(inlineData()), m_first(), m_last(), m_capacity(N) { }
+
+    PycSmallVector(const PycSmallVector& copy) : PycSmallVector()
+    {
+        reserve(copy.size());
+        for (const T& value : copy)
+            new (m_data + m_last++) T(value);
+    }
+
+    PycSmallVector(PycSmallVector&& move) noexcept : PycSmallVector() { steal(move); }
+
+    ~PycSmallVector()
+    {
+        clear();
+        freeData();
+    }
+
+    PycSmallVector& operator=(const PycSmallVector& copy)
+    {
+        if (this != &copy) {
+            clear();
+            reserve(copy.size());
+            for (const T& value : copy)
+                new (m_data + m_last++) T(value);
+        }
+        return *this;
+    }
+
+    PycSmallVector& operator=(PycSmallVector&& move) noexcept
+    {
+        if (this != &move) {
+            clear();
+            freeData();
+            m_data = inlineData();
+            m_capacity = N;
+            steal(move);
+        }
+        return *this;
+    }
+
+    iterator begin() { return m_data + m_first; }
+    iterator end() { return m_data + m_last; }
+    const_iterator begin() const { return m_data + m_first; }
+    const_iterator end() const { return m_data + m_last; }
+    const_iterator cbegin() const { return begin(); }
+    const_iterator cend() const { return end(); }
+    reverse_iterator rbegin() { return reverse_iterator(end()); }
+    reverse_iterator rend() { return reverse_iterator(begin()); }
+    const_reverse_iterator rbegin() const { return const_reverse_iterator(end()); }
+    const_reverse_iterator rend() const { return const_reverse_iterator(begin()); }
+    const_reverse_iterator crbegin() const { return rbegin(); }
+    const_reverse_iterator crend() const { return rend(); }
+
+    size_type size() const { return m_last - m_first; }
+    bool empty() const { return m_first == m_last; }
+
+    T& front() { return m_data[m_first]; }
+    T& back() { return m_data[m_last - 1]; }
+    const T& front() const { return m_data[m_first]; }
+    const T& back() const { return m_data[m_last - 1]; }
+    T& operator[](size_type idx) { return m_data[m_first + idx]; }
+    const T& operator[](size_type idx) const { return m_data[m_first + idx]; }
+
+    template <class... Args>
+    void emplace_back(Args&&... args)
+    {
+        if (m_last == m_capacity) {
+            // The arguments may refer to one of our own elements
+            T value(std::forward<Args>(args)...);
+            reserve(size() + 1);
+            new (m_data + m_last++) T(std::move(value));
+        } else {
+            new (m_data + m_last++) T(std::forward<Args>(args)...);
+        }
+    }
+
+    void push_back(const T& value) { emplace_back(value); }
+    void push_back(T&& value) { emplace_back(std::move(value)); }
+
+    /* Only cheap if something was popped off the front first */
+    void push_front(T value)
+    {
+        if (m_first > 0) {
+            new (m_data + --m_first) T(std::move(value));
+        } else {
+            emplace_back(std::move(value));
+            std::rotate(begin(), end() - 1, end());
+        }
+    }
+
+    void pop_front()
+    {
+        m_data[m_first++].~T();
+        if (m_first == m_last)
+            m_first = m_last = 0;
+    }
+
+    void pop_back()
+    {
+        m_data[--m_last].~T();
+        if (m_first == m_last)
+            m_first = m_last = 0;
+    }
+
+    void clear()
+    {
+        for (size_type i = m_first; i < m_last; ++i)
+            m_data[i].~T();
+        m_first = m_last = 0;
+    }
+
+    /* Makes room for at least count elements, all from the start of the
+     * storage */
+    void reserve(size_type count)
+    {
+        if (count <= m_capacity - m_first)
+            return;
+        if (count <= m_capacity) {
+            // Slide down over the space pop_front() left
+            moveTo(m_data);
+            return;
+        }
+        size_type capacity = std::max(count, m_capacity * 2);
+        T* data = static_cast<T*>(::operator new(capacity * sizeof(T)));
+        moveTo(data);
+        freeData();
+        m_data = data;
+        m_capacity = capacity;
+    }
+
+private:
+    T* inlineData() { return reinterpret_cast<T*>(m_inline); }
+    bool isInline() const { return m_data == reinterpret_cast<const T*>(m_inline); }
+
+    void freeData()
+    {
+        if (!isInline())
+            ::operator delete(m_data);
+    }
+
+    // Each slot written is either new space or one already moved from
+    void moveTo(T* data)
+    {
+        size_type count = size();
+        for (size_type i = 0; i < count; ++i) {
+            new (data + i) T(std::move(m_data[m_first + i]));
+            m_data[m_first + i].~T();
+        }
+        m_first = 0;
+        m_last = count;
+    }
+
+    void steal(PycSmallVector& other)
+    {
+        if (other.isInline()) {
+            for (T& value : other)
+                new (m_data + m_last++) T(std::move(value));
+            other.clear();
+        } else {
+            m_data = other.m_data;
+            m_first = other.m_first;
+            m_last = other.m_last;
+            m_capacity = other.m_capacity;
+            other.m_data = other.inlineData();
+            other.m_first = other.m_last = 0;
+            other.m_capacity = N;
+        }
+    }
+
+    T* m_data;
+    size_type m_first, m_last, m_capacity;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type m_inline[N];
+};
+
+#endif
@@ -0,0 +1,684 @@
+#include "pyc_stack.h"
+#include "bytecode.h"
+#include "pyc_code.h"
+#include "pyc_module.h"
+#include <algorithm>
+
+namespace {
+
+/* How each instruction of one Python version changes the stack depth, as
+ * CPython's stack_effect() has it.  The version questions are settled once
+ * per code object. */
+class StackModel {
+public:
+    explicit StackModel(PycModule* mod)
+        : m_mod(mod),
+          m_handlerPush(mod->has(PycModule::FEAT_UNIFIED_INTS) ? 6 : 3),
+          m_fromlists(mod->verCompare(2, 0) >= 0),
+          m_yieldExprs(mod->verCompare(2, 5) >= 0),
+          m_importLevels(m_yieldExprs),
+          m_sizedMaps(mod->verCompare(3, 5) >= 0),
+          m_packedCalls(!mod->has(PycModule::FEAT_WORDCODE)),
+          m_qualnames(mod->verCompare(3, 3) >= 0),
+          m_nullBits(mod->has(PycModule::FEAT_NULL_PUSH)),
+          m_methodBit(mod->has(PycModule::FEAT_SHIFTED_LOAD_ATTR)),
+          m_ver312(mod->verCompare(3, 12) >= 0),
+          m_ver313(mod->verCompare(3, 13) >= 0) { }
+
+    /* Sets the effect when the instruction falls through and when it
+     * jumps.  Returns false if the opcode isn't known. */
+    bool effect(int opcode, int operand, int& fall, int& jump) const;
+
+private:
+    // Positional and keyword argument counts packed in one operand
+    static int packedArgs(int operand)
+    {
+        return (operand & 0xFF) + 2 * ((operand >> 8) & 0xFF);
+    }
+
+    static int popcount4(int operand)
+    {
+        return (operand & 1) + ((operand >> 1) & 1) + ((operand >> 2) & 1)
+                + ((operand >> 3) & 1);
+    }
+
+    PycModule* m_mod;
+    int m_handlerPush;      // Values pushed when entering a handler before 3.11
+    bool m_fromlists;       // IMPORT_NAME pops a fromlist (2.0 ->)
+    bool m_yieldExprs;      // YIELD_VALUE is an expression (2.5 ->)
+    bool m_importLevels;    // IMPORT_NAME pops a relative import level (2.5 ->)
+    bool m_sizedMaps;       // BUILD_MAP pops its pairs (3.5 ->)
+    bool m_packedCalls;     // Call operands are packed positional/keyword counts
+    bool m_qualnames;       // MAKE_FUNCTION pops a qualified name (3.3 - 3.10)
+    bool m_nullBits;        // The NULL-pushing operand bit of 3.11 ->
+    bool m_methodBit;       // LOAD_ATTR's low bit pushes a NULL or self (3.12 ->)
+    bool m_ver312;
+    bool m_ver313;
+};
+
+bool StackModel::effect(int opcode, int operand, int& fall, int& jump) const
+{
+    jump = 0;
+    switch (opcode) {
+    case Pyc::STOP_CODE:
+    case Pyc::ROT_TWO:
+    case Pyc::ROT_THREE:
+    case Pyc::ROT_FOUR:
+    case Pyc::UNARY_POSITIVE:
+    case Pyc::UNARY_NEGATIVE:
+    case Pyc::UNARY_NOT:
+    case Pyc::UNARY_CONVERT:
+    case Pyc::UNARY_CALL:
+    case Pyc::UNARY_INVERT:
+    case Pyc::SLICE_0:
+    case Pyc::PRINT_NEWLINE:
+    case Pyc::BREAK_LOOP:
+    case Pyc::BUILD_FUNCTION:
+    case Pyc::POP_BLOCK:
+    case Pyc::NOP:
+    case Pyc::GET_ITER:
+    case Pyc::GET_AITER:
+    case Pyc::GET_YIELD_FROM_ITER:
+    case Pyc::GET_AWAITABLE:
+    case Pyc::GET_AWAITABLE_A:
+    case Pyc::LIST_TO_TUPLE:
+    case Pyc::CACHE:
+    case Pyc::CHECK_EXC_MATCH:
+    case Pyc::CHECK_EG_MATCH:
+    case Pyc::ASYNC_GEN_WRAP:
+    case Pyc::RESERVED:
+    case Pyc::FORMAT_SIMPLE:
+    case Pyc::MAKE_FUNCTION:
+    case Pyc::TO_BOOL:
+    case Pyc::SETUP_ANNOTATIONS:
+    case Pyc::COPY_DICT_WITHOUT_KEYS:
+    case Pyc::DELETE_NAME_A:
+    case Pyc::DELETE_GLOBAL_A:
+    case Pyc::DELETE_FAST_A:
+    case Pyc::DELETE_DEREF_A:
+    case Pyc::ROT_N_A:
+    case Pyc::JUMP_FORWARD_A:
+    case Pyc::JUMP_IF_FALSE_A:
+    case Pyc::JUMP_IF_TRUE_A:
+    case Pyc::JUMP_ABSOLUTE_A:
+    case Pyc::JUMP_BACKWARD_A:
+    case Pyc::JUMP_BACKWARD_NO_INTERRUPT_A:
+    case Pyc::CONTINUE_LOOP_A:
+    case Pyc::SET_FUNC_ARGS_A:
+    case Pyc::SETUP_LOOP_A:
+    case Pyc::RESERVE_FAST_A:
+    case Pyc::SET_LINENO_A:
+    case Pyc::GEN_START_A:  // Pops the value sent to start the generator
+    case Pyc::EXTENDED_ARG_A:
+    case Pyc::SWAP_A:
+    case Pyc::MAKE_CELL_A:
+    case Pyc::COPY_FREE_VARS_A:
+    case Pyc::RESUME_A:
+    case Pyc::KW_NAMES_A:
+    case Pyc::YIELD_VALUE_A:
+    case Pyc::CALL_INTRINSIC_1_A:
+    case Pyc::LOAD_FROM_DICT_OR_GLOBALS_A:
+    case Pyc::LOAD_FROM_DICT_OR_DEREF_A:
+    case Pyc::CONVERT_VALUE_A:
+    case Pyc::ENTER_EXECUTOR_A:
+    case Pyc::STORE_FAST_LOAD_FAST_A:
+    case Pyc::INSTRUMENTED_RESUME_A:
+    case Pyc::INSTRUMENTED_YIELD_VALUE_A:
+    case Pyc::INSTRUMENTED_JUMP_FORWARD_A:
+    case Pyc::INSTRUMENTED_JUMP_BACKWARD_A:
+    case Pyc::INSTRUMENTED_INSTRUCTION_A:
+    case Pyc::INSTRUMENTED_LINE_A:
+        fall = 0;
+        break;
+    case Pyc::DUP_TOP:
+    case Pyc::LOAD_LOCALS:
+    case Pyc::LOAD_GLOBALS:
+    case Pyc::GET_LEN:
+    case Pyc::MATCH_MAPPING:
+    case Pyc::MATCH_SEQUENCE:
+    case Pyc::GET_ANEXT:
+    case Pyc::BEFORE_ASYNC_WITH:
+    case Pyc::LOAD_BUILD_CLASS:
+    case Pyc::WITH_EXCEPT_START:
+    case Pyc::LOAD_ASSERTION_ERROR:
+    case Pyc::PUSH_NULL:
+    case Pyc::PUSH_EXC_INFO:
+    case Pyc::BEFORE_WITH:
+    case Pyc::RETURN_GENERATOR:     // Resuming pushes the value sent
+    case Pyc::LOAD_CONST_A:
+    case Pyc::LOAD_NAME_A:
+    case Pyc::LOAD_LOCAL_A:
+    case Pyc::LOAD_FAST_A:
+    case Pyc::LOAD_CLOSURE_A:
+    case Pyc::LOAD_DEREF_A:
+    case Pyc::LOAD_CLASSDEREF_A:
+    case Pyc::LOAD_METHOD_A:
+    case Pyc::COPY_A:
+    case Pyc::LOAD_FAST_CHECK_A:
+    case Pyc::LOAD_FAST_AND_CLEAR_A:
+        fall = 1;
+        break;
+    case Pyc::DUP_TOP_TWO:
+    case Pyc::LOAD_FAST_LOAD_FAST_A:
+        fall = 2;
+        break;
+    case Pyc::POP_TOP:
+    case Pyc::BINARY_POWER:
+    case Pyc::BINARY_MULTIPLY:
+    case Pyc::BINARY_DIVIDE:
+    case Pyc::BINARY_MODULO:
+    case Pyc::BINARY_ADD:
+    case Pyc::BINARY_SUBTRACT:
+    case Pyc::BINARY_SUBSCR:
+    case Pyc::BINARY_CALL:
+    case Pyc::BINARY_LSHIFT:
+    case Pyc::BINARY_RSHIFT:
+    case Pyc::BINARY_AND:
+    case Pyc::BINARY_XOR:
+    case Pyc::BINARY_OR:
+    case Pyc::BINARY_FLOOR_DIVIDE:
+    case Pyc::BINARY_TRUE_DIVIDE:
+    case Pyc::BINARY_MATRIX_MULTIPLY:
+    case Pyc::INPLACE_ADD:
+    case Pyc::INPLACE_SUBTRACT:
+    case Pyc::INPLACE_MULTIPLY:
+    case Pyc::INPLACE_DIVIDE:
+    case Pyc::INPLACE_MODULO:
+    case Pyc::INPLACE_POWER:
+    case Pyc::INPLACE_LSHIFT:
+    case Pyc::INPLACE_RSHIFT:
+    case Pyc::INPLACE_AND:
+    case Pyc::INPLACE_XOR:
+    case Pyc::INPLACE_OR:
+    case Pyc::INPLACE_FLOOR_DIVIDE:
+    case Pyc::INPLACE_TRUE_DIVIDE:
+    case Pyc::INPLACE_MATRIX_MULTIPLY:
+    case Pyc::SLICE_1:
+    case Pyc::SLICE_2:
+    case Pyc::DELETE_SLICE_0:
+    case Pyc::PRINT_EXPR:
+    case Pyc::PRINT_ITEM:
+    case Pyc::PRINT_NEWLINE_TO:
+    case Pyc::IMPORT_STAR:
+    case Pyc::STORE_LOCALS:
+    case Pyc::YIELD_FROM:
+    case Pyc::WITH_CLEANUP:
+    case Pyc::PREP_RERAISE_STAR:
+    case Pyc::END_SEND:
+    case Pyc::INSTRUMENTED_END_SEND_A:
+    case Pyc::CLEANUP_THROW:
+    case Pyc::EXIT_INIT_CHECK:
+    case Pyc::FORMAT_WITH_SPEC:
+    case Pyc::STORE_NAME_A:
+    case Pyc::DELETE_ATTR_A:
+    case Pyc::STORE_GLOBAL_A:
+    case Pyc::ACCESS_MODE_A:
+    case Pyc::COMPARE_OP_A:
+    case Pyc::STORE_FAST_A:
+    case Pyc::STORE_DEREF_A:
+    case Pyc::STORE_ANNOTATION_A:
+    case Pyc::SET_ADD_A:
+    case Pyc::LIST_APPEND_A:
+    case Pyc::IS_OP_A:
+    case Pyc::CONTAINS_OP_A:
+    case Pyc::LIST_EXTEND_A:
+    case Pyc::SET_UPDATE_A:
+    case Pyc::DICT_MERGE_A:
+    case Pyc::DICT_UPDATE_A:
+    case Pyc::BINARY_OP_A:
+    case Pyc::CALL_INTRINSIC_2_A:
+    case Pyc::SET_FUNCTION_ATTRIBUTE_A:
+        fall = -1;
+        break;
+    case Pyc::SLICE_3:
+    case Pyc::DELETE_SLICE_1:
+    case Pyc::DELETE_SLICE_2:
+    case Pyc::STORE_SLICE_0:
+    case Pyc::DELETE_SUBSCR:
+    case Pyc::PRINT_ITEM_TO:
+    case Pyc::LIST_APPEND:
+    case Pyc::SET_ADD:
+    case Pyc::BINARY_SLICE:
+    case Pyc::STORE_ATTR_A:
+    case Pyc::MAP_ADD_A:
+    case Pyc::STORE_FAST_STORE_FAST_A:
+        fall = -2;
+        break;
+    case Pyc::BUILD_CLASS:
+        fall = -2;
+        break;
+    case Pyc::STORE_SLICE_1:
+    case Pyc::STORE_SLICE_2:
+    case Pyc::DELETE_SLICE_3:
+    case Pyc::STORE_SUBSCR:
+    case Pyc::EXEC_STMT:
+        fall = -3;
+        break;
+    case Pyc::STORE_SLICE_3:
+    case Pyc::STORE_SLICE:
+        fall = -4;
+        break;
+    case Pyc::RETURN_VALUE:
+    case Pyc::INSTRUMENTED_RETURN_VALUE_A:
+    case Pyc::INTERPRETER_EXIT:
+        fall = -1;
+        break;
+    case Pyc::RETURN_CONST_A:
+    case Pyc::INSTRUMENTED_RETURN_CONST_A:
+        fall = 0;
+        break;
+    case Pyc::RAISE_EXCEPTION:
+        fall = -2;
+        break;
+    case Pyc::RAISE_VARARGS_A:
+        fall = -operand;
+        break;
+    case Pyc::RERAISE:
+    case Pyc::RERAISE_A:
+        fall = m_nullBits ? -1 : -3;
+        break;
+    case Pyc::YIELD_VALUE:
+        // A statement before 2.5
+        fall = m_yieldExprs ? 0 : -1;
+        break;
+    case Pyc::IMPORT_NAME_A:
+        // Pops the fromlist from 2.0, and the level from 2.5
+        if (!m_fromlists)
+            fall = 1;
+        else
+            fall = m_importLevels ? -1 : 0;
+        break;
+    case Pyc::IMPORT_FROM_A:
+        // Stores the name itself before 2.0
+        fall = m_fromlists ? 1 : 0;
+        break;
+    case Pyc::END_FINALLY:
+    case Pyc::POP_FINALLY_A:
+        // Counted as the handler's entry values, as CPython does
+        fall = -m_handlerPush;
+        break;
+    case Pyc::BEGIN_FINALLY:
+        // Only pushes one value, but counts as a handler entry
+        fall = 6;
+        break;
+    case Pyc::CALL_FINALLY_A:
+        fall = 0;
+        jump = 1;
+        break;
+    case Pyc::POP_EXCEPT:
+        fall = m_nullBits ? -1 : -3;
+        break;
+    case Pyc::SETUP_EXCEPT_A:
+    case Pyc::SETUP_FINALLY_A:
+        fall = 0;
+        jump = m_handlerPush;
+        break;
+    case Pyc::SETUP_WITH_A:
+        fall = 1;
+        jump = m_handlerPush;
+        break;
+    case Pyc::SETUP_ASYNC_WITH_A:
+        fall = 0;
+        jump = m_handlerPush - 1;
+        break;
+    case Pyc::WITH_CLEANUP_START:
+        fall = 2;
+        break;
+    case Pyc::WITH_CLEANUP_FINISH:
+        fall = -3;
+        break;
+    case Pyc::END_ASYNC_FOR:
+        fall = m_nullBits ? -2 : -7;
+        break;
+    case Pyc::END_FOR:
+    case Pyc::INSTRUMENTED_END_FOR_A:
+        fall = m_ver313 ? -1 : -2;
+        break;
+    case Pyc::MATCH_KEYS:
+        fall = m_nullBits ? 1 : 2;
+        break;
+    case Pyc::MATCH_CLASS_A:
+        fall = m_nullBits ? -2 : -1;
+        break;
+    case Pyc::UNPACK_TUPLE_A:
+    case Pyc::UNPACK_LIST_A:
+    case Pyc::UNPACK_ARG_A:
+    case Pyc::UNPACK_VARARG_A:
+    case Pyc::UNPACK_SEQUENCE_A:
+        fall = operand - 1;
+        break;
+    case Pyc::UNPACK_EX_A:
+        fall = (operand & 0xFF) + (operand >> 8);
+        break;
+    case Pyc::BUILD_TUPLE_A:
+    case Pyc::BUILD_LIST_A:
+    case Pyc::BUILD_SET_A:
+    case Pyc::BUILD_SLICE_A:
+    case Pyc::BUILD_STRING_A:
+    case Pyc::BUILD_LIST_UNPACK_A:
+    case Pyc::BUILD_TUPLE_UNPACK_A:
+    case Pyc::BUILD_SET_UNPACK_A:
+    case Pyc::BUILD_MAP_UNPACK_A:
+    case Pyc::BUILD_TUPLE_UNPACK_WITH_CALL_A:
+        fall = 1 - operand;
+        break;
+    case Pyc::BUILD_MAP_UNPACK_WITH_CALL_A:
+        fall = 1 - (m_packedCalls ? (operand & 0xFF) : operand);
+        break;
+    case Pyc::BUILD_MAP_A:
+        // The operand was only a size hint before 3.5
+        fall = m_sizedMaps ? 1 - 2 * operand : 1;
+        break;
+    case Pyc::STORE_MAP:
+        fall = -2;
+        break;
+    case Pyc::BUILD_CONST_KEY_MAP_A:
+        fall = -operand;
+        break;
+    case Pyc::DUP_TOPX_A:
+        fall = operand;
+        break;
+    case Pyc::LOAD_ATTR_A:
+        fall = m_methodBit ? (operand & 1) : 0;
+        break;
+    case Pyc::LOAD_GLOBAL_A:
+        fall = m_nullBits ? 1 + (operand & 1) : 1;
+        break;
+    case Pyc::LOAD_SUPER_ATTR_A:
+    case Pyc::INSTRUMENTED_LOAD_SUPER_ATTR_A:
+        fall = (operand & 1) ? -1 : -2;
+        break;
+    case Pyc::FORMAT_VALUE_A:
+        fall = (operand & 0x04) ? -1 : 0;
+        break;
+    case Pyc::MAKE_FUNCTION_A:
+        if (!m_mod->has(PycModule::FEAT_UNIFIED_INTS))
+            fall = -operand;
+        else if (m_packedCalls)
+            fall = -packedArgs(operand) - ((operand >> 16) & 0x7FFF) - (m_qualnames ? 1 : 0);
+        else
+            fall = -popcount4(operand) - (m_nullBits ? 0 : 1);
+        break;
+    case Pyc::MAKE_CLOSURE_A:
+        if (!m_mod->has(PycModule::FEAT_UNIFIED_INTS))
+            fall = -operand - 1;
+        else
+            fall = -packedArgs(operand) - ((operand >> 16) & 0x7FFF) - (m_qualnames ? 2 : 1);
+        break;
+    case Pyc::CALL_FUNCTION_A:
+        fall = m_packedCalls ? -packedArgs(operand) : -operand;
+        break;
+    case Pyc::CALL_FUNCTION_VAR_A:
+        fall = -packedArgs(operand) - 1;
+        break;
+    case Pyc::CALL_FUNCTION_KW_A:
+        fall = (m_packedCalls ? -packedArgs(operand) : -operand) - 1;
+        break;
+    case Pyc::CALL_FUNCTION_VAR_KW_A:
+        fall = -packedArgs(operand) - 2;
+        break;
+    case Pyc::CALL_FUNCTION_EX_A:
+    case Pyc::INSTRUMENTED_CALL_FUNCTION_EX_A:
+        fall = -(operand & 1) - (m_nullBits ? 2 : 1);
+        break;
+    case Pyc::CALL_METHOD_A:
+        fall = -operand - 1;
+        break;
+    case Pyc::PRECALL_A:
+        fall = -operand;
+        break;
+    case Pyc::CALL_A:
+    case Pyc::INSTRUMENTED_CALL_A:
+        // In 3.11 the PRECALL before it pops the arguments
+        fall = m_ver312 ? -operand - 1 : -1;
+        break;
+    case Pyc::CALL_KW_A:
+    case Pyc::INSTRUMENTED_CALL_KW_A:
+        fall = -operand - 2;
+        break;
+    case Pyc::FOR_LOOP_A:
+        fall = 1;
+        jump = -2;
+        break;
+    case Pyc::FOR_ITER_A:
+    case Pyc::INSTRUMENTED_FOR_ITER_A:
+        // From 3.12 the exhausted iterator is popped past END_FOR
+        fall = 1;
+        jump = m_ver312 ? 1 : -1;
+        break;
+    case Pyc::SEND_A:
+        fall = 0;
+        jump = m_ver312 ? 0 : -1;
+        break;
+    case Pyc::JUMP_IF_FALSE_OR_POP_A:
+    case Pyc::JUMP_IF_TRUE_OR_POP_A:
+        fall = -1;
+        jump = 0;
+        break;
+    case Pyc::POP_JUMP_IF_FALSE_A:
+    case Pyc::POP_JUMP_IF_TRUE_A:
+    case Pyc::POP_JUMP_FORWARD_IF_FALSE_A:
+    case Pyc::POP_JUMP_FORWARD_IF_TRUE_A:
+    case Pyc::POP_JUMP_FORWARD_IF_NOT_NONE_A:
+    case Pyc::POP_JUMP_FORWARD_IF_NONE_A:
+    case Pyc::POP_JUMP_BACKWARD_IF_NOT_NONE_A:
+    case Pyc::POP_JUMP_BACKWARD_IF_NONE_A:
+    case Pyc::POP_JUMP_BACKWARD_IF_FALSE_A:
+    case Pyc::POP_JUMP_BACKWARD_IF_TRUE_A:
+    case Pyc::POP_JUMP_IF_NOT_NONE_A:
+    case Pyc::POP_JUMP_IF_NONE_A:
+    case Pyc::INSTRUMENTED_POP_JUMP_IF_NONE_A:
+    case Pyc::INSTRUMENTED_POP_JUMP_IF_NOT_NONE_A:
+    case Pyc::INSTRUMENTED_POP_JUMP_IF_FALSE_A:
+    case Pyc::INSTRUMENTED_POP_JUMP_IF_TRUE_A:
+        fall = jump = -1;
+        return true;
+    case Pyc::JUMP_IF_NOT_EXC_MATCH_A:
+        fall = jump = -2;
+        return true;
+    default:
+        return false;
+    }
+    return true;
+}
+
+/* Whether an instruction can go on to the next one */
+bool fallsThrough(int opcode)
+{
+    switch (opcode) {
+    case Pyc::RETURN_VALUE:
+    case Pyc::RETURN_CONST_A:
+    case Pyc::INSTRUMENTED_RETURN_VALUE_A:
+    case Pyc::INSTRUMENTED_RETURN_CONST_A:
+    case Pyc::RAISE_EXCEPTION:
+    case Pyc::RAISE_VARARGS_A:
+    case Pyc::RERAISE:
+    case Pyc::RERAISE_A:
+    case Pyc::INTERPRETER_EXIT:
+    case Pyc::JUMP_FORWARD_A:
+    case Pyc::JUMP_ABSOLUTE_A:
+    case Pyc::JUMP_BACKWARD_A:
+    case Pyc::JUMP_BACKWARD_NO_INTERRUPT_A:
+    case Pyc::INSTRUMENTED_JUMP_FORWARD_A:
+    case Pyc::INSTRUMENTED_JUMP_BACKWARD_A:
+    // These unwind to the loop's own depth, which its other paths give
+    case Pyc::BREAK_LOOP:
+    case Pyc::CONTINUE_LOOP_A:
+        return false;
+    default:
+        return true;
+    }
+}
+
+/* Whether an instruction's target is only a handler, whose depth comes
+ * from the exception path rather than the code before it */
+bool isHandlerSetup(int opcode)
+{
+    switch (opcode) {
+    case Pyc::SETUP_EXCEPT_A:
+    case Pyc::SETUP_FINALLY_A:
+    case Pyc::SETUP_WITH_A:
+    case Pyc::SETUP_ASYNC_WITH_A:
+    case Pyc::CALL_FINALLY_A:
+        return true;
+    default:
+        return false;
+    }
+}
+
+// A depth that keeps rising at one instruction is going around a loop
+const int MAX_RAISES = 8;
+
+}
+
+void PycStackDepth::fail(Status status, int offset)
+{
+    if (m_status == STACK_OK) {
+        m_status = status;
+        m_errorOffset = offset;
+    }
+}
+
+const char* PycStackDepth::statusText() const
+{
+    switch (m_status) {
+    case STACK_OK:              return "OK";
+    case STACK_UNKNOWN_OPCODE:  return "unknown stack effect";
+    case STACK_UNDERFLOW:       return "stack underflow";
+    case STACK_INCONSISTENT:    return "inconsistent stack depths";
+    case STACK_UNBOUNDED:       return "unbounded stack growth";
+    }
+    return "";
+}
+
+void PycStackDepth::analyze(const PycInstructions& insns, const PycExceptionTable& exceptions,
+                            PycModule* mod)
+{
+    m_status = STACK_OK;
+    m_errorOffset = -1;
+    m_depths.assign(insns.size(), -1);
+    m_conflicts.clear();
+    const size_t count = insns.size();
+    if (count == 0)
+        return;
+
+    const int codeLen = insns.next(count - 1);
+    std::vector<int> indexOf(codeLen, -1);
+    for (size_t i = 0; i < count; ++i)
+        indexOf[insns.offset(i)] = (int)i;
+    auto indexAt = [&](int offset) {
+        return (offset >= 0 && offset < codeLen) ? indexOf[offset] : -1;
+    };
+
+    const bool strict = mod->verCompare(3, 9) >= 0;
+    std::vector<char> handler(count, 0);
+    if (!strict) {
+        for (size_t i = 0; i < count; ++i) {
+            int idx = indexAt(insns.target(i));
+            if (idx >= 0 && isHandlerSetup(insns.opcode(i)))
+                handler[idx] = 1;
+        }
+    }
+
+    /* Before 3.8 a finally block is also entered by the code before it,
+     * with just None pushed, and the END_FINALLY that closes it then drops
+     * only that.  Each END_FINALLY is paired with the handler it closes,
+     * innermost first, so its depth after can come from that normal entry
+     * and not the exception's.  One closing an except handler, which has
+     * no normal entry, only ever reraises. */
+    std::vector<int> closes(count, -1), closedBy(count, -1), normalDepth(count, -1);
+    if (!strict && mod->verCompare(3, 8) < 0) {
+        std::vector<int> open;
+        for (size_t i = 0; i < count; ++i) {
+            if (handler[i])
+                open.push_back((int)i);
+            else if (insns.opcode(i) == Pyc::END_FINALLY && !open.empty()) {
+                closes[i] = open.back();
+                closedBy[open.back()] = (int)i;
+                open.pop_back();
+            }
+        }
+    }
+
+    const StackModel model(mod);
+    std::vector<size_t> work;
+    std::vector<unsigned char> raises(count, 0);
+
+    auto merge = [&](int idx, int depth, int from, bool normal) {
+        if (idx < 0)
+            return;
+        if (depth < 0) {
+            fail(STACK_UNDERFLOW, from);
+            return;
+        }
+        if (normal && closedBy[idx] >= 0 && depth > normalDepth[idx]) {
+            normalDepth[idx] = depth;
+            // Its END_FINALLY may already have been walked without this
+            if (m_depths[closedBy[idx]] >= 0)
+                work.push_back(closedBy[idx]);
+        }
+        int& known = m_depths[idx];
+        if (known == depth)
+            return;
+        if (known >= 0) {
+            if (!handler[idx]) {
+                m_conflicts.push_back(insns.offset(idx));
+                if (strict)
+                    fail(STACK_INCONSISTENT, insns.offset(idx));
+            }
+            if (depth < known)
+                return;
+            if (++raises[idx] > MAX_RAISES) {
+                fail(STACK_UNBOUNDED, insns.offset(idx));
+                return;
+            }
+        }
+        known = depth;
+        work.push_back(idx);
+    };
+
+    m_depths[0] = 0;
+    work.push_back(0);
+    while (!work.empty() && m_status == STACK_OK) {
+        const size_t idx = work.back();
+        work.pop_back();
+        const int offset = insns.offset(idx);
+        const int opcode = insns.opcode(idx);
+        const int depth = m_depths[idx];
+
+        int fall, jump;
+        if (!model.effect(opcode, insns.operand(idx), fall, jump)) {
+            fail(STACK_UNKNOWN_OPCODE, offset);
+            break;
+        }
+        bool falls = fallsThrough(opcode);
+        if (closes[idx] >= 0) {
+            // Back to where the normal entry was, less its None.  With no
+            // normal entry (yet), all it does is reraise.
+            const int entry = closes[idx];
+            if (normalDepth[entry] >= 0)
+                fall = normalDepth[entry] - m_depths[entry] - 1;
+            else
+                falls = false;
+        }
+        if (depth + fall < 0) {
+            fail(STACK_UNDERFLOW, offset);
+            break;
+        }
+
+        const PycExceptionTable::Entry* entry = exceptions.find(offset);
+        if (entry)
+            merge(indexAt(entry->target), entry->depth + (entry->lasti ? 1 : 0) + 1, offset, false);
+        if (falls && idx + 1 < count)
+            merge((int)idx + 1, depth + fall, offset, true);
+
+        /* The jump is queued last so it is walked first.  A finally block
+         * then gets its handler depth before the code falling into it
+         * arrives with a smaller one. */
+        if (insns.target(idx) >= 0 && opcode != Pyc::BREAK_LOOP && opcode != Pyc::CONTINUE_LOOP_A)
+            merge(indexAt(insns.target(idx)), depth + jump, offset, !isHandlerSetup(opcode));
+    }
+
+    std::sort(m_conflicts.begin(), m_conflicts.end());
+    m_conflicts.erase(std::unique(m_conflicts.begin(), m_conflicts.end()), m_conflicts.end());
+}
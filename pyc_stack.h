@@ -0,0 +1,62 @@
+#ifndef _PYC_STACK_H
+#define _PYC_STACK_H
+
+#include <cstddef>
+#include <vector>
+
+class PycInstructions;
+class PycExceptionTable;
+class PycModule;
+
+/* The value stack depth before every instruction of a code object, worked
+ * out by abstract interpretation over each version's stack effects, the
+ * way CPython computes co_stacksize.  Handler entries come from the SETUP_*
+ * instructions before 3.11 and from the exception table after.
+ *
+ * Where paths meet with different depths the larger one is kept.  Before
+ * 3.9 a finally block is entered both normally (with None pushed) and by an
+ * exception (with 3 or 6 values pushed), so handlers are allowed to differ;
+ * anywhere else, and anywhere at all from 3.9 on, it is an inconsistent
+ * merge.  Before 3.8 the END_FINALLY closing such a block goes back to the
+ * depth of its normal entry.
+ *
+ * Before 3.9 the analysis is only advisory: the bytecode is less regular
+ * there, and the builder goes ahead whatever it finds. */
+class PycStackDepth {
+public:
+    enum Status {
+        STACK_OK,
+        STACK_UNKNOWN_OPCODE,   // An instruction with no known stack effect
+        STACK_UNDERFLOW,        // Something pops more than the stack holds
+        STACK_INCONSISTENT,     // Paths meet with different depths
+        STACK_UNBOUNDED,        // The depth grows around a loop
+    };
+
+    PycStackDepth() : m_status(STACK_OK), m_errorOffset(-1) { }
+
+    void analyze(const PycInstructions& insns, const PycExceptionTable& exceptions,
+                 PycModule* mod);
+
+    Status status() const { return m_status; }
+    bool ok() const { return m_status == STACK_OK; }
+    const char* statusText() const;
+
+    /* Where the first problem was found, or -1 */
+    int errorOffset() const { return m_errorOffset; }
+
+    /* The depth before the instruction, or -1 if it can't be reached */
+    int depthAt(size_t idx) const { return m_depths[idx]; }
+
+    /* Offsets where paths meet with different depths */
+    const std::vector<int>& conflicts() const { return m_conflicts; }
+
+private:
+    void fail(Status status, int offset);
+
+    Status m_status;
+    int m_errorOffset;
+    std::vector<int> m_depths;
+    std::vector<int> m_conflicts;
+};
+
+#endif
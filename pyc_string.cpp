@@ -3,47 +3,46 @@
 #include "data.h"
 #include <stdexcept>
 
-static bool check_ascii(const std::string& data)
+static bool check_ascii(const char* data, size_t length)
 {
-    auto cp = reinterpret_cast<const unsigned char*>(data.c_str());
-    while (*cp) {
-        if (*cp & 0x80)
+    auto cp = reinterpret_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < length; ++i) {
+        if (cp[i] & 0x80)
             return false;
-        ++cp;
     }
     return true;
 }
 
 /* PycString */
-void PycString::load(PycData* stream, PycModule* mod)
+void PycString::load(PycReader& stream, PycModule* mod)
 {
+    // Intern slots are keyed by the offset of the type byte before us
+    size_t offset = stream.pos() - 1;
+
     if (type() == TYPE_STRINGREF) {
-        PycRef<PycString> str = mod->getIntern(stream->get32());
+        PycRef<PycString> str = mod->getIntern(stream.u32());
         m_type = str->m_type;
-        m_value = str->m_value;
+        m_data = str->m_data;
+        m_length = str->m_length;
     } else {
-        int length;
+        size_t length;
         if (type() == TYPE_SHORT_ASCII || type() == TYPE_SHORT_ASCII_INTERNED)
-            length = stream->getByte();
+            length = stream.u8();
         else
-            length = stream->get32();
-
-        if (length < 0)
-            throw std::bad_alloc();
+            length = stream.u32();
 
-        m_value.resize(length);
-        if (length) {
-            stream->getBuffer(length, &m_value.front());
-            if (type() == TYPE_ASCII || type() == TYPE_ASCII_INTERNED ||
-                    type() == TYPE_SHORT_ASCII || type() == TYPE_SHORT_ASCII_INTERNED) {
-                if (!check_ascii(m_value))
-                    throw std::runtime_error("Invalid bytes in ASCII string");
-            }
+        // Zero-copy: the module keeps its input buffer alive
+        m_data = (const char*)stream.read(length);
+        m_length = length;
+        if (type() == TYPE_ASCII || type() == TYPE_ASCII_INTERNED ||
+                type() == TYPE_SHORT_ASCII || type() == TYPE_SHORT_ASCII_INTERNED) {
+            if (!check_ascii(m_data, m_length))
+                throw std::runtime_error("Invalid bytes in ASCII string");
         }
 
         if (type() == TYPE_INTERNED || type() == TYPE_ASCII_INTERNED ||
                 type() == TYPE_SHORT_ASCII_INTERNED)
-            mod->intern(this);
+            mod->intern(this, offset);
     }
 }
 
@@ -53,7 +52,8 @@ bool PycString::isEqual(PycRef<PycObject> obj) const
         return false;
 
     PycRef<PycString> strObj = obj.cast<PycString>();
-    return isEqual(strObj->m_value);
+    return m_length == strObj->m_length
+           && memcmp(m_data, strObj->m_data, m_length) == 0;
 }
 
 void PycString::print(std::ostream &pyc_output, PycModule* mod, bool triple,
@@ -84,7 +84,7 @@ void PycString::print(std::ostream &pyc_output, PycModule* mod, bool triple,
     if (prefix != 0)
         pyc_output << prefix;
 
-    if (m_value.empty()) {
+    if (m_length == 0) {
         pyc_output << "''";
         return;
     }
@@ -92,7 +92,8 @@ void PycString::print(std::ostream &pyc_output, PycModule* mod, bool triple,
     // Determine preferred quote style (Emulate Python's method)
     bool useQuotes = false;
     if (!parent_f_string_quote) {
-        for (char ch : m_value) {
+        for (size_t i = 0; i < m_length; ++i) {
+            char ch = m_data[i];
             if (ch == '\'') {
                 useQuotes = true;
             } else if (ch == '"') {
@@ -111,7 +112,8 @@ void PycString::print(std::ostream &pyc_output, PycModule* mod, bool triple,
         else
             pyc_output << (useQuotes ? '"' : '\'');
     }
-    for (char ch : m_value) {
+    for (size_t i = 0; i < m_length; ++i) {
+        char ch = m_data[i];
         if (static_cast<unsigned char>(ch) < 0x20 || ch == 0x7F) {
             if (ch == '\r') {
                 pyc_output << "\\r";
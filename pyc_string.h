@@ -4,34 +4,52 @@
 #include "pyc_object.h"
 #include "data.h"
 #include <cstdio>
+#include <cstring>
 #include <string>
 
+/* Strings loaded from a module hold a view into the module's input buffer,
+ * which stays valid for the lifetime of the PycModule.  Strings built with
+ * setValue() own their data instead.  Either way, data() is NOT terminated;
+ * use length() or strValue(). */
 class PycString : public PycObject {
 public:
     PycString(int type = TYPE_STRING)
-        : PycObject(type) { }
+        : PycObject(type), m_data(""), m_length() { }
+
+    PycString(const PycString&) = delete;
+    PycString& operator=(const PycString&) = delete;
 
     bool isEqual(PycRef<PycObject> obj) const override;
-    bool isEqual(const std::string& str) const { return m_value == str; }
+    bool isEqual(const std::string& str) const
+    {
+        return str.size() == m_length && memcmp(m_data, str.data(), m_length) == 0;
+    }
 
     bool startsWith(const std::string& str) const
     {
-        return m_value.substr(0, str.size()) == str;
+        return str.size() <= m_length && memcmp(m_data, str.data(), str.size()) == 0;
     }
 
-    void load(class PycData* stream, class PycModule* mod) override;
+    void load(class PycReader& stream, class PycModule* mod) override;
 
-    int length() const { return (int)m_value.size(); }
-    const char* value() const { return m_value.c_str(); }
-    const std::string &strValue() const { return m_value; }
+    size_t length() const { return m_length; }
+    const char* data() const { return m_data; }
+    std::string strValue() const { return std::string(m_data, m_length); }
 
-    void setValue(std::string str) { m_value = std::move(str); }
+    void setValue(std::string str)
+    {
+        m_owned = std::move(str);
+        m_data = m_owned.data();
+        m_length = m_owned.size();
+    }
 
     void print(std::ostream& stream, class PycModule* mod, bool triple = false,
                const char* parent_f_string_quote = nullptr);
 
 private:
-    std::string m_value;
+    const char* m_data;
+    size_t m_length;
+    std::string m_owned;
 };
 
 #endif
@@ -2,11 +2,13 @@
 #include <cstring>
 #include <cstdarg>
 #include <string>
+#include <vector>
 #include <iostream>
 #include <fstream>
 #include "pyc_module.h"
 #include "pyc_numeric.h"
 #include "bytecode.h"
+#include "pyc_archive.h"
 
 #ifdef WIN32
 #  define PATHSEP '\\'
@@ -73,6 +75,32 @@ static void iprintf(std::ostream& pyc_output, int indent, const char* fmt, ...)
     va_end(varargs);
 }
 
+static void print_block_list(const std::vector<int>& list, std::ostream& pyc_output)
+{
+    if (list.empty())
+        pyc_output << " -";
+    for (int idx : list)
+        formatted_print(pyc_output, " %d", idx);
+}
+
+static void print_cfg(const PycCFG& cfg, int indent, std::ostream& pyc_output)
+{
+    for (size_t idx = 0; idx < cfg.size(); ++idx) {
+        const PycCFG::Block& blk = cfg.block(idx);
+        iprintf(pyc_output, indent, "Block %d: %d-%d  preds:", (int)idx, blk.start, blk.end);
+        print_block_list(blk.preds, pyc_output);
+        pyc_output << "  succs:";
+        print_block_list(blk.succs, pyc_output);
+        if (!cfg.reachable(idx))
+            pyc_output << "  (unreachable)";
+        else if (blk.idom >= 0)
+            formatted_print(pyc_output, "  idom: %d", blk.idom);
+        if (blk.ipdom >= 0)
+            formatted_print(pyc_output, "  ipdom: %d", blk.ipdom);
+        pyc_output << "\n";
+    }
+}
+
 void output_object(PycRef<PycObject> obj, PycModule* mod, int indent,
                    unsigned flags, std::ostream& pyc_output)
 {
@@ -87,22 +115,22 @@ void output_object(PycRef<PycObject> obj, PycModule* mod, int indent,
         {
             PycRef<PycCode> codeObj = obj.cast<PycCode>();
             iputs(pyc_output, indent, "[Code]\n");
-            iprintf(pyc_output, indent + 1, "File Name: %s\n", codeObj->fileName()->value());
-            iprintf(pyc_output, indent + 1, "Object Name: %s\n", codeObj->name()->value());
-            if (mod->verCompare(3, 11) >= 0)
-                iprintf(pyc_output, indent + 1, "Qualified Name: %s\n", codeObj->qualName()->value());
+            iprintf(pyc_output, indent + 1, "File Name: %s\n", codeObj->fileName()->strValue().c_str());
+            iprintf(pyc_output, indent + 1, "Object Name: %s\n", codeObj->name()->strValue().c_str());
+            if (mod->has(PycModule::FEAT_QUALNAME))
+                iprintf(pyc_output, indent + 1, "Qualified Name: %s\n", codeObj->qualName()->strValue().c_str());
             iprintf(pyc_output, indent + 1, "Arg Count: %d\n", codeObj->argCount());
-            if (mod->verCompare(3, 8) >= 0)
+            if (mod->has(PycModule::FEAT_POSONLY))
                 iprintf(pyc_output, indent + 1, "Pos Only Arg Count: %d\n", codeObj->posOnlyArgCount());
-            if (mod->majorVer() >= 3)
+            if (mod->has(PycModule::FEAT_KWONLY))
                 iprintf(pyc_output, indent + 1, "KW Only Arg Count: %d\n", codeObj->kwOnlyArgCount());
-            if (mod->verCompare(3, 11) < 0)
+            if (!mod->has(PycModule::FEAT_LOCALS_PLUS))
                 iprintf(pyc_output, indent + 1, "Locals: %d\n", codeObj->numLocals());
-            if (mod->verCompare(1, 5) >= 0)
+            if (mod->has(PycModule::FEAT_LINE_TABLE))
                 iprintf(pyc_output, indent + 1, "Stack Size: %d\n", codeObj->stackSize());
-            if (mod->verCompare(1, 3) >= 0) {
+            if (mod->has(PycModule::FEAT_LOCAL_NAMES)) {
                 unsigned int orig_flags = codeObj->flags();
-                if (mod->verCompare(3, 8) < 0) {
+                if (!mod->has(PycModule::FEAT_SHIFTED_FUTURE_FLAGS)) {
                     // Remap flags back to the value stored in the PyCode object
                     orig_flags = (orig_flags & 0xFFFF) | ((orig_flags & 0xFFF00000) >> 4);
                 }
@@ -111,49 +139,64 @@ void output_object(PycRef<PycObject> obj, PycModule* mod, int indent,
             }
 
             iputs(pyc_output, indent + 1, "[Names]\n");
-            for (int i=0; i<codeObj->names()->size(); i++)
+            for (size_t i=0; i<codeObj->names()->size(); i++)
                 output_object(codeObj->names()->get(i), mod, indent + 2, flags, pyc_output);
 
-            if (mod->verCompare(1, 3) >= 0) {
-                if (mod->verCompare(3, 11) >= 0)
+            if (mod->has(PycModule::FEAT_LOCAL_NAMES)) {
+                if (mod->has(PycModule::FEAT_LOCALS_PLUS))
                     iputs(pyc_output, indent + 1, "[Locals+Names]\n");
                 else
                     iputs(pyc_output, indent + 1, "[Var Names]\n");
-                for (int i=0; i<codeObj->localNames()->size(); i++)
+                for (size_t i=0; i<codeObj->localNames()->size(); i++)
                     output_object(codeObj->localNames()->get(i), mod, indent + 2, flags, pyc_output);
             }
 
-            if (mod->verCompare(3, 11) >= 0 && (flags & Pyc::DISASM_PYCODE_VERBOSE) != 0) {
+            if (mod->has(PycModule::FEAT_LOCALS_PLUS) && (flags & Pyc::DISASM_PYCODE_VERBOSE) != 0) {
                 iputs(pyc_output, indent + 1, "[Locals+Kinds]\n");
                 output_object(codeObj->localKinds().cast<PycObject>(), mod, indent + 2, flags, pyc_output);
             }
 
-            if (mod->verCompare(2, 1) >= 0 && mod->verCompare(3, 11) < 0) {
+            if (mod->has(PycModule::FEAT_CLOSURES) && !mod->has(PycModule::FEAT_LOCALS_PLUS)) {
                 iputs(pyc_output, indent + 1, "[Free Vars]\n");
-                for (int i=0; i<codeObj->freeVars()->size(); i++)
+                for (size_t i=0; i<codeObj->freeVars()->size(); i++)
                     output_object(codeObj->freeVars()->get(i), mod, indent + 2, flags, pyc_output);
 
                 iputs(pyc_output, indent + 1, "[Cell Vars]\n");
-                for (int i=0; i<codeObj->cellVars()->size(); i++)
+                for (size_t i=0; i<codeObj->cellVars()->size(); i++)
                     output_object(codeObj->cellVars()->get(i), mod, indent + 2, flags, pyc_output);
             }
 
             iputs(pyc_output, indent + 1, "[Constants]\n");
-            for (int i=0; i<codeObj->consts()->size(); i++)
+            for (size_t i=0; i<codeObj->consts()->size(); i++)
                 output_object(codeObj->consts()->get(i), mod, indent + 2, flags, pyc_output);
 
             iputs(pyc_output, indent + 1, "[Disassembly]\n");
             bc_disasm(pyc_output, codeObj, mod, indent + 2, flags);
 
-            if (mod->verCompare(1, 5) >= 0 && (flags & Pyc::DISASM_PYCODE_VERBOSE) != 0) {
+            if ((flags & Pyc::DISASM_SHOW_CFG) != 0) {
+                iputs(pyc_output, indent + 1, "[Control Flow]\n");
+                print_cfg(codeObj->cfg(mod), indent + 2, pyc_output);
+            }
+
+            if (mod->has(PycModule::FEAT_LINE_TABLE) && (flags & Pyc::DISASM_PYCODE_VERBOSE) != 0) {
                 iprintf(pyc_output, indent + 1, "First Line: %d\n", codeObj->firstLine());
                 iputs(pyc_output, indent + 1, "[Line Number Table]\n");
                 output_object(codeObj->lnTable().cast<PycObject>(), mod, indent + 2, flags, pyc_output);
+                const PycLineTable& lines = codeObj->lineIndex(mod);
+                for (size_t i = 0; i < lines.size(); ++i)
+                    iprintf(pyc_output, indent + 2, "%d: %d\n", lines.start(i), lines.line(i));
             }
 
-            if (mod->verCompare(3, 11) >= 0 && (flags & Pyc::DISASM_PYCODE_VERBOSE) != 0) {
+            if (mod->has(PycModule::FEAT_EXCEPTION_TABLE) && (flags & Pyc::DISASM_PYCODE_VERBOSE) != 0) {
                 iputs(pyc_output, indent + 1, "[Exception Table]\n");
                 output_object(codeObj->exceptTable().cast<PycObject>(), mod, indent + 2, flags, pyc_output);
+                const PycExceptionTable& exceptions = codeObj->exceptionIndex();
+                for (size_t i = 0; i < exceptions.size(); ++i) {
+                    const PycExceptionTable::Entry& entry = exceptions.entry(i);
+                    iprintf(pyc_output, indent + 2, "%d to %d -> %d [%d]%s\n",
+                            entry.start, entry.end, entry.target, entry.depth,
+                            entry.lasti ? " lasti" : "");
+                }
             }
         }
         break;
@@ -248,10 +291,107 @@ void output_object(PycRef<PycObject> obj, PycModule* mod, int indent,
     }
 }
 
+static int disassemble_module(PycModule& mod, const char* filename, const char* dispname,
+                              unsigned disasm_flags, std::ostream& pyc_output)
+{
+    formatted_print(pyc_output, "%s (Python %d.%d%s)\n", dispname,
+                    mod.majorVer(), mod.minorVer(),
+                    (mod.majorVer() < 3 && mod.isUnicode()) ? " -U" : "");
+    try {
+        output_object(mod.code().try_cast<PycObject>(), &mod, 0, disasm_flags,
+                      pyc_output);
+    } catch (std::exception& ex) {
+        fprintf(stderr, "Error disassembling %s: %s\n", filename, ex.what());
+        return 1;
+    }
+    return 0;
+}
+
+/* Prints one tab-separated record for a .pyc header, leaving out the
+ * fields the file's version doesn't have. */
+static int print_header(const char* filename, std::ostream& pyc_output)
+{
+    PycModule mod;
+    try {
+        if (!mod.loadHeaderFromFile(filename)) {
+            fprintf(stderr, "Error opening file %s\n", filename);
+            return 1;
+        }
+    } catch (std::exception& ex) {
+        fprintf(stderr, "Error reading header of %s: %s\n", filename, ex.what());
+        return 1;
+    }
+
+    const PycModule::Header& header = mod.header();
+    if (!mod.isValid()) {
+        formatted_print(pyc_output, "%s\tversion=unknown\tmagic=0x%08x\n", filename,
+                        header.magic);
+        return 0;
+    }
+    formatted_print(pyc_output, "%s\tversion=%d.%d\tmagic=0x%08x\tunicode=%d", filename,
+                    mod.majorVer(), mod.minorVer(), header.magic, mod.isUnicode() ? 1 : 0);
+    if (mod.has(PycModule::FEAT_HEADER_FLAGS))
+        formatted_print(pyc_output, "\tflags=0x%x", header.flags);
+    if (header.flags & PycModule::Header::FLAG_HASH_BASED) {
+        pyc_output << "\thash=";
+        for (unsigned char byte : header.hash)
+            formatted_print(pyc_output, "%02x", byte);
+        pyc_output << '\n';
+    } else {
+        formatted_print(pyc_output, "\tmtime=%u", header.timestamp);
+        if (mod.has(PycModule::FEAT_SOURCE_SIZE))
+            formatted_print(pyc_output, "\tsize=%u", header.sourceSize);
+        pyc_output << '\n';
+    }
+    return 0;
+}
+
+static int disassemble_archive(const PycArchive& archive, const std::string& path,
+                               unsigned disasm_flags, std::ostream& pyc_output)
+{
+    int result = 0;
+    for (const auto& entry : archive.entries()) {
+        std::string entry_path = path + '/' + entry.name;
+        if (entry.format == PycArchive::FORMAT_ARCHIVE) {
+            // e.g. the PYZ inside a PyInstaller executable
+            std::unique_ptr<PycArchive> nested;
+            try {
+                std::unique_ptr<PycBuffer> source = archive.open(entry);
+                nested = PycArchive::fromBuffer(source);
+            } catch (std::exception& ex) {
+                fprintf(stderr, "Error disassembling %s: %s\n", entry_path.c_str(),
+                        ex.what());
+                result = 1;
+                continue;
+            }
+            if (nested && disassemble_archive(*nested, entry_path, disasm_flags,
+                                              pyc_output) != 0)
+                result = 1;
+            continue;
+        }
+        if (!PycArchive::isModule(entry))
+            continue;
+
+        PycModule mod;
+        try {
+            archive.loadModule(entry, mod);
+        } catch (std::exception& ex) {
+            fprintf(stderr, "Error disassembling %s: %s\n", entry_path.c_str(), ex.what());
+            result = 1;
+            continue;
+        }
+        if (disassemble_module(mod, entry_path.c_str(), entry.name.c_str(), disasm_flags,
+                               pyc_output) != 0)
+            result = 1;
+    }
+    return result;
+}
+
 int main(int argc, char* argv[])
 {
-    const char* infile = nullptr;
+    std::vector<const char*> infiles;
     bool marshalled = false;
+    bool header_only = false;
     const char* version = nullptr;
     unsigned disasm_flags = 0;
     std::ostream* pyc_output = &std::cout;
@@ -285,33 +425,65 @@ int main(int argc, char* argv[])
             disasm_flags |= Pyc::DISASM_PYCODE_VERBOSE;
         } else if (strcmp(argv[arg], "--show-caches") == 0) {
             disasm_flags |= Pyc::DISASM_SHOW_CACHES;
+        } else if (strcmp(argv[arg], "--cfg") == 0) {
+            disasm_flags |= Pyc::DISASM_SHOW_CFG;
+        } else if (strcmp(argv[arg], "--lines") == 0) {
+            disasm_flags |= Pyc::DISASM_SHOW_LINES;
+        } else if (strcmp(argv[arg], "--header-only") == 0) {
+            header_only = true;
         } else if (strcmp(argv[arg], "--help") == 0 || strcmp(argv[arg], "-h") == 0) {
-            fprintf(stderr, "Usage:  %s [options] input.pyc\n\n", argv[0]);
+            fprintf(stderr, "Usage:  %s [options] input.pyc|archive\n", argv[0]);
+            fprintf(stderr, "        %s [options] --header-only input.pyc [...]\n\n", argv[0]);
             fputs("Options:\n", stderr);
             fputs("  -o <filename>  Write output to <filename> (default: stdout)\n", stderr);
             fputs("  -c             Specify loading a compiled code object. Requires the version to be set\n", stderr);
             fputs("  -v <x.y>       Specify a Python version for loading a compiled code object\n", stderr);
             fputs("  --pycode-extra Show extra fields in PyCode object dumps\n", stderr);
             fputs("  --show-caches  Don't suprress CACHE instructions in Python 3.11+ disassembly\n", stderr);
+            fputs("  --cfg          Show each code object's basic blocks and (post-)dominators\n", stderr);
+            fputs("  --lines        Show the source line of each instruction in the disassembly\n", stderr);
+            fputs("  --header-only  Only print a one-line summary of each file's header\n", stderr);
             fputs("  --help         Show this help text and then exit\n", stderr);
             return 0;
         } else if (argv[arg][0] == '-') {
             fprintf(stderr, "Error: Unrecognized argument %s\n", argv[arg]);
             return 1;
         } else {
-            infile = argv[arg];
+            infiles.push_back(argv[arg]);
         }
     }
 
-    if (!infile) {
+    if (infiles.empty()) {
         fputs("No input file specified\n", stderr);
         return 1;
     }
 
+    if (header_only) {
+        int result = 0;
+        for (const char* filename : infiles) {
+            if (print_header(filename, *pyc_output) != 0)
+                result = 1;
+        }
+        return result;
+    }
+    if (infiles.size() > 1) {
+        fputs("Multiple input files are only supported with --header-only\n", stderr);
+        return 1;
+    }
+    const char* infile = infiles[0];
+
     PycModule mod;
     if (!marshalled) {
         try {
-            mod.loadFromFile(infile);
+            std::unique_ptr<PycBuffer> source = OpenInputFile(infile);
+            if (!source->isOpen()) {
+                fprintf(stderr, "Error opening file %s\n", infile);
+            } else {
+                std::unique_ptr<PycArchive> archive = PycArchive::fromBuffer(source);
+                if (archive)
+                    return disassemble_archive(*archive, infile, disasm_flags, *pyc_output);
+                mod.loadFromBuffer(std::move(source));
+            }
         } catch (std::exception &ex) {
             fprintf(stderr, "Error disassembling %s: %s\n", infile, ex.what());
             return 1;
@@ -333,16 +505,5 @@ int main(int argc, char* argv[])
     }
     const char* dispname = strrchr(infile, PATHSEP);
     dispname = (dispname == NULL) ? infile : dispname + 1;
-    formatted_print(*pyc_output, "%s (Python %d.%d%s)\n", dispname,
-                    mod.majorVer(), mod.minorVer(),
-                    (mod.majorVer() < 3 && mod.isUnicode()) ? " -U" : "");
-    try {
-        output_object(mod.code().try_cast<PycObject>(), &mod, 0, disasm_flags,
-                      *pyc_output);
-    } catch (std::exception& ex) {
-        fprintf(stderr, "Error disassembling %s: %s\n", infile, ex.what());
-        return 1;
-    }
-
-    return 0;
+    return disassemble_module(mod, infile, dispname, disasm_flags, *pyc_output);
 }
@@ -1,7 +1,11 @@
+#include <algorithm>
+#include <cctype>
 #include <cstring>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include "ASTree.h"
+#include "pyc_archive.h"
 
 #ifdef WIN32
 #  define PATHSEP '\\'
@@ -9,6 +13,125 @@
 #  define PATHSEP '/'
 #endif
 
+/* Writes a tab-separated line for each decompiled statement: the output
+ * line it starts on, then the source line and bytecode offset it was
+ * compiled from and the name of its code object.  Output lines count on
+ * across all the modules written to the same output. */
+class SourceMapWriter {
+public:
+    explicit SourceMapWriter(std::ostream& out) : m_out(out), m_lines() { }
+
+    void write(const char* dispname, const std::string& text, const SourceMap& map,
+               PycModule* mod);
+
+private:
+    std::ostream& m_out;
+    int m_lines;
+};
+
+void SourceMapWriter::write(const char* dispname, const std::string& text,
+                            const SourceMap& map, PycModule* mod)
+{
+    formatted_print(m_out, "# File: %s\n", dispname);
+
+    // The entries come in output order, so one pass counts the lines
+    size_t pos = 0;
+    int line = m_lines + 1;
+    for (const auto& entry : map) {
+        for (; pos < text.size() && (std::streamoff)pos < entry.outPos; ++pos) {
+            if (text[pos] == '\n')
+                ++line;
+        }
+        // Some statements open with blank lines; point at their text
+        int text_line = line;
+        for (size_t ahead = pos; ahead < text.size() && isspace((unsigned char)text[ahead]); ++ahead) {
+            if (text[ahead] == '\n')
+                ++text_line;
+        }
+
+        PycRef<PycString> name = entry.code->qualName();
+        if (name->length() == 0)
+            name = entry.code->name();
+        formatted_print(m_out, "%d\t%d\t%d\t%s\n", text_line,
+                        entry.code->lineIndex(mod).lineAt(entry.offset), entry.offset,
+                        name->strValue().c_str());
+    }
+    m_lines += (int)std::count(text.begin(), text.end(), '\n');
+}
+
+static int decompile_module(PycModule& mod, const char* filename,
+                            const char* dispname, std::ostream& pyc_output,
+                            SourceMapWriter* map_writer)
+{
+    if (!mod.isValid()) {
+        fprintf(stderr, "Could not load file %s\n", filename);
+        return 1;
+    }
+
+    // Statement positions are taken with tellp(), which needs a buffer
+    std::ostringstream mapped_output;
+    std::ostream& out = map_writer ? mapped_output : pyc_output;
+    SourceMap source_map;
+
+    out << "# Source Generated with Decompyle++\n";
+    formatted_print(out, "# File: %s (Python %d.%d%s)\n\n", dispname,
+                    mod.majorVer(), mod.minorVer(),
+                    (mod.majorVer() < 3 && mod.isUnicode()) ? " Unicode" : "");
+    int result = 0;
+    try {
+        decompyle(mod.code(), &mod, out, map_writer ? &source_map : nullptr);
+    } catch (std::exception& ex) {
+        fprintf(stderr, "Error decompyling %s: %s\n", filename, ex.what());
+        result = 1;
+    }
+
+    if (map_writer) {
+        const std::string text = mapped_output.str();
+        map_writer->write(dispname, text, source_map, &mod);
+        pyc_output << text;
+    }
+    return result;
+}
+
+static int decompile_archive(const PycArchive& archive, const std::string& path,
+                             std::ostream& pyc_output, SourceMapWriter* map_writer)
+{
+    int result = 0;
+    for (const auto& entry : archive.entries()) {
+        std::string entry_path = path + '/' + entry.name;
+        if (entry.format == PycArchive::FORMAT_ARCHIVE) {
+            // e.g. the PYZ inside a PyInstaller executable
+            std::unique_ptr<PycArchive> nested;
+            try {
+                std::unique_ptr<PycBuffer> source = archive.open(entry);
+                nested = PycArchive::fromBuffer(source);
+            } catch (std::exception& ex) {
+                fprintf(stderr, "Error loading file %s: %s\n", entry_path.c_str(), ex.what());
+                result = 1;
+                continue;
+            }
+            if (nested && decompile_archive(*nested, entry_path, pyc_output, map_writer) != 0)
+                result = 1;
+            continue;
+        }
+        if (!PycArchive::isModule(entry))
+            continue;
+
+        PycModule mod;
+        try {
+            archive.loadModule(entry, mod);
+        } catch (std::exception& ex) {
+            fprintf(stderr, "Error loading file %s: %s\n", entry_path.c_str(), ex.what());
+            result = 1;
+            continue;
+        }
+        if (decompile_module(mod, entry_path.c_str(), entry.name.c_str(), pyc_output,
+                             map_writer) != 0)
+            result = 1;
+    }
+    return result;
+}
+
 int main(int argc, char* argv[])
 {
     const char* infile = nullptr;
@@ -16,6 +139,8 @@ int main(int argc, char* argv[])
     const char* version = nullptr;
     std::ostream* pyc_output = &std::cout;
     std::ofstream out_file;
+    std::ofstream map_file;
+    std::unique_ptr<SourceMapWriter> map_writer;
 
     for (int arg = 1; arg < argc; ++arg) {
         if (strcmp(argv[arg], "-o") == 0) {
@@ -32,6 +157,21 @@ int main(int argc, char* argv[])
                 fputs("Option '-o' requires a filename\n", stderr);
                 return 1;
             }
+        } else if (strcmp(argv[arg], "--source-map") == 0) {
+            if (arg + 1 < argc) {
+                const char* filename = argv[++arg];
+                map_file.open(filename, std::ios_base::out);
+                if (map_file.fail()) {
+                    fprintf(stderr, "Error opening file '%s' for writing\n",
+                            filename);
+                    return 1;
+                }
+                map_file << "# Output line, source line, offset, code object\n";
+                map_writer.reset(new SourceMapWriter(map_file));
+            } else {
+                fputs("Option '--source-map' requires a filename\n", stderr);
+                return 1;
+            }
         } else if (strcmp(argv[arg], "-c") == 0) {
             marshalled = true;
         } else if (strcmp(argv[arg], "-v") == 0) {
@@ -42,11 +182,13 @@ int main(int argc, char* argv[])
                 return 1;
             }
         } else if (strcmp(argv[arg], "--help") == 0 || strcmp(argv[arg], "-h") == 0) {
-            fprintf(stderr, "Usage:  %s [options] input.pyc\n\n", argv[0]);
+            fprintf(stderr, "Usage:  %s [options] input.pyc|archive\n\n", argv[0]);
             fputs("Options:\n", stderr);
             fputs("  -o <filename>  Write output to <filename> (default: stdout)\n", stderr);
             fputs("  -c             Specify loading a compiled code object. Requires the version to be set\n", stderr);
             fputs("  -v <x.y>       Specify a Python version for loading a compiled code object\n", stderr);
+            fputs("  --source-map <filename>\n", stderr);
+            fputs("                 Write the output line, source line and offset of each statement to <filename>\n", stderr);
             fputs("  --help         Show this help text and then exit\n", stderr);
             return 0;
         } else {
@@ -62,7 +204,15 @@ int main(int argc, char* argv[])
     PycModule mod;
     if (!marshalled) {
         try {
-            mod.loadFromFile(infile);
+            std::unique_ptr<PycBuffer> source = OpenInputFile(infile);
+            if (!source->isOpen()) {
+                fprintf(stderr, "Error opening file %s\n", infile);
+            } else {
+                std::unique_ptr<PycArchive> archive = PycArchive::fromBuffer(source);
+                if (archive)
+                    return decompile_archive(*archive, infile, *pyc_output, map_writer.get());
+                mod.loadFromBuffer(std::move(source));
+            }
         } catch (std::exception& ex) {
             fprintf(stderr, "Error loading file %s: %s\n", infile, ex.what());
             return 1;
@@ -83,22 +233,7 @@ int main(int argc, char* argv[])
         mod.loadFromMarshalledFile(infile, major, minor);
     }
 
-    if (!mod.isValid()) {
-        fprintf(stderr, "Could not load file %s\n", infile);
-        return 1;
-    }
     const char* dispname = strrchr(infile, PATHSEP);
     dispname = (dispname == NULL) ? infile : dispname + 1;
-    *pyc_output << "# Source Generated with Decompyle++\n";
-    formatted_print(*pyc_output, "# File: %s (Python %d.%d%s)\n\n", dispname,
-                    mod.majorVer(), mod.minorVer(),
-                    (mod.majorVer() < 3 && mod.isUnicode()) ? " Unicode" : "");
-    try {
-        decompyle(mod.code(), &mod, *pyc_output);
-    } catch (std::exception& ex) {
-        fprintf(stderr, "Error decompyling %s: %s\n", infile, ex.what());
-        return 1;
-    }
-
-    return 0;
+    return decompile_module(mod, infile, dispname, *pyc_output, map_writer.get());
 }
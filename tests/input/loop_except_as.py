@@ -0,0 +1,15 @@
+def read_all(paths):
+    for path in paths:
+        try:
+            data = load(path)
+        except OSError as why:
+            log(why)
+        save(data)
+
+def drain(queue):
+    while queue:
+        try:
+            item = queue.pop()
+        except IndexError as why:
+            item = why
+        queue = item
@@ -0,0 +1,22 @@
+def outer(a):
+    b = a + 1
+
+    def inner(c):
+        return c * 2
+
+    return inner(b)
+
+
+class Shape:
+    sides = 0
+
+    def __init__(self, name):
+        self.name = name
+
+    class Corner:
+
+        def angle(self):
+            return 90
+
+
+result = outer(3)
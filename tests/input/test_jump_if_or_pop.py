@@ -0,0 +1,25 @@
+def either(a, b):
+    return a or b
+
+def both(a, b):
+    return a and b
+
+def capwords(s, sep):
+    return (sep or ' ').join(s.split(sep))
+
+def join(dirname, basename):
+    if not dirname:
+        return dirname or basename
+    return dirname + basename
+
+def is_leap(year):
+    return year % 4 == 0 and (year % 100 != 0 or year % 400 == 0)
+
+def check(value):
+    if not value:
+        raise ValueError(value)
+    return value
+
+x = a or b
+y = a and b and c
+z = a or b and c
@@ -0,0 +1,14 @@
+def parse(text):
+    try:
+        value = int(text)
+    except ValueError:
+        value = None
+    return value
+
+def parse_if(text):
+    if text:
+        try:
+            value = int(text)
+        except ValueError:
+            value = None
+        return value
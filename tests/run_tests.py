@@ -109,6 +109,58 @@ def run_test(test_file):
     return fails, [status_line] + errlines
 
 
+def run_cli_test(test_file):
+    """
+    Runs a tool on a fixture and compares what it prints with the rest of
+    test_file.  Its first line is the command, "$ tool args...", run from the
+    tests directory.  Wherever "{out}" appears in it, a scratch file name is
+    substituted, and what the tool writes there comes first in the output.
+    Then comes its stdout, then its stderr, so that the two can't interleave
+    differently from one platform to the next.  A nonzero exit status is
+    checked as a final "[exit status N]" line.
+    """
+    test_name = os.path.splitext(os.path.basename(test_file))[0]
+    with open(test_file, 'r', encoding='utf-8', errors='replace') as cli_file:
+        command = cli_file.readline()
+        expect = cli_file.read()
+
+    status_line = '\033[1m*** cli/{}:\033[0m '.format(test_name)
+    if not command.startswith('$ '):
+        return 1, [status_line + '\033[31mFAIL\033[0m\n', 'No "$ command" line\n']
+
+    outdir = os.path.join(os.getcwd(), 'tests-out')
+    os.makedirs(outdir, exist_ok=True)
+    out_file = os.path.join(outdir, test_name + '.cli.out')
+    args = command[2:].split()
+    args = [os.path.join(os.getcwd(), args[0])] \
+         + [arg.replace('{out}', out_file).replace('/', os.sep) for arg in args[1:]]
+    if os.path.exists(out_file):
+        os.unlink(out_file)
+
+    proc = subprocess.run(args, cwd=TEST_DIR, stdout=subprocess.PIPE, stderr=subprocess.PIPE,
+                          universal_newlines=True, encoding='utf-8', errors='replace')
+    output = proc.stdout + proc.stderr
+    if os.path.exists(out_file):
+        with open(out_file, 'r', encoding='utf-8', errors='replace') as written:
+            output = written.read() + output
+    if os.sep != '/':
+        output = output.replace(os.sep, '/')
+    if proc.returncode != 0:
+        output += '[exit status {}]\n'.format(proc.returncode)
+    with open(os.path.join(outdir, test_name + '.cli.txt'), 'w') as actual_file:
+        actual_file.write(output)
+
+    if output != expect and 'needs zlib support' in output:
+        return 0, [status_line + '\033[33mSKIP (no zlib)\033[0m\n']
+    if output != expect:
+        diff = difflib.unified_diff(expect.splitlines(True), output.splitlines(True),
+                                    fromfile='cli/{}.txt'.format(test_name),
+                                    tofile='tests-out/{}.cli.txt'.format(test_name))
+        return 1, [status_line + '\033[31mFAIL\033[0m\n'] + list(diff)
+
+    return 0, [status_line + '\033[32mPASS\033[0m\n']
+
+
 def main():
     # For simpler invocation from CMake's check target, we also support setting
     # these parameters via environment variables.
@@ -124,11 +176,15 @@ def main():
 
     glob_pattern = '*{}*.txt'.format(args.filter) if args.filter else '*.txt'
     test_files = sorted(glob.iglob(os.path.join(TEST_DIR, 'tokenized', glob_pattern)))
+    cli_files = sorted(glob.iglob(os.path.join(TEST_DIR, 'cli', glob_pattern)))
     total_fails = 0
     with multiprocessing.Pool(args.jobs) as pool:
         for fails, output in pool.imap(run_test, test_files):
             total_fails += fails
             sys.stdout.writelines(output)
+        for fails, output in pool.imap(run_cli_test, cli_files):
+            total_fails += fails
+            sys.stdout.writelines(output)
 
     if total_fails:
         print('{} test(s) failed'.format(total_fails))